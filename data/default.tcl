@@ -14,3 +14,7 @@ input:bind2 MOUSE_LEFT {
 } {
   puts UP([input:mouseX]x[input:mouseY])
 }
+
+# Simulation
+sim:tickRate 30
+sim:maxCatchUp 5
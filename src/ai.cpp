@@ -0,0 +1,449 @@
+#include "ai.h"
+#include "player.h"
+#include "spatial.h"
+#include "fog.h"
+#include "collide.h"
+#include "fixed.h"
+#include "world.h"
+#include "platform.h"
+#include "util.h"
+#include "tcl.h"
+
+#include <memory.h>
+#include <deque>
+#include <algorithm>
+
+namespace ai
+{
+  namespace {
+    // Nominal cost of one decision, measured on a crowded map. Turns the
+    // budget into a decision count that is the same on every machine.
+    const uint32_t DECISION_COST_NS = 300;
+
+    // Engaged units stop this close to their target
+    const math::Fixed ATTACK_RANGE = math::Fixed::fromInt(1);
+
+    // Enemies a decision may look at, keeps a unit facing a large army from
+    // scanning all of it
+    const uint32_t MAX_VISITED = 64;
+
+    struct Slot
+    {
+      unit::ID id;      // Unit the slot was last used by
+      unit::ID target;  // INVALID_ID when not engaged
+      uint32_t queued;  // Whether id is in the combat queue
+      float vx, vz;     // Velocity towards the target at the last decision
+    };
+
+    struct Engaged
+    {
+      unit::ID id;
+      uint32_t pad;
+      uint64_t due;     // Tick of the next decision
+    };
+
+    struct Owner
+    {
+      uint32_t player;
+      float speed;
+    };
+
+    uint32_t _quota = 250 * 1000 / DECISION_COST_NS;
+    uint32_t _combatInterval = 6;
+    float _engageRadius = 12.0f;
+
+    uint64_t _tick = 0;
+    uint32_t _cursorPlayer = 0;
+    uint32_t _cursorIndex = 0;
+
+    // Per unit registry slot
+    std::vector<Slot> _slots;
+
+    // Sorted by due tick, ties in the order they were added
+    std::deque<Engaged> _combat;
+
+    // Per storage registry index, rebuilt every tick
+    std::vector<Owner> _owners;
+
+    Stats _stats;
+  }
+
+  void setBudget(uint32_t microseconds)
+  {
+    _quota = (uint32_t)((uint64_t)microseconds * 1000 / DECISION_COST_NS);
+    if (_quota == 0)
+      _quota = 1;
+  }
+
+  uint32_t decisionsPerTick()
+  {
+    return _quota;
+  }
+
+  void setCombatInterval(uint32_t ticks)
+  {
+    _combatInterval = ticks > 0 ? ticks : 1;
+  }
+
+  void setEngageRadius(float radius)
+  {
+    _engageRadius = radius;
+  }
+
+  void clear()
+  {
+    _tick = 0;
+    _cursorPlayer = 0;
+    _cursorIndex = 0;
+    _slots.clear();
+    _combat.clear();
+  }
+
+  static Slot & slot(unit::ID id)
+  {
+    const uint32_t index = unit::index(id);
+    if (index >= _slots.size())
+    {
+      const Slot empty = { unit::INVALID_ID, unit::INVALID_ID, 0, 0.0f, 0.0f };
+      _slots.resize(index + 1, empty);
+    }
+
+    Slot & result = _slots[index];
+    if (result.id != id)
+    {
+      // The slot was used by a unit that has died since
+      result.id = id;
+      result.target = unit::INVALID_ID;
+      result.queued = 0;
+    }
+
+    return result;
+  }
+
+  static bool dueBefore(uint64_t due, Engaged const& engaged)
+  {
+    return due < engaged.due;
+  }
+
+  /// Queues the next combat decision of id. With a fixed interval that is
+  /// always at the back, after the interval changed it is sorted in.
+  static void enqueue(unit::ID id)
+  {
+    const Engaged engaged = { id, 0, _tick + _combatInterval };
+    if (_combat.empty() || _combat.back().due <= engaged.due)
+      _combat.push_back(engaged);
+    else
+      _combat.insert(std::upper_bound(_combat.begin(), _combat.end(), engaged.due, dueBefore), engaged);
+  }
+
+  static void decide(unit::Storage & storage, uint32_t i)
+  {
+    Slot & s = slot(storage.ids[i]);
+
+    // Enemies hidden by the fog of war or behind walls can not be targeted.
+    // The collide bitmap starts at the world corner.
+    const float cornerX = world::width() * 0.5f, cornerZ = world::height() * 0.5f;
+    spatial::Entry enemy;
+    if (!spatial::queryNearest(storage.x[i], storage.z[i], _engageRadius, storage.registryIndex, MAX_VISITED, &enemy) ||
+        !fog::visibleAt(_owners[storage.registryIndex].player, enemy.x, enemy.z) ||
+        !collide::lineOfSight(storage.x[i] + cornerX, storage.z[i] + cornerZ, enemy.x + cornerX, enemy.z + cornerZ))
+    {
+      // Back to the velocity the flow field gave it this tick
+      s.target = unit::INVALID_ID;
+      return;
+    }
+
+    s.target = enemy.id;
+    if (!s.queued)
+    {
+      enqueue(s.id);
+      s.queued = 1;
+    }
+
+    // Heads for where the target was, the next decision corrects for where
+    // it went
+    const math::FixedVector2 delta(math::Fixed::fromFloat(enemy.x - storage.x[i]),
+                                   math::Fixed::fromFloat(enemy.z - storage.z[i]));
+    const math::Fixed dist = math::fixed::length(delta);
+
+    if (dist <= ATTACK_RANGE)
+    {
+      s.vx = 0.0f;
+      s.vz = 0.0f;
+    }
+    else
+    {
+      const math::Fixed scale = math::Fixed::fromFloat(_owners[storage.registryIndex].speed) / dist;
+      s.vx = (delta.x * scale).toFloat();
+      s.vz = (delta.z * scale).toFloat();
+    }
+  }
+
+  // Gives engaged units their chase velocity, one linear pass like the flow
+  // field steering it overrides
+  static uint32_t steer(unit::Storage & storage)
+  {
+    const uint32_t slots = _slots.size();
+
+    uint32_t engaged = 0;
+    for (uint32_t i = 0; i < storage.count; ++i)
+    {
+      const unit::ID id = storage.ids[i];
+      const uint32_t index = unit::index(id);
+      if (index >= slots)
+        continue;
+
+      Slot const& s = _slots[index];
+      if (s.id != id || s.target == unit::INVALID_ID)
+        continue;
+
+      storage.stateHash ^= unit::setVelocity(storage, i, s.vx, s.vz);
+      ++engaged;
+    }
+
+    return engaged;
+  }
+
+  void tick()
+  {
+    const double start = platform::time();
+
+    player::PlayerVector const& players = player::players();
+
+    _owners.clear();
+    for (uint32_t p = 0; p < players.size(); ++p)
+    {
+      player::Player & owner = player::player(p);
+      const uint32_t index = owner.units.registryIndex;
+      if (index >= _owners.size())
+        _owners.resize(index + 1);
+
+      _owners[index].player = p;
+      _owners[index].speed = owner.unitSpeed;
+    }
+
+    uint32_t decisions = 0;
+
+    // Units in combat first, but always leave a quarter of the budget to the
+    // round-robin so new fights are noticed
+    const uint32_t combatQuota = _quota - _quota / 4;
+    while (!_combat.empty() && _combat.front().due <= _tick && decisions < combatQuota)
+    {
+      const unit::ID id = _combat.front().id;
+      _combat.pop_front();
+
+      uint32_t i = 0;
+      unit::Storage * storage = unit::find(id, &i);
+      if (!storage)
+        continue;
+
+      Slot & s = slot(id);
+      s.queued = 0;
+      if (s.target == unit::INVALID_ID)
+        continue;
+
+      decide(*storage, i);
+      ++decisions;
+    }
+
+    // Everyone in turn, at most one pass over all units per tick
+    uint32_t total = 0;
+    for (size_t p = 0; p < players.size(); ++p)
+      total += players[p].units.count;
+
+    uint32_t remaining = _quota - decisions;
+    if (remaining > total)
+      remaining = total;
+
+    while (remaining > 0)
+    {
+      if (_cursorPlayer >= players.size())
+      {
+        _cursorPlayer = 0;
+        _cursorIndex = 0;
+      }
+
+      unit::Storage & storage = player::player(_cursorPlayer).units;
+      if (_cursorIndex >= storage.count)
+      {
+        ++_cursorPlayer;
+        _cursorIndex = 0;
+        continue;
+      }
+
+      decide(storage, _cursorIndex++);
+      ++decisions;
+      --remaining;
+    }
+
+    uint32_t engaged = 0;
+    for (uint32_t p = 0; p < players.size(); ++p)
+      engaged += steer(player::player(p).units);
+
+    ++_tick;
+
+    _stats.decisions = decisions;
+    _stats.engaged = engaged;
+    _stats.seconds = platform::time() - start;
+  }
+
+  void save(std::vector<uint8_t> & out)
+  {
+    util::append(out, _tick);
+    util::append(out, _cursorPlayer);
+    util::append(out, _cursorIndex);
+
+    const uint32_t slots = _slots.size();
+    util::append(out, slots);
+    if (slots > 0)
+      util::append(out, &_slots[0], slots * sizeof(Slot));
+
+    const uint32_t combat = _combat.size();
+    util::append(out, combat);
+    for (std::deque<Engaged>::const_iterator it = _combat.begin(); it != _combat.end(); ++it)
+      util::append(out, *it);
+  }
+
+  bool load(util::Reader & reader)
+  {
+    uint32_t slots = 0;
+    if (!reader.read(_tick) || !reader.read(_cursorPlayer) || !reader.read(_cursorIndex) ||
+        !reader.read(slots) || slots > unit::INDEX_MASK + 1)
+      return false;
+
+    _slots.resize(slots);
+    if (slots > 0 && !reader.read(&_slots[0], slots * sizeof(Slot)))
+      return false;
+
+    uint32_t combat = 0;
+    if (!reader.read(combat) || combat > slots)
+      return false;
+
+    _combat.clear();
+    for (uint32_t i = 0; i < combat; ++i)
+    {
+      Engaged engaged;
+      if (!reader.read(engaged))
+        return false;
+      _combat.push_back(engaged);
+    }
+
+    return true;
+  }
+
+  void saveKeyframe(std::vector<uint8_t> & out)
+  {
+    util::append(out, _tick);
+    util::append(out, _cursorPlayer);
+    util::append(out, _cursorIndex);
+
+    const uint32_t slots = _slots.size();
+    util::append(out, slots);
+
+    // Any other slot is reset the next time its unit comes up, nothing reads
+    // it before that. The slot index is the index of its unit's handle.
+    std::vector<Slot> active;
+    for (uint32_t i = 0; i < slots; ++i)
+      if (_slots[i].target != unit::INVALID_ID || _slots[i].queued)
+        active.push_back(_slots[i]);
+
+    const uint32_t activeCount = active.size();
+    util::append(out, activeCount);
+    if (activeCount > 0)
+      util::appendPlanes(out, &active[0], activeCount, sizeof(Slot));
+
+    // Due ticks are close to now either way, relative to it they fit 32 bits
+    const uint32_t combat = _combat.size();
+    util::append(out, combat);
+
+    std::vector<uint32_t> ids(combat);
+    std::vector<int32_t> due(combat);
+    for (uint32_t i = 0; i < combat; ++i)
+    {
+      ids[i] = _combat[i].id;
+      due[i] = (int32_t)(_combat[i].due - _tick);
+    }
+
+    if (combat > 0)
+    {
+      util::appendPlanes(out, &ids[0], combat, sizeof(uint32_t));
+      util::appendPlanes(out, &due[0], combat, sizeof(int32_t));
+    }
+  }
+
+  bool loadKeyframe(util::Reader & reader)
+  {
+    uint32_t slots = 0, activeCount = 0;
+    if (!reader.read(_tick) || !reader.read(_cursorPlayer) || !reader.read(_cursorIndex) ||
+        !reader.read(slots) || slots > unit::INDEX_MASK + 1 ||
+        !reader.read(activeCount) || activeCount > slots)
+      return false;
+
+    std::vector<Slot> active(activeCount);
+    if (activeCount > 0 && !reader.readPlanes(&active[0], activeCount, sizeof(Slot)))
+      return false;
+
+    const Slot empty = { unit::INVALID_ID, unit::INVALID_ID, 0, 0.0f, 0.0f };
+    _slots.assign(slots, empty);
+
+    for (uint32_t i = 0; i < activeCount; ++i)
+    {
+      const uint32_t index = unit::index(active[i].id);
+      if (index >= slots)
+        return false;
+
+      _slots[index] = active[i];
+    }
+
+    uint32_t combat = 0;
+    if (!reader.read(combat) || combat > slots)
+      return false;
+
+    std::vector<uint32_t> ids(combat);
+    std::vector<int32_t> due(combat);
+    if (combat > 0 && (!reader.readPlanes(&ids[0], combat, sizeof(uint32_t)) ||
+                       !reader.readPlanes(&due[0], combat, sizeof(int32_t))))
+      return false;
+
+    _combat.clear();
+    for (uint32_t i = 0; i < combat; ++i)
+    {
+      const Engaged engaged = { ids[i], 0, _tick + (int64_t)due[i] };
+      _combat.push_back(engaged);
+    }
+
+    return true;
+  }
+
+  uint64_t hash()
+  {
+    uint64_t result = util::mix64(_tick ^ (((uint64_t)_cursorPlayer << 32) | _cursorIndex));
+
+    for (std::deque<Engaged>::const_iterator it = _combat.begin(); it != _combat.end(); ++it)
+    {
+      Slot const& s = _slots[unit::index(it->id)];
+
+      uint32_t vx, vz;
+      memcpy(&vx, &s.vx, sizeof(vx));
+      memcpy(&vz, &s.vz, sizeof(vz));
+
+      result = util::mix64(result ^ (((uint64_t)it->id << 32) | s.target));
+      result = util::mix64(result ^ it->due);
+      result = util::mix64(result ^ (((uint64_t)vx << 32) | vz));
+    }
+
+    return result;
+  }
+
+  Stats const& stats()
+  {
+    return _stats;
+  }
+
+  // -- Tcl Bindings --
+
+  PROC("ai:budget", setBudget);
+  PROC("ai:combatInterval", setCombatInterval);
+  PROC("ai:engageRadius", setEngageRadius);
+
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+namespace util { struct Reader; }
+
+/// Soldier decisions, time sliced. Every tick a fixed number of units get to
+/// look for the closest enemy, picked round-robin over all units so the cost
+/// per tick does not grow with the army. Units that found an enemy are in
+/// combat, they go to the front of the line and decide again every few ticks.
+///
+/// Deciding and moving are separate, engaged units keep the velocity towards
+/// their target from their last decision every tick, over the flow field.
+namespace ai
+{
+
+  /// Time each tick may spend on decisions. Lockstep needs every peer to make
+  /// the same decisions, so the budget is turned into a fixed number of
+  /// decisions per tick from a nominal cost instead of being measured. It has
+  /// to be set to the same value on every peer before the game starts.
+  void setBudget(uint32_t microseconds);
+  uint32_t decisionsPerTick();
+
+  /// Ticks between decisions of units in combat
+  void setCombatInterval(uint32_t ticks);
+
+  /// Units engage enemies within this many world units
+  void setEngageRadius(float radius);
+
+  /// Forgets every decision
+  void clear();
+
+  /// Makes this tick's decisions from the spatial grid of the last tick and
+  /// steers engaged units. Runs after the flow fields steered the units and
+  /// before they are integrated.
+  void tick();
+
+  /// Engaged units and the scheduler position, part of the state written by
+  /// sim::save()
+  void save(std::vector<uint8_t> & out);
+  bool load(util::Reader & reader);
+
+  /// Same for replay keyframes, only the slots of engaged or queued units
+  void saveKeyframe(std::vector<uint8_t> & out);
+  bool loadKeyframe(util::Reader & reader);
+
+  /// Hash of the scheduler position and of every unit in combat with its
+  /// target, velocity and next decision. Computed when asked, it only walks
+  /// the combat queue.
+  uint64_t hash();
+
+  /// Measured for reporting only, never feeds back into the simulation
+  struct Stats
+  {
+    uint32_t decisions;
+    uint32_t engaged;
+    double seconds;
+  };
+
+  /// Numbers of the last tick
+  Stats const& stats();
+
+}
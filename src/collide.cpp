@@ -1,60 +1,594 @@
-
 #include "collide.h"
 #include "tcl.h"
+#include "util.h"
+#include "jobs.h"
 
 #include <stdio.h>
 #include <memory.h>
 #include <cmath>
+#include <vector>
+#include <algorithm>
 
 namespace collide
 {
   namespace
   {
-    struct Cell
-    {
-      uint16_t row[16];
-      uint32_t sum;
-    };
+    // Blocks at the bottom of the occupancy pyramid are this many bits wide
+    // and high, a word holds four of them side by side
+    const uint32_t BLOCK_SIZE = 16;
 
-    Cell * _cells = NULL;
+    // One bit per collide cell in rows of 64-bit words, bit n of word w on
+    // row z is x = 64 * w + n. Bits past the width stay clear.
+    std::vector<uint64_t> _rows;
+    std::vector<uint64_t> _columns; // Transposed copy, rows are columns of _rows
     uint32_t _width = 0;
     uint32_t _height = 0;
-    uint32_t _cellWidth = 0;
-    uint32_t _cellHeight = 0;
+    uint32_t _rowWords = 0;
+    uint32_t _columnWords = 0;
+    uint32_t _revision = 0;
+
+    // XOR of bitHash() over all set bits
+    uint64_t _hash = 0;
+
+    // Occupancy pyramid, level 0 counts the set bits of every block of
+    // BLOCK_SIZE x BLOCK_SIZE bits and each level above counts 2x2 blocks of
+    // the level below, up to a single block. A block is free when its count
+    // is 0 and blocked when it equals its area.
+    struct Level
+    {
+      uint32_t width;
+      uint32_t height;
+      std::vector<uint32_t> counts;
+    };
+
+    std::vector<Level> _levels;
+
+    std::vector<ChangeListener> _listeners;
+
+    // Swept boxes stop this far in front of a blocked bit, in bits
+    const float SWEEP_GAP = 1.0f / 1024.0f;
   }
 
-  void reset(uint32_t width, uint32_t height)
+  static inline uint64_t bitHash(uint32_t x, uint32_t z)
+  {
+    return util::mix64((((uint64_t)z << 32) | x) ^ 0x636f6c6c69646521ULL);
+  }
+
+  static void rehash()
+  {
+    _hash = 0;
+    for (uint32_t z = 0; z < _height; ++z)
+      for (uint32_t w = 0; w < _rowWords; ++w)
+      {
+        uint64_t bits = _rows[z * _rowWords + w];
+        while (bits)
+        {
+          _hash ^= bitHash(w * 64 + util::lowestBit(bits), z);
+          bits &= bits - 1;
+        }
+      }
+  }
+
+  /// Rebuilds the transposed copy from the rows
+  static void transpose()
+  {
+    std::fill(_columns.begin(), _columns.end(), 0);
+    for (uint32_t z = 0; z < _height; ++z)
+      for (uint32_t w = 0; w < _rowWords; ++w)
+      {
+        uint64_t bits = _rows[z * _rowWords + w];
+        while (bits)
+        {
+          const uint32_t x = w * 64 + util::lowestBit(bits);
+          bits &= bits - 1;
+          _columns[x * _columnWords + z / 64] |= 1ull << (z % 64);
+        }
+      }
+  }
+
+  // -- Occupancy pyramid --
+
+  /// Recounts every level from the rows
+  static void rebuildPyramid()
+  {
+    _levels.clear();
+
+    Level bottom;
+    bottom.width = (_width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    bottom.height = (_height + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    bottom.counts.assign(bottom.width * bottom.height, 0);
+
+    for (uint32_t z = 0; z < _height; ++z)
+      for (uint32_t w = 0; w < _rowWords; ++w)
+      {
+        const uint64_t bits = _rows[z * _rowWords + w];
+        for (uint32_t block = 0; block < 64; block += BLOCK_SIZE)
+          if (const uint32_t count = util::bitCount((bits >> block) & 0xffff))
+            bottom.counts[(z / BLOCK_SIZE) * bottom.width + (w * 64 + block) / BLOCK_SIZE] += count;
+      }
+
+    _levels.push_back(bottom);
+
+    while (_levels.back().width > 1 || _levels.back().height > 1)
+    {
+      Level const& below = _levels.back();
+
+      Level level;
+      level.width = (below.width + 1) / 2;
+      level.height = (below.height + 1) / 2;
+      level.counts.assign(level.width * level.height, 0);
+
+      for (uint32_t z = 0; z < below.height; ++z)
+        for (uint32_t x = 0; x < below.width; ++x)
+          level.counts[(z / 2) * level.width + x / 2] += below.counts[z * below.width + x];
+
+      _levels.push_back(level);
+    }
+  }
+
+  /// Adds delta to every block containing bit (x, z), going around through
+  /// unsigned overflow to subtract
+  static void addCount(uint32_t x, uint32_t z, uint32_t delta)
+  {
+    x /= BLOCK_SIZE;
+    z /= BLOCK_SIZE;
+
+    for (size_t i = 0; i < _levels.size(); ++i)
+    {
+      Level & level = _levels[i];
+      level.counts[(z >> i) * level.width + (x >> i)] += delta;
+    }
+  }
+
+  /// Whether any bit in [x0, x1) x [z0, z1) is set, or clear when set is
+  /// false. Blocks that are all free or all blocked answer for everything
+  /// below them, so only the blocks along the edges of the rectangle are
+  /// descended into.
+  static bool findBit(uint32_t level, uint32_t bx, uint32_t bz, uint32_t x0, uint32_t z0, uint32_t x1, uint32_t z1, bool set)
+  {
+    const uint32_t size = BLOCK_SIZE << level;
+    const uint32_t left = bx * size, top = bz * size;
+    const uint32_t right = std::min(left + size, _width), bottom = std::min(top + size, _height);
+
+    const uint32_t count = _levels[level].counts[bz * _levels[level].width + bx];
+    const uint32_t area = (right - left) * (bottom - top);
+    if (count == (set ? 0 : area))
+      return false;
+
+    if (count == (set ? area : 0))
+      return true;
+
+    // Mixed blocks inside the rectangle hold both kinds of bits
+    if (x0 <= left && right <= x1 && z0 <= top && bottom <= z1)
+      return true;
+
+    if (level == 0)
+    {
+      const uint32_t lo = std::max(x0, left);
+      const uint32_t hi = std::min(x1, right) - 1;
+      const uint64_t mask = util::spanMask(lo % 64, hi % 64);
+
+      for (uint32_t z = std::max(z0, top); z < std::min(z1, bottom); ++z)
+      {
+        const uint64_t word = _rows[z * _rowWords + lo / 64];
+        if ((set ? word : ~word) & mask)
+          return true;
+      }
+
+      return false;
+    }
+
+    const uint32_t half = size / 2;
+    for (uint32_t cz = bz * 2; cz < bz * 2 + 2; ++cz)
+      for (uint32_t cx = bx * 2; cx < bx * 2 + 2; ++cx)
+      {
+        const uint32_t childLeft = cx * half, childTop = cz * half;
+        if (childLeft >= std::min(x1, right) || childTop >= std::min(z1, bottom) ||
+            childLeft + half <= x0 || childTop + half <= z0)
+          continue;
+
+        if (findBit(level - 1, cx, cz, x0, z0, x1, z1, set))
+          return true;
+      }
+
+    return false;
+  }
+
+  /// Clips the rectangle to the bitmap, returns false when nothing is left
+  static bool clipRect(int32_t x, int32_t z, uint32_t width, uint32_t height,
+                       uint32_t & x0, uint32_t & z0, uint32_t & x1, uint32_t & z1)
+  {
+    const int64_t right = std::min<int64_t>((int64_t)x + width, _width);
+    const int64_t bottom = std::min<int64_t>((int64_t)z + height, _height);
+    x0 = std::max(x, 0);
+    z0 = std::max(z, 0);
+    if (right <= (int64_t)x0 || bottom <= (int64_t)z0)
+      return false;
+
+    x1 = (uint32_t)right;
+    z1 = (uint32_t)bottom;
+    return true;
+  }
+
+  /// Whether the rectangle lies completely inside the bitmap
+  static bool insideRect(int32_t x, int32_t z, uint32_t width, uint32_t height)
+  {
+    return x >= 0 && z >= 0 && (int64_t)x + width <= _width && (int64_t)z + height <= _height;
+  }
+
+  static void notify(uint32_t x, uint32_t z, uint32_t width, uint32_t height)
+  {
+    for (size_t i = 0; i < _listeners.size(); ++i)
+      _listeners[i](x, z, width, height);
+  }
+
+  /// Word of a line of length bits, bits outside the line read as blocked
+  static inline uint64_t lineWord(const uint64_t * words, uint32_t lineWords, uint32_t length, int32_t word)
+  {
+    if (word < 0 || word >= (int32_t)lineWords)
+      return ~0ull;
+
+    if (word == (int32_t)lineWords - 1 && length % 64)
+      return words[word] | (~0ull << (length % 64));
+
+    return words[word];
+  }
+
+  /// Reads 64 bits starting at pos on a line of a bitmap stored as lines of
+  /// lineWords words each
+  static uint64_t read64(std::vector<uint64_t> const& bits, uint32_t lineWords, uint32_t length, uint32_t lines, int32_t pos, int32_t line)
+  {
+    if (line < 0 || line >= (int32_t)lines || lineWords == 0)
+      return ~0ull;
+
+    const uint64_t * words = &bits[line * lineWords];
+    const int32_t word = (pos >= 0 ? pos : pos - 63) / 64;
+    const uint32_t offset = pos - word * 64;
+
+    // Fast path, both words are inside the line
+    if (pos >= 0 && pos + 64 <= (int32_t)length)
+      return offset == 0 ? words[word] : (words[word] >> offset) | (words[word + 1] << (64 - offset));
+
+    const uint64_t low = lineWord(words, lineWords, length, word);
+    return offset == 0 ? low : (low >> offset) | (lineWord(words, lineWords, length, word + 1) << (64 - offset));
+  }
+
+  uint64_t row64(int32_t x, int32_t z)
+  {
+    return read64(_rows, _rowWords, _width, _height, x, z);
+  }
+
+  uint64_t column64(int32_t x, int32_t z)
+  {
+    return read64(_columns, _columnWords, _height, _width, z, x);
+  }
+
+  // -- Line of sight --
+
+  typedef uint64_t (*LineReader)(int32_t line, int32_t pos);
+
+  static uint64_t readRow(int32_t line, int32_t pos)
+  {
+    return row64(pos, line);
+  }
+
+  static uint64_t readColumn(int32_t line, int32_t pos)
+  {
+    return column64(line, pos);
+  }
+
+  /// Segment from (pos0, line0) to (pos1, line1) where line is the shorter
+  /// axis. Each line the segment crosses is tested over the span of
+  /// positions it covers there.
+  static bool clearAlong(LineReader read, float pos0, float line0, float pos1, float line1)
+  {
+    if (line1 < line0)
+    {
+      std::swap(pos0, pos1);
+      std::swap(line0, line1);
+    }
+
+    const int32_t first = (int32_t)std::floor(line0);
+    const int32_t last = (int32_t)std::floor(line1);
+    const float slope = line1 > line0 ? (pos1 - pos0) / (line1 - line0) : 0.0f;
+
+    for (int32_t line = first; line <= last; ++line)
+    {
+      // Computed from the start every time, so no error accumulates
+      const float enter = line == first ? pos0 : pos0 + (line - line0) * slope;
+      const float exit = line == last ? pos1 : pos0 + (line + 1 - line0) * slope;
+
+      const int32_t lo = (int32_t)std::floor(std::min(enter, exit));
+      const int32_t hi = (int32_t)std::floor(std::max(enter, exit));
+
+      // Shallow segments can cover more than a word on one line
+      for (int32_t start = lo; start <= hi; start += 64)
+      {
+        const uint32_t count = std::min(hi - start + 1, 64);
+        const uint64_t mask = count == 64 ? ~0ull : (1ull << count) - 1;
+        if (read(line, start) & mask)
+          return false;
+      }
+    }
+
+    return true;
+  }
+
+  bool lineOfSight(float x0, float z0, float x1, float z1)
+  {
+    // Scaled to bits, like set() and check()
+    x0 *= 2.0f;
+    z0 *= 2.0f;
+    x1 *= 2.0f;
+    z1 *= 2.0f;
+
+    if (std::fabs(x1 - x0) >= std::fabs(z1 - z0))
+      return clearAlong(readRow, x0, z0, x1, z1);
+
+    return clearAlong(readColumn, z0, x0, z1, x1);
+  }
+
+  struct RayJob
+  {
+    Ray const* rays;
+    uint8_t * visible;
+  };
+
+  static void rayRange(void * data, uint32_t begin, uint32_t end)
+  {
+    RayJob * job = (RayJob *)data;
+    for (uint32_t i = begin; i < end; ++i)
+    {
+      Ray const& ray = job->rays[i];
+      job->visible[i] = lineOfSight(ray.x0, ray.z0, ray.x1, ray.z1);
+    }
+  }
+
+  uint32_t lineOfSight(Ray const* rays, uint32_t count, uint8_t * visible)
   {
-    delete[] _cells;
-    _cells = NULL;
+    // Only reads the bitmap, so the ranges need no synchronization
+    RayJob job = { rays, visible };
+    jobs::parallelFor(count, 256, rayRange, &job);
 
+    uint32_t clear = 0;
+    for (uint32_t i = 0; i < count; ++i)
+      clear += visible[i];
+
+    return clear;
+  }
+
+  // -- Movement --
+
+  /// Finds the set bit in positions [first, last] on any of the lines
+  /// [lineLo, lineHi] that comes first when walking from first to last,
+  /// which may lie on either side. A word of positions is tested on all
+  /// lines at once by ORing the lines together.
+  static bool firstBlocked(LineReader read, int32_t lineLo, int32_t lineHi, int32_t first, int32_t last, int32_t & found)
+  {
+    if (first <= last)
+    {
+      for (int32_t start = first; start <= last; start += 64)
+      {
+        const uint32_t count = std::min(last - start + 1, 64);
+        const uint64_t mask = count == 64 ? ~0ull : (1ull << count) - 1;
+
+        uint64_t bits = 0;
+        for (int32_t line = lineLo; line <= lineHi; ++line)
+          bits |= read(line, start);
+
+        if (bits & mask)
+        {
+          found = start + util::lowestBit(bits & mask);
+          return true;
+        }
+      }
+    }
+    else
+    {
+      for (int32_t end = first; end >= last; end -= 64)
+      {
+        const int32_t start = std::max(end - 63, last);
+        const uint32_t count = end - start + 1;
+        const uint64_t mask = count == 64 ? ~0ull : (1ull << count) - 1;
+
+        uint64_t bits = 0;
+        for (int32_t line = lineLo; line <= lineHi; ++line)
+          bits |= read(line, start);
+
+        if (bits & mask)
+        {
+          found = start + util::highestBit(bits & mask);
+          return true;
+        }
+      }
+    }
+
+    return false;
+  }
+
+  /// Moves a box covering [pos - radius, pos + radius) along one axis from
+  /// pos0 to pos1, the box spans the lines around line. Only positions the
+  /// box newly enters are tested, so a box already overlapping set bits can
+  /// still move out of them.
+  static float sweepAxis(LineReader read, float pos0, float pos1, float line, float radius, bool & blocked)
+  {
+    blocked = false;
+
+    const int32_t lineLo = (int32_t)std::floor(line - radius);
+    const int32_t lineHi = (int32_t)std::ceil(line + radius) - 1;
+    int32_t hit = 0;
+
+    if (pos1 > pos0)
+    {
+      const int32_t first = (int32_t)std::ceil(pos0 + radius);
+      const int32_t last = (int32_t)std::ceil(pos1 + radius) - 1;
+      if (first <= last && firstBlocked(read, lineLo, lineHi, first, last, hit))
+      {
+        blocked = true;
+        return std::max(pos0, hit - radius - SWEEP_GAP);
+      }
+    }
+    else if (pos1 < pos0)
+    {
+      const int32_t first = (int32_t)std::floor(pos0 - radius) - 1;
+      const int32_t last = (int32_t)std::floor(pos1 - radius);
+      if (last <= first && firstBlocked(read, lineLo, lineHi, first, last, hit))
+      {
+        blocked = true;
+        return std::min(pos0, hit + 1 + radius + SWEEP_GAP);
+      }
+    }
+
+    return pos1;
+  }
+
+  uint32_t sweep(float fromX, float fromZ, float & toX, float & toZ, float radius)
+  {
+    bool blockedX = false, blockedZ = false;
+
+    // In bits, along x first and then along z from where that ended, so
+    // diagonal moves can not slip between two bits touching at a corner
+    const float x = sweepAxis(readRow, fromX * 2.0f, toX * 2.0f, fromZ * 2.0f, radius * 2.0f, blockedX);
+    const float z = sweepAxis(readColumn, fromZ * 2.0f, toZ * 2.0f, x, radius * 2.0f, blockedZ);
+
+    toX = x * 0.5f;
+    toZ = z * 0.5f;
+    return (blockedX ? BLOCKED_X : 0) | (blockedZ ? BLOCKED_Z : 0);
+  }
+
+  void reset(uint32_t width, uint32_t height)
+  {
     _width = width;
     _height = height;
-    _cellWidth = width / 8;
-    _cellHeight = height / 8;
+    _rowWords = (width + 63) / 64;
+    _columnWords = (height + 63) / 64;
 
-    _cells = new Cell[_cellWidth * _cellHeight];
-    memset(_cells, 0, sizeof(Cell) * _cellWidth * _cellHeight);
+    _rows.assign(_rowWords * height, 0);
+    _columns.assign(_columnWords * width, 0);
+
+    _hash = 0;
+    rebuildPyramid();
+    ++_revision;
+    notify(0, 0, width, height);
   }
 
   void setI(uint32_t x, uint32_t z, bool on)
   {
-    const uint32_t cellX = x / 16;
-    const uint32_t cellZ = z / 16;
-    const uint32_t inX = x % 16;
-    const uint32_t inZ = z % 16;
-    const uint16_t bit = 1 << inX;
+    if (x >= _width || z >= _height)
+      return;
+
+    uint64_t & word = _rows[z * _rowWords + x / 64];
+    const uint64_t bit = 1ull << (x % 64);
+    if (((word & bit) != 0) == on)
+      return;
+
+    word ^= bit;
+    _columns[x * _columnWords + z / 64] ^= 1ull << (z % 64);
+    addCount(x, z, on ? 1 : (uint32_t)-1);
+    _hash ^= bitHash(x, z);
+    ++_revision;
+    notify(x, z, 1, 1);
+  }
+
+  /// Sets or clears the rectangle a row word at a time, the listeners hear
+  /// about it once
+  static void fillRect(int32_t x, int32_t z, uint32_t width, uint32_t height, bool on)
+  {
+    uint32_t x0, z0, x1, z1;
+    if (!clipRect(x, z, width, height, x0, z0, x1, z1))
+      return;
+
+    bool changed = false;
+    for (uint32_t row = z0; row < z1; ++row)
+      for (uint32_t w = x0 / 64; w <= (x1 - 1) / 64; ++w)
+      {
+        const uint32_t lo = std::max(x0, w * 64) - w * 64;
+        const uint32_t hi = std::min(x1, w * 64 + 64) - w * 64 - 1;
+
+        uint64_t & word = _rows[row * _rowWords + w];
+        uint64_t toggled = (on ? ~word : word) & util::spanMask(lo, hi);
+        if (!toggled)
+          continue;
+
+        word ^= toggled;
+        changed = true;
+
+        // The pyramid is updated per block, the hash and the transposed
+        // copy per bit
+        for (uint32_t block = 0; block < 64; block += BLOCK_SIZE)
+          if (const uint32_t count = util::bitCount((toggled >> block) & 0xffff))
+            addCount(w * 64 + block, row, on ? count : 0 - count);
+
+        while (toggled)
+        {
+          const uint32_t bitX = w * 64 + util::lowestBit(toggled);
+          toggled &= toggled - 1;
+          _columns[bitX * _columnWords + row / 64] ^= 1ull << (row % 64);
+          _hash ^= bitHash(bitX, row);
+        }
+      }
+
+    if (changed)
+    {
+      ++_revision;
+      notify(x0, z0, x1 - x0, z1 - z0);
+    }
+  }
+
+  void setRect(int32_t x, int32_t z, uint32_t width, uint32_t height)
+  {
+    fillRect(x, z, width, height, true);
+  }
 
-    Cell & cell = _cells[cellZ * _width + cellX];
-    uint16_t & row = cell.row[inZ];
+  void clearRect(int32_t x, int32_t z, uint32_t width, uint32_t height)
+  {
+    fillRect(x, z, width, height, false);
+  }
+
+  bool testRect(int32_t x, int32_t z, uint32_t width, uint32_t height)
+  {
+    if (width == 0 || height == 0)
+      return false;
 
-    cell.sum -= row;
-    row = (row & ~(1 << inX)) | (on << inX);
-    cell.sum += row;
+    if (!insideRect(x, z, width, height))
+      return true;
+
+    const uint32_t x1 = x + width;
+    for (uint32_t row = z; row < z + height; ++row)
+      for (uint32_t w = x / 64; w <= (x1 - 1) / 64; ++w)
+      {
+        const uint32_t lo = std::max<uint32_t>(x, w * 64) - w * 64;
+        const uint32_t hi = std::min(x1, w * 64 + 64) - w * 64 - 1;
+        if (_rows[row * _rowWords + w] & util::spanMask(lo, hi))
+          return true;
+      }
+
+    return false;
+  }
+
+  uint32_t countRect(int32_t x, int32_t z, uint32_t width, uint32_t height)
+  {
+    uint32_t x0, z0, x1, z1;
+    if (!clipRect(x, z, width, height, x0, z0, x1, z1))
+      return 0;
+
+    uint32_t count = 0;
+    for (uint32_t row = z0; row < z1; ++row)
+      for (uint32_t w = x0 / 64; w <= (x1 - 1) / 64; ++w)
+      {
+        const uint32_t lo = std::max(x0, w * 64) - w * 64;
+        const uint32_t hi = std::min(x1, w * 64 + 64) - w * 64 - 1;
+        count += util::bitCount(_rows[row * _rowWords + w] & util::spanMask(lo, hi));
+      }
+
+    return count;
   }
 
   void set(float x, float z, bool on)
   {
+    if (x < 0.0f || z < 0.0f)
+      return;
+
     const uint32_t cellX = std::floor(x * 2.0f);
     const uint32_t cellZ = std::floor(z * 2.0f);
     setI(cellX, cellZ, on);
@@ -62,27 +596,138 @@ namespace collide
 
   bool checkI(uint32_t x, uint32_t z)
   {
-    const uint32_t cellX = x / 16;
-    const uint32_t cellZ = z / 16;
-    const uint32_t inX = x % 16;
-    const uint32_t inZ = z % 16;
-
-    const Cell & cell = _cells[cellZ * _width + cellX];
-    const uint16_t & row = cell.row[inZ];
+    if (x >= _width || z >= _height)
+      return true;
 
-    return row & (1 << inX);
+    return (_rows[z * _rowWords + x / 64] >> (x % 64)) & 1;
   }
 
   bool check(float x, float z)
   {
+    if (x < 0.0f || z < 0.0f)
+      return true;
+
     const uint32_t cellX = std::floor(x * 2.0f);
     const uint32_t cellZ = std::floor(z * 2.0f);
     return checkI(cellX, cellZ);
   }
 
+  bool rectFree(int32_t x, int32_t z, uint32_t width, uint32_t height)
+  {
+    if (width == 0 || height == 0)
+      return true;
+
+    // Anything sticking out of the bitmap is blocked
+    if (!insideRect(x, z, width, height))
+      return false;
+
+    return !findBit(_levels.size() - 1, 0, 0, x, z, x + width, z + height, true);
+  }
+
+  bool rectBlocked(int32_t x, int32_t z, uint32_t width, uint32_t height)
+  {
+    uint32_t x0, z0, x1, z1;
+    if (!clipRect(x, z, width, height, x0, z0, x1, z1))
+      return true;
+
+    return !findBit(_levels.size() - 1, 0, 0, x0, z0, x1, z1, false);
+  }
+
+  uint32_t width()
+  {
+    return _width;
+  }
+
+  uint32_t height()
+  {
+    return _height;
+  }
+
+  void addListener(ChangeListener listener)
+  {
+    if (std::find(_listeners.begin(), _listeners.end(), listener) == _listeners.end())
+      _listeners.push_back(listener);
+  }
+
+  void removeListener(ChangeListener listener)
+  {
+    _listeners.erase(std::remove(_listeners.begin(), _listeners.end(), listener), _listeners.end());
+  }
+
+  void save(std::vector<uint8_t> & out)
+  {
+    util::append(out, _width);
+    util::append(out, _height);
+    if (!_rows.empty())
+      util::append(out, &_rows[0], sizeof(uint64_t) * _rows.size());
+  }
+
+  bool load(util::Reader & reader)
+  {
+    uint32_t width = 0, height = 0;
+    if (!reader.read(width) || !reader.read(height))
+      return false;
+
+    const size_t size = sizeof(uint64_t) * ((width + 63) / 64) * height;
+    if ((size_t)(reader.end - reader.cursor) < size)
+    {
+      reader.failed = true;
+      return false;
+    }
+
+    // Unchanged walls keep the revision, so listeners keep their caches
+    if (width == _width && height == _height && (size == 0 || memcmp(&_rows[0], reader.cursor, size) == 0))
+    {
+      reader.cursor += size;
+      return true;
+    }
+
+    if (width != _width || height != _height)
+      reset(width, height);
+
+    if (size)
+      reader.read(&_rows[0], size);
+
+    // Bits past the width would throw off the counts and the hash
+    if (_width % 64)
+      for (uint32_t z = 0; z < _height; ++z)
+        _rows[z * _rowWords + _rowWords - 1] &= ~(~0ull << (_width % 64));
+
+    transpose();
+    rehash();
+    rebuildPyramid();
+    ++_revision;
+    notify(0, 0, _width, _height);
+    return true;
+  }
+
+  uint32_t revision()
+  {
+    return _revision;
+  }
+
+  uint64_t hash()
+  {
+    return util::mix64(_hash ^ (((uint64_t)_width << 32) | _height));
+  }
+
+  // -- Tcl Bindings --
+
+  static bool testLineOfSight(float x0, float z0, float x1, float z1)
+  {
+    return lineOfSight(x0, z0, x1, z1);
+  }
+
   PROC("collide:set", set);
   PROC("collide:check", check);
   PROC("collide:setI", setI);
-  PROC("collide:check", checkI);
+  PROC("collide:checkI", checkI);
+  PROC("collide:lineOfSight", testLineOfSight);
+  PROC("collide:rectFree", rectFree);
+  PROC("collide:rectBlocked", rectBlocked);
+  PROC("collide:setRect", setRect);
+  PROC("collide:clearRect", clearRect);
+  PROC("collide:testRect", testRect);
+  PROC("collide:countRect", countRect);
 
-}
\ No newline at end of file
+}
@@ -1,8 +1,13 @@
-
 #pragma once
 
 #include <stdint.h>
+#include <vector>
+
+namespace util { struct Reader; }
 
+/// Occupancy bitmap at half world unit resolution. Coordinates are relative
+/// to the world corner, so a world of w x h units is 2w x 2h bits. Stored as
+/// rows of 64-bit words, so spans of a row are read and written with masks.
 namespace collide
 {
 
@@ -11,7 +16,97 @@ namespace collide
   void set(float x, float z, bool on);
   void setI(uint32_t x, uint32_t z, bool on);
 
+  /// Sets or clears every bit of the rectangle [x, x + width) x
+  /// [z, z + height), a row word at a time. Parts outside the bitmap are
+  /// ignored. Listeners are notified once about the clipped rectangle.
+  void setRect(int32_t x, int32_t z, uint32_t width, uint32_t height);
+  void clearRect(int32_t x, int32_t z, uint32_t width, uint32_t height);
+
+  /// Whether any bit of the rectangle is set, bits outside the bitmap count
+  /// as set
+  bool testRect(int32_t x, int32_t z, uint32_t width, uint32_t height);
+
+  /// Set bits in the part of the rectangle inside the bitmap
+  uint32_t countRect(int32_t x, int32_t z, uint32_t width, uint32_t height);
+
+  /// Anything outside the bitmap counts as blocked
   bool check(float x, float z);
   bool checkI(uint32_t x, uint32_t z);
 
-}
\ No newline at end of file
+  uint32_t width();
+  uint32_t height();
+
+  /// Whether no bit / every bit of the rectangle [x, x + width) x
+  /// [z, z + height) is set, bits outside the bitmap count as blocked.
+  /// Answered from a pyramid of set bit counts over blocks of 16x16, 32x32,
+  /// ... bits kept up to date by every change, so only blocks along the
+  /// edges of the rectangle are looked at.
+  bool rectFree(int32_t x, int32_t z, uint32_t width, uint32_t height);
+  bool rectBlocked(int32_t x, int32_t z, uint32_t width, uint32_t height);
+
+  /// Occupancy of the 64 bits [x, x + 64) on row z, bit n is x + n.
+  /// Bits outside the bitmap read as blocked, so x and z may be negative.
+  uint64_t row64(int32_t x, int32_t z);
+
+  /// Occupancy of the 64 bits [z, z + 64) on column x, bit n is z + n.
+  /// Served from a transposed copy of the bitmap kept in sync by every change.
+  uint64_t column64(int32_t x, int32_t z);
+
+  // -- Line of sight --
+
+  /// Segment between two points, in the coordinates of set() and check()
+  struct Ray
+  {
+    float x0, z0;
+    float x1, z1;
+  };
+
+  /// True when no set bit touches the segment from (x0, z0) to (x1, z1).
+  /// Walks the lines of bits along the shorter axis, testing the whole span
+  /// the segment covers on each line with one 64-bit read, rows through
+  /// row64() and columns through column64(). Segments leaving the bitmap are
+  /// blocked.
+  bool lineOfSight(float x0, float z0, float x1, float z1);
+
+  /// Tests count rays at once, spread over the job system, and writes 1 to
+  /// visible for every clear one and 0 otherwise. Returns the number of
+  /// clear rays.
+  uint32_t lineOfSight(Ray const* rays, uint32_t count, uint8_t * visible);
+
+  // -- Movement --
+
+  enum
+  {
+    BLOCKED_X = 1,
+    BLOCKED_Z = 2
+  };
+
+  /// Moves a square of half size radius from (fromX, fromZ) to (toX, toZ),
+  /// first along x and then along z, stopping each axis in front of the
+  /// first set bit in the way so the square slides along walls. Every bit
+  /// the square passes over is tested, a word of bits per line at a time,
+  /// so fast movers can not tunnel through thin walls. Returns the blocked
+  /// axes and writes where the square ended up to toX and toZ.
+  uint32_t sweep(float fromX, float fromZ, float & toX, float & toZ, float radius);
+
+  /// Called with the rectangle of bits that may have changed, reset() reports
+  /// the whole bitmap.
+  typedef void (*ChangeListener)(uint32_t x, uint32_t z, uint32_t width, uint32_t height);
+
+  void addListener(ChangeListener listener);
+  void removeListener(ChangeListener listener);
+
+  /// The rows, part of the state written by sim::save(). Loading rebuilds
+  /// the transposed copy and the pyramid and notifies the listeners about
+  /// the whole bitmap.
+  void save(std::vector<uint8_t> & out);
+  bool load(util::Reader & reader);
+
+  /// Incremented whenever a bit changes, lets caches built from the bitmap
+  /// notice that they are stale.
+  uint32_t revision();
+
+  /// Hash of the bitmap, updated bit by bit as bits change
+  uint64_t hash();
+
+}
@@ -0,0 +1,128 @@
+#include "crowd.h"
+#include "spatial.h"
+#include "jobs.h"
+#include "util.h"
+#include "fixed.h"
+#include "tcl.h"
+
+#include <vector>
+
+namespace crowd
+{
+  namespace {
+    // Neighbours looked at per unit, caps the cost inside dense blobs
+    const uint32_t MAX_NEIGHBOURS = 16;
+
+    const uint32_t SEPARATE_GRAIN = 1024;
+
+    // Change to the unit hash of each range
+    std::vector<uint64_t> _rangeHashes;
+
+    // Units on the exact same spot are split along one of eight directions
+    // picked from both handles, the same on every peer. Raw fixed point.
+    const int32_t ONE = math::Fixed::ONE;
+    const int32_t DIAGONAL = math::fixed::SQRT_HALF_RAW;
+    const int32_t SPLIT_X[8] = { ONE, DIAGONAL, 0, -DIAGONAL, -ONE, -DIAGONAL, 0, DIAGONAL };
+    const int32_t SPLIT_Z[8] = { 0, DIAGONAL, ONE, DIAGONAL, 0, -DIAGONAL, -ONE, -DIAGONAL };
+
+    float _radius = 0.6f;
+    float _strength = 1.0f;
+  }
+
+  struct SeparateJob
+  {
+    unit::Storage * units;
+    float speed;
+    uint64_t * hashes;  // One per range
+  };
+
+  static void separateRange(void * data, uint32_t begin, uint32_t end)
+  {
+    SeparateJob * job = (SeparateJob *)data;
+    unit::Storage & units = *job->units;
+
+    const math::Fixed radius = math::Fixed::fromFloat(_radius);
+    const math::Fixed invRadius = math::Fixed::fromInt(1) / radius;
+    const math::Fixed scale = math::Fixed::fromFloat(job->speed * _strength);
+
+    spatial::Entry neighbours[MAX_NEIGHBOURS];
+    uint64_t changed = 0;
+
+    for (uint32_t i = begin; i < end; ++i)
+    {
+      const float x = units.x[i];
+      const float z = units.z[i];
+      const unit::ID id = units.ids[i];
+
+      const uint32_t count = spatial::queryRadius(x, z, _radius, neighbours, MAX_NEIGHBOURS);
+
+      math::FixedVector2 push;
+      for (uint32_t n = 0; n < count; ++n)
+      {
+        spatial::Entry const& other = neighbours[n];
+        if (other.id == id)
+          continue;
+
+        const math::FixedVector2 delta(math::Fixed::fromFloat(x - other.x), math::Fixed::fromFloat(z - other.z));
+
+        if (delta.x.raw == 0 && delta.z.raw == 0)
+        {
+          // The pair picks opposite directions, whichever of the two asks
+          const uint32_t dir = util::mix64(id < other.id ? ((uint64_t)id << 32) | other.id
+                                                         : ((uint64_t)other.id << 32) | id) & 7;
+          const math::FixedVector2 split(math::Fixed::fromRaw(SPLIT_X[dir]), math::Fixed::fromRaw(SPLIT_Z[dir]));
+          push = id < other.id ? push + split : push - split;
+          continue;
+        }
+
+        // Direction away from the neighbour, stronger the more they overlap.
+        // The query is in floats, a neighbour right on the edge may come out
+        // a bit outside in fixed point.
+        const math::Fixed dist = math::fixed::length(delta);
+        if (dist >= radius)
+          continue;
+
+        push = push + delta * ((radius - dist) / dist * invRadius);
+      }
+
+      // Never faster than the strength allows, however many neighbours push
+      if (math::fixed::length(push) > math::Fixed::fromInt(1))
+        push = math::fixed::normalize(push);
+
+      changed ^= unit::setVelocity(units, i, units.vx[i] + (push.x * scale).toFloat(),
+                                             units.vz[i] + (push.z * scale).toFloat());
+    }
+
+    job->hashes[begin / SEPARATE_GRAIN] = changed;
+  }
+
+  void setRadius(float radius)
+  {
+    if (radius > 0.0f)
+      _radius = radius;
+  }
+
+  void setStrength(float strength)
+  {
+    _strength = strength > 0.0f ? strength : 0.0f;
+  }
+
+  void separate(unit::Storage & units, float speed)
+  {
+    if (_strength == 0.0f || units.count == 0)
+      return;
+
+    _rangeHashes.assign(units.count / SEPARATE_GRAIN + 1, 0);
+    SeparateJob job = { &units, speed, &_rangeHashes[0] };
+    jobs::parallelFor(units.count, SEPARATE_GRAIN, separateRange, &job);
+
+    for (size_t i = 0; i < _rangeHashes.size(); ++i)
+      units.stateHash ^= _rangeHashes[i];
+  }
+
+  // -- Tcl Bindings --
+
+  PROC("crowd:radius", setRadius);
+  PROC("crowd:strength", setStrength);
+
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "unit.h"
+
+/// Local avoidance. After path steering, every unit is pushed away from the
+/// neighbours overlapping it, found through the spatial grid, so crowds
+/// spread out instead of stacking on one spot. Each unit only reads
+/// positions and writes its own velocity, so ranges of units run in parallel
+/// and the result does not depend on how they were split.
+namespace crowd
+{
+
+  /// Units closer than this push each other apart
+  void setRadius(float radius);
+
+  /// Fraction of the unit speed the push can reach
+  void setStrength(float strength);
+
+  /// Adds the separation velocity to every unit in units, which move at
+  /// speed. Reads the spatial grid of the last tick, which still holds the
+  /// current positions before integration. Units that got pushed are folded
+  /// into the storage hash.
+  void separate(unit::Storage & units, float speed);
+
+}
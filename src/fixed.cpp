@@ -0,0 +1,127 @@
+#include "fixed.h"
+
+namespace math
+{
+  namespace {
+    // sin(i * 90 / 256 degrees) in Q16.16. Literal values rather than computed
+    // at startup, so the table can not differ between C libraries.
+    const int32_t QUARTER_STEPS = 256;
+    const int32_t SINE_TABLE[QUARTER_STEPS + 1] = {
+          0,   402,   804,  1206,  1608,  2010,  2412,  2814,
+       3216,  3617,  4019,  4420,  4821,  5222,  5623,  6023,
+       6424,  6824,  7224,  7623,  8022,  8421,  8820,  9218,
+       9616, 10014, 10411, 10808, 11204, 11600, 11996, 12391,
+      12785, 13180, 13573, 13966, 14359, 14751, 15143, 15534,
+      15924, 16314, 16703, 17091, 17479, 17867, 18253, 18639,
+      19024, 19409, 19792, 20175, 20557, 20939, 21320, 21699,
+      22078, 22457, 22834, 23210, 23586, 23961, 24335, 24708,
+      25080, 25451, 25821, 26190, 26558, 26925, 27291, 27656,
+      28020, 28383, 28745, 29106, 29466, 29824, 30182, 30538,
+      30893, 31248, 31600, 31952, 32303, 32652, 33000, 33347,
+      33692, 34037, 34380, 34721, 35062, 35401, 35738, 36075,
+      36410, 36744, 37076, 37407, 37736, 38064, 38391, 38716,
+      39040, 39362, 39683, 40002, 40320, 40636, 40951, 41264,
+      41576, 41886, 42194, 42501, 42806, 43110, 43412, 43713,
+      44011, 44308, 44604, 44898, 45190, 45480, 45769, 46056,
+      46341, 46624, 46906, 47186, 47464, 47741, 48015, 48288,
+      48559, 48828, 49095, 49361, 49624, 49886, 50146, 50404,
+      50660, 50914, 51166, 51417, 51665, 51911, 52156, 52398,
+      52639, 52878, 53114, 53349, 53581, 53812, 54040, 54267,
+      54491, 54714, 54934, 55152, 55368, 55582, 55794, 56004,
+      56212, 56418, 56621, 56823, 57022, 57219, 57414, 57607,
+      57798, 57986, 58172, 58356, 58538, 58718, 58896, 59071,
+      59244, 59415, 59583, 59750, 59914, 60075, 60235, 60392,
+      60547, 60700, 60851, 60999, 61145, 61288, 61429, 61568,
+      61705, 61839, 61971, 62101, 62228, 62353, 62476, 62596,
+      62714, 62830, 62943, 63054, 63162, 63268, 63372, 63473,
+      63572, 63668, 63763, 63854, 63944, 64031, 64115, 64197,
+      64277, 64354, 64429, 64501, 64571, 64639, 64704, 64766,
+      64827, 64884, 64940, 64993, 65043, 65091, 65137, 65180,
+      65220, 65259, 65294, 65328, 65358, 65387, 65413, 65436,
+      65457, 65476, 65492, 65505, 65516, 65525, 65531, 65535,
+      65536
+    };
+  }
+
+  /// Floor of the square root, value below 2^63. The double square root is
+  /// only a guess, it may be one off for values past 2^53, the corrections
+  /// make the result exact so it does not depend on the FPU.
+  static uint32_t isqrt(uint64_t value)
+  {
+    uint64_t result = (uint64_t)std::sqrt((double)value);
+
+    while (result * result > value)
+      --result;
+
+    while ((result + 1) * (result + 1) <= value)
+      ++result;
+
+    return (uint32_t)result;
+  }
+
+  /// position is in Q16.16 table steps, [0, QUARTER_STEPS]
+  static int32_t quarterSine(int32_t position)
+  {
+    const int32_t index = position >> Fixed::FRACTION_BITS;
+    if (index >= QUARTER_STEPS)
+      return SINE_TABLE[QUARTER_STEPS];
+
+    const int32_t fraction = position & (Fixed::ONE - 1);
+    const int32_t low = SINE_TABLE[index];
+    return low + (int32_t)(((int64_t)(SINE_TABLE[index + 1] - low) * fraction) >> Fixed::FRACTION_BITS);
+  }
+
+  namespace fixed
+  {
+    Fixed sqrt(Fixed a)
+    {
+      if (a.raw <= 0)
+        return Fixed();
+
+      return Fixed::fromRaw(isqrt((uint64_t)a.raw << Fixed::FRACTION_BITS));
+    }
+
+    Fixed sin(Fixed degrees)
+    {
+      // Degrees to table steps, four quarters per turn
+      const int64_t turn = (int64_t)QUARTER_STEPS * 4 << Fixed::FRACTION_BITS;
+      int64_t position = ((int64_t)degrees.raw * QUARTER_STEPS * 4 / 360) % turn;
+      if (position < 0)
+        position += turn;
+
+      const int32_t quarterLength = QUARTER_STEPS << Fixed::FRACTION_BITS;
+      const int32_t quarter = (int32_t)(position / quarterLength);
+      const int32_t offset = (int32_t)(position % quarterLength);
+
+      switch (quarter)
+      {
+        case 0:  return Fixed::fromRaw(quarterSine(offset));
+        case 1:  return Fixed::fromRaw(quarterSine(quarterLength - offset));
+        case 2:  return Fixed::fromRaw(-quarterSine(offset));
+        default: return Fixed::fromRaw(-quarterSine(quarterLength - offset));
+      }
+    }
+
+    Fixed cos(Fixed degrees)
+    {
+      return sin(degrees + Fixed::fromInt(90));
+    }
+
+    Fixed length(FixedVector2 v)
+    {
+      const uint64_t squared = (uint64_t)((int64_t)v.x.raw * v.x.raw) + (uint64_t)((int64_t)v.z.raw * v.z.raw);
+      const uint32_t result = isqrt(squared);
+      return Fixed::fromRaw(result > INT32_MAX ? INT32_MAX : (int32_t)result);
+    }
+
+    FixedVector2 normalize(FixedVector2 v)
+    {
+      const Fixed scale = length(v);
+      if (scale.raw == 0)
+        return v;
+
+      return FixedVector2(v.x / scale, v.z / scale);
+    }
+  }
+
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <stdint.h>
+#include <cmath>
+
+/// Q16.16 fixed point. Every operation is plain integer math, so results are
+/// bit identical on every compiler and instruction set, which lockstep and
+/// replays depend on. Products and quotients go through 64 bits and are
+/// rounded towards negative infinity. Results out of range wrap around, sums
+/// and integers are computed unsigned so that is well defined.
+///
+/// The simulation keeps unit state in floats for the SIMD kernels, float
+/// add and multiply are exactly rounded everywhere. Anything that needs a
+/// square root, a division or trigonometry goes through here.
+namespace math
+{
+
+  struct Fixed
+  {
+    enum { FRACTION_BITS = 16, ONE = 1 << FRACTION_BITS };
+
+    Fixed() : raw(0) { }
+
+    static Fixed fromRaw(int32_t raw)
+    {
+      Fixed result;
+      result.raw = raw;
+      return result;
+    }
+
+    static Fixed fromInt(int32_t value)
+    {
+      return fromRaw((int32_t)((uint32_t)value << FRACTION_BITS));
+    }
+
+    /// Rounds to the nearest value, halfway cases away from negative
+    /// infinity, and saturates outside the range. value * ONE is exact in
+    /// double, so this is the same everywhere.
+    static Fixed fromFloat(float value)
+    {
+      const double scaled = std::floor((double)value * ONE + 0.5);
+      if (scaled >= 2147483647.0)
+        return fromRaw(INT32_MAX);
+      if (scaled <= -2147483648.0)
+        return fromRaw(INT32_MIN);
+
+      return fromRaw((int32_t)scaled);
+    }
+
+    float toFloat() const
+    {
+      return raw * (1.0f / ONE);
+    }
+
+    /// Rounds towards negative infinity
+    int32_t toInt() const
+    {
+      return raw >> FRACTION_BITS;
+    }
+
+    Fixed & operator += (Fixed other) { raw = (int32_t)((uint32_t)raw + (uint32_t)other.raw); return *this; }
+    Fixed & operator -= (Fixed other) { raw = (int32_t)((uint32_t)raw - (uint32_t)other.raw); return *this; }
+
+    int32_t raw;
+  };
+
+  inline Fixed operator + (Fixed a, Fixed b) { return a += b; }
+  inline Fixed operator - (Fixed a, Fixed b) { return a -= b; }
+  inline Fixed operator - (Fixed a) { return Fixed::fromRaw((int32_t)(0u - (uint32_t)a.raw)); }
+
+  inline Fixed operator * (Fixed a, Fixed b)
+  {
+    return Fixed::fromRaw((int32_t)(((int64_t)a.raw * b.raw) >> Fixed::FRACTION_BITS));
+  }
+
+  inline Fixed operator * (Fixed a, int32_t b)
+  {
+    return Fixed::fromRaw((int32_t)((uint32_t)a.raw * (uint32_t)b));
+  }
+
+  /// Division by zero saturates instead of trapping
+  inline Fixed operator / (Fixed a, Fixed b)
+  {
+    if (b.raw == 0)
+      return Fixed::fromRaw(a.raw < 0 ? INT32_MIN : INT32_MAX);
+
+    // Integer division truncates towards zero, negative quotients with a
+    // remainder are moved down by one to round like the product
+    const int64_t numerator = (int64_t)a.raw * Fixed::ONE;
+    int64_t quotient = numerator / b.raw;
+    if (numerator % b.raw != 0 && (numerator < 0) != (b.raw < 0))
+      --quotient;
+
+    return Fixed::fromRaw((int32_t)quotient);
+  }
+
+  inline bool operator == (Fixed a, Fixed b) { return a.raw == b.raw; }
+  inline bool operator != (Fixed a, Fixed b) { return a.raw != b.raw; }
+  inline bool operator <  (Fixed a, Fixed b) { return a.raw <  b.raw; }
+  inline bool operator <= (Fixed a, Fixed b) { return a.raw <= b.raw; }
+  inline bool operator >  (Fixed a, Fixed b) { return a.raw >  b.raw; }
+  inline bool operator >= (Fixed a, Fixed b) { return a.raw >= b.raw; }
+
+  struct FixedVector2
+  {
+    FixedVector2() { }
+    FixedVector2(Fixed x, Fixed z) : x(x), z(z) { }
+
+    Fixed x, z;
+  };
+
+  inline FixedVector2 operator + (FixedVector2 a, FixedVector2 b) { return FixedVector2(a.x + b.x, a.z + b.z); }
+  inline FixedVector2 operator - (FixedVector2 a, FixedVector2 b) { return FixedVector2(a.x - b.x, a.z - b.z); }
+  inline FixedVector2 operator * (FixedVector2 v, Fixed scalar) { return FixedVector2(v.x * scalar, v.z * scalar); }
+
+  namespace fixed
+  {
+    /// sqrt(0.5) as a raw value, each axis of a unit length diagonal
+    const int32_t SQRT_HALF_RAW = 46341;
+
+    inline Fixed abs(Fixed a)
+    {
+      return a.raw < 0 ? -a : a;
+    }
+
+    inline Fixed min(Fixed a, Fixed b)
+    {
+      return a < b ? a : b;
+    }
+
+    inline Fixed max(Fixed a, Fixed b)
+    {
+      return a > b ? a : b;
+    }
+
+    inline Fixed lerp(Fixed a, Fixed b, Fixed t)
+    {
+      return a + (b - a) * t;
+    }
+
+    /// Integer square root, negative input gives zero
+    Fixed sqrt(Fixed a);
+
+    /// Angles are in degrees like everywhere else in the game. Uses a quarter
+    /// wave table with linear interpolation, off by at most two units of 2^-16.
+    Fixed sin(Fixed degrees);
+    Fixed cos(Fixed degrees);
+
+    inline Fixed dot(FixedVector2 a, FixedVector2 b)
+    {
+      return a.x * b.x + a.z * b.z;
+    }
+
+    /// The squares are kept in 64 bits, so this works across the whole world
+    Fixed length(FixedVector2 v);
+
+    /// Zero length vectors stay zero
+    FixedVector2 normalize(FixedVector2 v);
+  }
+
+}
@@ -0,0 +1,234 @@
+#include "flowfield.h"
+#include "grid.h"
+#include "fixed.h"
+#include "world.h"
+#include "tcl.h"
+
+#include <algorithm>
+#include <map>
+
+namespace flowfield
+{
+  namespace {
+
+    struct Node
+    {
+      uint32_t cost;
+      uint32_t cell;
+
+      bool operator < (Node const& other) const
+      {
+        // std heaps are max-heaps, we want the cheapest node on top
+        return cost > other.cost;
+      }
+    };
+
+    typedef std::map<uint32_t, Field *> FieldMap;
+
+    FieldMap _fields;
+    uint32_t _cacheSize = 16;
+    uint64_t _useCounter = 0;
+
+    // Scratch space reused between builds
+    std::vector<Node> _open;
+    std::vector<uint8_t> _walkable;
+  }
+
+  /// Diagonal moves may not cut corners, both orthogonal neighbours must be free
+  static inline bool canStep(uint32_t x, uint32_t z, uint32_t dir, uint32_t width, uint32_t height)
+  {
+    const int32_t nx = (int32_t)x + grid::DIRECTION_X[dir];
+    const int32_t nz = (int32_t)z + grid::DIRECTION_Z[dir];
+
+    if (nx < 0 || nz < 0 || nx >= (int32_t)width || nz >= (int32_t)height)
+      return false;
+
+    if (!_walkable[nz * width + nx])
+      return false;
+
+    if (dir & 1)
+      return _walkable[z * width + nx] && _walkable[nz * width + x];
+
+    return true;
+  }
+
+  void build(Field & field, uint32_t goalX, uint32_t goalZ)
+  {
+    const uint32_t width = world::width();
+    const uint32_t height = world::height();
+    const uint32_t cellCount = width * height;
+
+    field.goalX = goalX;
+    field.goalZ = goalZ;
+    field.width = width;
+    field.height = height;
+    field.revision = world::revision();
+    field.cost.assign(cellCount, UNREACHABLE);
+    field.direction.assign(cellCount, NO_DIRECTION);
+
+    if (goalX >= width || goalZ >= height)
+      return;
+
+    // Walkability is sampled once, it is read eight times per cell below
+    _walkable.resize(cellCount);
+    for (uint32_t z = 0; z < height; ++z)
+      for (uint32_t x = 0; x < width; ++x)
+        _walkable[z * width + x] = world::walkable(x, z);
+
+    if (!_walkable[goalZ * width + goalX])
+      return;
+
+    // Integration field
+    _open.clear();
+
+    Node start = { 0, goalZ * width + goalX };
+    field.cost[start.cell] = 0;
+    _open.push_back(start);
+
+    while (!_open.empty())
+    {
+      std::pop_heap(_open.begin(), _open.end());
+      const Node node = _open.back();
+      _open.pop_back();
+
+      if (node.cost > field.cost[node.cell])
+        continue;
+
+      const uint32_t x = node.cell % width;
+      const uint32_t z = node.cell / width;
+
+      for (uint32_t dir = 0; dir < 8; ++dir)
+      {
+        if (!canStep(x, z, dir, width, height))
+          continue;
+
+        const uint32_t next = (z + grid::DIRECTION_Z[dir]) * width + (x + grid::DIRECTION_X[dir]);
+        const uint32_t cost = node.cost + ((dir & 1) ? grid::DIAGONAL_COST : grid::STRAIGHT_COST);
+
+        if (cost < field.cost[next])
+        {
+          field.cost[next] = cost;
+          Node neighbour = { cost, next };
+          _open.push_back(neighbour);
+          std::push_heap(_open.begin(), _open.end());
+        }
+      }
+    }
+
+    // Direction field, every reachable cell points at its cheapest neighbour
+    for (uint32_t z = 0; z < height; ++z)
+      for (uint32_t x = 0; x < width; ++x)
+      {
+        const uint32_t cell = z * width + x;
+        uint32_t best = field.cost[cell];
+
+        if (best == UNREACHABLE || best == 0)
+          continue;
+
+        for (uint32_t dir = 0; dir < 8; ++dir)
+        {
+          if (!canStep(x, z, dir, width, height))
+            continue;
+
+          const uint32_t cost = field.cost[(z + grid::DIRECTION_Z[dir]) * width + (x + grid::DIRECTION_X[dir])];
+          if (cost < best)
+          {
+            best = cost;
+            field.direction[cell] = dir;
+          }
+        }
+      }
+  }
+
+  static void evict()
+  {
+    while (_fields.size() > _cacheSize)
+    {
+      FieldMap::iterator oldest = _fields.begin();
+      for (FieldMap::iterator it = _fields.begin(), end = _fields.end(); it != end; ++it)
+        if (it->second->lastUsed < oldest->second->lastUsed)
+          oldest = it;
+
+      delete oldest->second;
+      _fields.erase(oldest);
+    }
+  }
+
+  Field const& get(uint32_t goalX, uint32_t goalZ)
+  {
+    const uint32_t key = goalZ * world::width() + goalX;
+
+    FieldMap::iterator result = _fields.find(key);
+    Field * field = NULL;
+
+    if (result == _fields.end())
+    {
+      field = new Field();
+      build(*field, goalX, goalZ);
+      _fields.insert(std::make_pair(key, field));
+    }
+    else
+    {
+      field = result->second;
+      if (field->revision != world::revision() ||
+          field->width != world::width() ||
+          field->height != world::height() ||
+          field->goalX != goalX ||
+          field->goalZ != goalZ)
+        build(*field, goalX, goalZ);
+    }
+
+    field->lastUsed = ++_useCounter;
+    evict();
+
+    return *field;
+  }
+
+  void setCacheSize(uint32_t fields)
+  {
+    _cacheSize = fields > 0 ? fields : 1;
+    evict();
+  }
+
+  void clearCache()
+  {
+    for (FieldMap::iterator it = _fields.begin(), end = _fields.end(); it != end; ++it)
+      delete it->second;
+
+    _fields.clear();
+  }
+
+  void steer(unit::Storage & units, Field const& field, float speed)
+  {
+    const uint32_t cellCount = field.width * field.height;
+
+    // Direction vectors premultiplied by speed, indexed by direction
+    const math::Fixed straight = math::Fixed::fromFloat(speed);
+    const math::Fixed diagonal = straight * math::Fixed::fromRaw(math::fixed::SQRT_HALF_RAW);
+
+    float stepX[NO_DIRECTION + 1];
+    float stepZ[NO_DIRECTION + 1];
+    for (uint32_t dir = 0; dir < 8; ++dir)
+    {
+      const math::Fixed scale = (dir & 1) ? diagonal : straight;
+      stepX[dir] = (scale * grid::DIRECTION_X[dir]).toFloat();
+      stepZ[dir] = (scale * grid::DIRECTION_Z[dir]).toFloat();
+    }
+    stepX[NO_DIRECTION] = 0.0f;
+    stepZ[NO_DIRECTION] = 0.0f;
+
+    for (uint32_t i = 0; i < units.count; ++i)
+    {
+      const uint32_t cell = units.cell[i];
+      const uint8_t dir = cell < cellCount ? field.direction[cell] : (uint8_t)NO_DIRECTION;
+
+      units.stateHash ^= unit::setVelocity(units, i, stepX[dir], stepZ[dir]);
+    }
+  }
+
+  // -- Tcl Bindings --
+
+  PROC("flowfield:cacheSize", setCacheSize);
+  PROC("flowfield:clearCache", clearCache);
+
+}
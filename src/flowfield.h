@@ -0,0 +1,45 @@
+#pragma once
+
+#include "unit.h"
+
+#include <vector>
+
+/// Flow fields over the world grid. A field holds the walking cost from every
+/// cell to one goal cell and the direction to walk from each cell. Fields are
+/// cached per goal, so every unit heading for the same goal shares one build.
+namespace flowfield
+{
+
+  enum { NO_DIRECTION = 8 };
+
+  const uint32_t UNREACHABLE = 0xffffffff;
+
+  struct Field
+  {
+    uint32_t goalX, goalZ;
+    uint32_t width, height;
+    uint32_t revision;  // world::revision() the field was built against
+    uint64_t lastUsed;
+
+    std::vector<uint32_t> cost;      // Integration field, UNREACHABLE for blocked cells
+    std::vector<uint8_t> direction;  // Index into grid::DIRECTION_X/Z or NO_DIRECTION
+  };
+
+  /// Returns the field for the goal cell, building it if it is not cached or
+  /// the world has changed since it was built.
+  Field const& get(uint32_t goalX, uint32_t goalZ);
+
+  /// Builds the integration field with Dijkstra from the goal and derives
+  /// the direction field from it.
+  void build(Field & field, uint32_t goalX, uint32_t goalZ);
+
+  /// Maximum number of cached fields, the least recently used one is evicted
+  void setCacheSize(uint32_t fields);
+  void clearCache();
+
+  /// Sets the velocity of every unit in storage to follow the field at speed.
+  /// Relies on the cell stream written by unit::integrate(), only units whose
+  /// velocity changes are hashed again.
+  void steer(unit::Storage & units, Field const& field, float speed);
+
+}
@@ -0,0 +1,273 @@
+#include "fog.h"
+#include "player.h"
+#include "unit_tracker.h"
+#include "world.h"
+#include "tcl.h"
+#include "util.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace fog
+{
+  namespace {
+    // A block is one word of BLOCK_ROWS consecutive rows, the unit in which
+    // visibility is rebuilt
+    const uint32_t BLOCK_ROWS = 8;
+
+    struct View
+    {
+      // Own units in each world cell
+      std::vector<uint32_t> units;
+
+      // Cells with at least one unit and cells seen, one bit per cell
+      std::vector<uint64_t> occupied;
+      std::vector<uint64_t> visible;
+
+      std::vector<uint8_t> dirty;
+      std::vector<uint32_t> dirtyBlocks;
+    };
+
+    uint32_t _radius = 8;
+
+    // Half width of the vision circle on each row away from its center
+    std::vector<int32_t> _halfWidth;
+
+    uint32_t _width = 0;
+    uint32_t _height = 0;
+    uint32_t _wordsPerRow = 0;
+    uint32_t _blockRows = 0;
+    std::vector<View> _views;
+    bool _stale = true;
+
+    // The world cell each unit was counted in
+    unit::Tracker _tracker;
+  }
+
+  static void reset()
+  {
+    _width = world::width();
+    _height = world::height();
+    _wordsPerRow = (_width + 63) / 64;
+    _blockRows = (_height + BLOCK_ROWS - 1) / BLOCK_ROWS;
+
+    _views.assign(player::players().size(), View());
+    for (size_t i = 0; i < _views.size(); ++i)
+    {
+      View & view = _views[i];
+      view.units.assign(_width * _height, 0);
+      view.occupied.assign(_wordsPerRow * _height, 0);
+      view.visible.assign(_wordsPerRow * _height, 0);
+      view.dirty.assign(_wordsPerRow * _blockRows, 0);
+    }
+
+    // Rounded out a little so small circles do not look like diamonds
+    const int32_t radius = _radius;
+    _halfWidth.assign(radius + 1, 0);
+    for (int32_t dz = 0; dz <= radius; ++dz)
+    {
+      int32_t half = 0;
+      while ((half + 1) * (half + 1) + dz * dz <= radius * radius + radius)
+        ++half;
+      _halfWidth[dz] = half;
+    }
+
+    _tracker.clear();
+    _stale = false;
+  }
+
+  static void markDirty(View & view, uint32_t cell)
+  {
+    const int32_t radius = _radius;
+    const int32_t x = cell % _width, z = cell / _width;
+    const uint32_t bx0 = std::max(x - radius, 0) / 64;
+    const uint32_t bx1 = std::min(x + radius, (int32_t)_width - 1) / 64;
+    const uint32_t bz0 = std::max(z - radius, 0) / BLOCK_ROWS;
+    const uint32_t bz1 = std::min(z + radius, (int32_t)_height - 1) / BLOCK_ROWS;
+
+    for (uint32_t bz = bz0; bz <= bz1; ++bz)
+      for (uint32_t bx = bx0; bx <= bx1; ++bx)
+      {
+        const uint32_t block = bz * _wordsPerRow + bx;
+        if (!view.dirty[block])
+        {
+          view.dirty[block] = 1;
+          view.dirtyBlocks.push_back(block);
+        }
+      }
+  }
+
+  static void addUnit(View & view, uint32_t cell)
+  {
+    if (view.units[cell]++ == 0)
+    {
+      view.occupied[(cell / _width) * _wordsPerRow + (cell % _width) / 64] |= 1ull << (cell % _width % 64);
+      markDirty(view, cell);
+    }
+  }
+
+  static void removeUnit(View & view, uint32_t cell)
+  {
+    if (--view.units[cell] == 0)
+    {
+      view.occupied[(cell / _width) * _wordsPerRow + (cell % _width) / 64] &= ~(1ull << (cell % _width % 64));
+      markDirty(view, cell);
+    }
+  }
+
+  static void dropUnit(uint32_t, uint32_t owner, uint32_t cell)
+  {
+    removeUnit(_views[owner], cell);
+  }
+
+  /// Clears a block and ORs in the circle of every occupied cell in reach
+  static void rebuild(View & view, uint32_t block)
+  {
+    const int32_t radius = _radius;
+    const uint32_t bx = block % _wordsPerRow;
+    const int32_t base = bx * 64;
+    const int32_t z0 = (block / _wordsPerRow) * BLOCK_ROWS;
+    const int32_t z1 = std::min(z0 + (int32_t)BLOCK_ROWS, (int32_t)_height) - 1;
+    const int32_t last = std::min(base + 63, (int32_t)_width - 1);
+
+    for (int32_t z = z0; z <= z1; ++z)
+      view.visible[z * _wordsPerRow + bx] = 0;
+
+    // Occupied cells whose circle can reach the block
+    const int32_t sx0 = std::max(base - radius, 0), sx1 = std::min(last + radius, (int32_t)_width - 1);
+    const int32_t sz0 = std::max(z0 - radius, 0), sz1 = std::min(z1 + radius, (int32_t)_height - 1);
+
+    for (int32_t sz = sz0; sz <= sz1; ++sz)
+    {
+      const uint64_t * row = &view.occupied[sz * _wordsPerRow];
+      const int32_t rz0 = std::max(z0, sz - radius), rz1 = std::min(z1, sz + radius);
+
+      for (uint32_t w = sx0 / 64; w <= (uint32_t)sx1 / 64; ++w)
+      {
+        const uint32_t lo = std::max(sx0 - (int32_t)w * 64, 0);
+        const uint32_t hi = std::min(sx1 - (int32_t)w * 64, 63);
+        uint64_t bits = row[w] & util::spanMask(lo, hi);
+
+        while (bits)
+        {
+          const int32_t cx = w * 64 + util::lowestBit(bits) - base;
+          bits &= bits - 1;
+
+          for (int32_t z = rz0; z <= rz1; ++z)
+          {
+            const int32_t half = _halfWidth[z > sz ? z - sz : sz - z];
+            const int32_t spanLo = std::max(cx - half, 0);
+            const int32_t spanHi = std::min(cx + half, last - base);
+            if (spanLo <= spanHi)
+              view.visible[z * _wordsPerRow + bx] |= util::spanMask(spanLo, spanHi);
+          }
+        }
+      }
+    }
+  }
+
+  // -- API --
+
+  void setVisionRadius(uint32_t cells)
+  {
+    _radius = std::min<uint32_t>(cells, 255);
+    _stale = true;
+  }
+
+  uint32_t visionRadius()
+  {
+    return _radius;
+  }
+
+  void clear()
+  {
+    _width = 0;
+    _height = 0;
+    _views.clear();
+    _tracker.clear();
+    _stale = true;
+  }
+
+  void update()
+  {
+    if (_stale || _width != world::width() || _height != world::height() ||
+        _views.size() != player::players().size())
+      reset();
+
+    if (_width == 0 || _height == 0)
+      return;
+
+    _tracker.begin();
+
+    for (uint32_t p = 0; p < _views.size(); ++p)
+    {
+      unit::Storage const& units = player::players()[p].units;
+      View & view = _views[p];
+
+      for (uint32_t i = 0; i < units.count; ++i)
+      {
+        // Integration already found the world cell, units off the map see
+        // nothing
+        const uint32_t cell = units.cell[i];
+        if (cell >= _width * _height)
+          continue;
+
+        // Vision only changes when the cell count goes to or from zero
+        uint32_t from, fromOwner;
+        if (!_tracker.move(units.ids[i], p, cell, from, fromOwner))
+          continue;
+
+        if (from != unit::Tracker::NO_CELL)
+          removeUnit(_views[fromOwner], from);
+
+        addUnit(view, cell);
+      }
+    }
+
+    // Dead units stop seeing
+    _tracker.sweep(dropUnit);
+
+    for (size_t p = 0; p < _views.size(); ++p)
+    {
+      View & view = _views[p];
+      for (size_t i = 0; i < view.dirtyBlocks.size(); ++i)
+      {
+        rebuild(view, view.dirtyBlocks[i]);
+        view.dirty[view.dirtyBlocks[i]] = 0;
+      }
+
+      view.dirtyBlocks.clear();
+    }
+  }
+
+  bool visible(uint32_t player, uint32_t x, uint32_t z)
+  {
+    if (player >= _views.size() || x >= _width || z >= _height)
+      return false;
+
+    return (_views[player].visible[z * _wordsPerRow + x / 64] >> (x % 64)) & 1;
+  }
+
+  bool visibleAt(uint32_t player, float x, float z)
+  {
+    if (_width == 0)
+      return false;
+
+    const uint32_t cell = world::cellAt(x, z);
+    return visible(player, cell % _width, cell / _width);
+  }
+
+  uint64_t row64(uint32_t player, uint32_t word, uint32_t z)
+  {
+    if (player >= _views.size() || word >= _wordsPerRow || z >= _height)
+      return 0;
+
+    return _views[player].visible[z * _wordsPerRow + word];
+  }
+
+  // -- Tcl Bindings --
+
+  PROC("fog:visionRadius", setVisionRadius);
+  PROC("fog:visible", visibleAt);
+
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+
+/// Fog of war. Every player sees the world cells within the vision radius of
+/// the cells its units stand in, kept as one bit per world cell in rows of
+/// 64-bit words. Only the parts of the bitmap near cells that gained or lost
+/// their last unit are rebuilt, by ORing a precomputed circle of row spans
+/// over the occupied cells around them.
+///
+/// Visibility is derived from the unit positions alone, so it is the same on
+/// every peer and can drive simulation decisions.
+namespace fog
+{
+
+  /// Vision radius in world cells, rebuilds every bitmap on the next update
+  void setVisionRadius(uint32_t cells);
+  uint32_t visionRadius();
+
+  /// Forgets all units
+  void clear();
+
+  /// Moves units that changed cells since the last update, adds new ones,
+  /// drops dead ones and rebuilds the visibility around them
+  void update();
+
+  /// Whether player sees world cell (x, z), cells outside the world are
+  /// never visible
+  bool visible(uint32_t player, uint32_t x, uint32_t z);
+
+  /// Same for the world cell containing world position (x, z)
+  bool visibleAt(uint32_t player, float x, float z);
+
+  /// Visibility of the 64 world cells [64 * word, 64 * word + 64) on row z,
+  /// bit n is cell 64 * word + n
+  uint64_t row64(uint32_t player, uint32_t word, uint32_t z);
+
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+
+/// Movement rules shared by the path finders that work on a grid, flowfield,
+/// jps and hpa. Moves are 8-connected, a straight step costs 10 and a
+/// diagonal one 14, so all of them agree on the cost of a path.
+namespace grid
+{
+
+  const uint32_t STRAIGHT_COST = 10;
+  const uint32_t DIAGONAL_COST = 14;
+
+  /// Unit steps for each direction, N, NE, E, SE, S, SW, W, NW. Odd
+  /// directions are diagonal.
+  const int8_t DIRECTION_X[8] = {  0,  1,  1,  1,  0, -1, -1, -1 };
+  const int8_t DIRECTION_Z[8] = { -1, -1,  0,  1,  1,  1,  0, -1 };
+
+  /// Cost of the shortest path between two cells when nothing is in the way
+  inline uint32_t octile(int32_t ax, int32_t az, int32_t bx, int32_t bz)
+  {
+    const uint32_t dx = ax > bx ? ax - bx : bx - ax;
+    const uint32_t dz = az > bz ? az - bz : bz - az;
+    return dx < dz ? DIAGONAL_COST * dx + STRAIGHT_COST * (dz - dx)
+                   : DIAGONAL_COST * dz + STRAIGHT_COST * (dx - dz);
+  }
+
+}
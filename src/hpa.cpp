@@ -0,0 +1,568 @@
+#include "hpa.h"
+#include "collide.h"
+#include "grid.h"
+#include "tcl.h"
+
+#include <algorithm>
+#include <queue>
+
+namespace hpa
+{
+  struct Cluster
+  {
+    Cluster() : dirty(true) { }
+
+    // Transitions towards the east and south neighbour, stored as pairs of
+    // (cell in this cluster, cell in the neighbour)
+    std::vector<uint32_t> east;
+    std::vector<uint32_t> south;
+
+    // Abstract nodes in this cluster and the walking cost between each pair,
+    // dist[a * nodes.size() + b]
+    std::vector<uint32_t> nodes;
+    std::vector<uint32_t> dist;
+
+    // Transitions leaving this cluster, pairs of (node index, cell on the other side)
+    std::vector<uint32_t> links;
+
+    bool dirty;
+  };
+
+  namespace {
+    const uint32_t UNREACHABLE = 0xffffffff;
+
+    // Runs of free border cells at least this long get a transition at both ends
+    const uint32_t LONG_ENTRANCE = 6;
+
+    // Paths shorter than this, in path cost, skip the abstract graph
+    const uint32_t NEAR_DISTANCE = grid::STRAIGHT_COST * CLUSTER_SIZE * 2;
+
+
+    uint32_t _width = 0;
+    uint32_t _height = 0;
+    uint32_t _clustersX = 0;
+    uint32_t _clustersZ = 0;
+
+    std::vector<Cluster> _clusters;
+    std::vector<uint32_t> _dirty;
+    bool _fullRebuild = true;
+    bool _listening = false;
+
+    // Search state indexed by cell, only valid where _stamp matches _search
+    uint32_t _search = 0;
+    std::vector<uint32_t> _stamp;
+    std::vector<uint32_t> _g;
+    std::vector<uint32_t> _parent;
+    std::vector<uint8_t> _closed;
+
+    typedef std::pair<uint32_t, uint32_t> Edge;
+    std::vector<Edge> _edges;
+    std::vector<Edge> _open;
+  }
+
+  static inline bool blocked(int32_t x, int32_t z)
+  {
+    return x < 0 || z < 0 || collide::checkI(x, z);
+  }
+
+  static inline uint32_t clusterOf(uint32_t x, uint32_t z)
+  {
+    return (z / CLUSTER_SIZE) * _clustersX + x / CLUSTER_SIZE;
+  }
+
+  static void markDirty(uint32_t cluster)
+  {
+    if (!_clusters[cluster].dirty)
+    {
+      _clusters[cluster].dirty = true;
+      _dirty.push_back(cluster);
+    }
+  }
+
+  static void onCollideChange(uint32_t x, uint32_t z, uint32_t width, uint32_t height)
+  {
+    if (_fullRebuild || collide::width() != _width || collide::height() != _height ||
+        (x == 0 && z == 0 && width >= _width && height >= _height))
+    {
+      _fullRebuild = true;
+      return;
+    }
+
+    // Border transitions depend on both sides, so the neighbours of every
+    // touched cluster have to be rebuilt as well.
+    const uint32_t x0 = (x > 0 ? x - 1 : 0) / CLUSTER_SIZE;
+    const uint32_t z0 = (z > 0 ? z - 1 : 0) / CLUSTER_SIZE;
+    const uint32_t x1 = std::min(x + width, _width - 1) / CLUSTER_SIZE;
+    const uint32_t z1 = std::min(z + height, _height - 1) / CLUSTER_SIZE;
+
+    for (uint32_t cz = z0; cz <= z1; ++cz)
+      for (uint32_t cx = x0; cx <= x1; ++cx)
+        markDirty(cz * _clustersX + cx);
+  }
+
+  // -- Cluster building --
+
+  /// Adds the transitions along one border. The border runs over count cells
+  /// starting at (x, z) stepping by (stepX, stepZ), the neighbour cell is
+  /// offset by (crossX, crossZ).
+  static void buildBorder(std::vector<uint32_t> & border, uint32_t x, uint32_t z, uint32_t count,
+                          uint32_t stepX, uint32_t stepZ, uint32_t crossX, uint32_t crossZ)
+  {
+    border.clear();
+
+    uint32_t runStart = 0;
+    uint32_t runLength = 0;
+
+    for (uint32_t i = 0; i <= count; ++i)
+    {
+      const uint32_t cx = x + stepX * i;
+      const uint32_t cz = z + stepZ * i;
+      const bool open = i < count && !blocked(cx, cz) && !blocked(cx + crossX, cz + crossZ);
+
+      if (open)
+      {
+        if (runLength++ == 0)
+          runStart = i;
+        continue;
+      }
+
+      if (runLength == 0)
+        continue;
+
+      uint32_t picks[2] = { runStart + runLength / 2, runStart + runLength / 2 };
+      if (runLength >= LONG_ENTRANCE)
+      {
+        picks[0] = runStart;
+        picks[1] = runStart + runLength - 1;
+      }
+
+      for (uint32_t p = 0; p < (picks[0] == picks[1] ? 1u : 2u); ++p)
+      {
+        const uint32_t px = x + stepX * picks[p];
+        const uint32_t pz = z + stepZ * picks[p];
+        border.push_back(pz * _width + px);
+        border.push_back((pz + crossZ) * _width + px + crossX);
+      }
+
+      runLength = 0;
+    }
+  }
+
+  static void buildBorders(uint32_t cx, uint32_t cz)
+  {
+    Cluster & cluster = _clusters[cz * _clustersX + cx];
+    const uint32_t x0 = cx * CLUSTER_SIZE;
+    const uint32_t z0 = cz * CLUSTER_SIZE;
+    const uint32_t w = std::min<uint32_t>(CLUSTER_SIZE, _width - x0);
+    const uint32_t h = std::min<uint32_t>(CLUSTER_SIZE, _height - z0);
+
+    // Nothing can be entered in a solid cluster
+    if (collide::rectBlocked(x0, z0, w, h))
+    {
+      cluster.east.clear();
+      cluster.south.clear();
+      return;
+    }
+
+    if (cx + 1 < _clustersX)
+      buildBorder(cluster.east, x0 + w - 1, z0, h, 0, 1, 1, 0);
+    else
+      cluster.east.clear();
+
+    if (cz + 1 < _clustersZ)
+      buildBorder(cluster.south, x0, z0 + h - 1, w, 1, 0, 0, 1);
+    else
+      cluster.south.clear();
+  }
+
+  /// Dijkstra from cell limited to the cluster, distances are written for
+  /// every cell of the cluster in local coordinates.
+  static void localDistances(uint32_t cx, uint32_t cz, uint32_t cell, uint32_t * dist)
+  {
+    const int32_t x0 = cx * CLUSTER_SIZE;
+    const int32_t z0 = cz * CLUSTER_SIZE;
+    const int32_t w = std::min<uint32_t>(CLUSTER_SIZE, _width - x0);
+    const int32_t h = std::min<uint32_t>(CLUSTER_SIZE, _height - z0);
+
+    for (uint32_t i = 0; i < CLUSTER_SIZE * CLUSTER_SIZE; ++i)
+      dist[i] = UNREACHABLE;
+
+    const uint32_t start = (cell / _width - z0) * CLUSTER_SIZE + (cell % _width - x0);
+
+    // Open clusters need no search, the distance is the octile distance
+    if (collide::rectFree(x0, z0, w, h))
+    {
+      const int32_t sx = start % CLUSTER_SIZE, sz = start / CLUSTER_SIZE;
+      for (int32_t lz = 0; lz < h; ++lz)
+        for (int32_t lx = 0; lx < w; ++lx)
+          dist[lz * CLUSTER_SIZE + lx] = grid::octile(lx, lz, sx, sz);
+
+      return;
+    }
+
+    typedef std::pair<uint32_t, uint32_t> Node;
+    std::priority_queue<Node, std::vector<Node>, std::greater<Node> > open;
+
+    dist[start] = 0;
+    open.push(Node(0, start));
+
+    while (!open.empty())
+    {
+      const Node node = open.top();
+      open.pop();
+
+      if (node.first > dist[node.second])
+        continue;
+
+      const int32_t lx = node.second % CLUSTER_SIZE;
+      const int32_t lz = node.second / CLUSTER_SIZE;
+
+      for (uint32_t dir = 0; dir < 8; ++dir)
+      {
+        const int32_t nx = lx + grid::DIRECTION_X[dir];
+        const int32_t nz = lz + grid::DIRECTION_Z[dir];
+
+        if (nx < 0 || nz < 0 || nx >= w || nz >= h || blocked(x0 + nx, z0 + nz))
+          continue;
+
+        // No corner cutting, inside the cluster only
+        if ((dir & 1) && (blocked(x0 + nx, z0 + lz) || blocked(x0 + lx, z0 + nz)))
+          continue;
+
+        const uint32_t next = nz * CLUSTER_SIZE + nx;
+        const uint32_t cost = node.first + ((dir & 1) ? grid::DIAGONAL_COST : grid::STRAIGHT_COST);
+        if (cost < dist[next])
+        {
+          dist[next] = cost;
+          open.push(Node(cost, next));
+        }
+      }
+    }
+  }
+
+  static inline uint32_t localIndex(uint32_t cx, uint32_t cz, uint32_t cell)
+  {
+    return (cell / _width - cz * CLUSTER_SIZE) * CLUSTER_SIZE + (cell % _width - cx * CLUSTER_SIZE);
+  }
+
+  static uint32_t addNode(Cluster & cluster, uint32_t cell)
+  {
+    std::vector<uint32_t>::iterator it = std::find(cluster.nodes.begin(), cluster.nodes.end(), cell);
+    if (it != cluster.nodes.end())
+      return it - cluster.nodes.begin();
+
+    cluster.nodes.push_back(cell);
+    return cluster.nodes.size() - 1;
+  }
+
+  static void buildNodes(uint32_t cx, uint32_t cz)
+  {
+    Cluster & cluster = _clusters[cz * _clustersX + cx];
+    cluster.nodes.clear();
+    cluster.links.clear();
+
+    // Our own east and south borders, then the borders of the west and north
+    // neighbours seen from the other side
+    for (size_t i = 0; i < cluster.east.size(); i += 2)
+    {
+      cluster.links.push_back(addNode(cluster, cluster.east[i]));
+      cluster.links.push_back(cluster.east[i + 1]);
+    }
+
+    for (size_t i = 0; i < cluster.south.size(); i += 2)
+    {
+      cluster.links.push_back(addNode(cluster, cluster.south[i]));
+      cluster.links.push_back(cluster.south[i + 1]);
+    }
+
+    if (cx > 0)
+    {
+      std::vector<uint32_t> const& west = _clusters[cz * _clustersX + cx - 1].east;
+      for (size_t i = 0; i < west.size(); i += 2)
+      {
+        cluster.links.push_back(addNode(cluster, west[i + 1]));
+        cluster.links.push_back(west[i]);
+      }
+    }
+
+    if (cz > 0)
+    {
+      std::vector<uint32_t> const& north = _clusters[(cz - 1) * _clustersX + cx].south;
+      for (size_t i = 0; i < north.size(); i += 2)
+      {
+        cluster.links.push_back(addNode(cluster, north[i + 1]));
+        cluster.links.push_back(north[i]);
+      }
+    }
+
+    // Intra-cluster edges
+    const uint32_t count = cluster.nodes.size();
+    cluster.dist.assign(count * count, UNREACHABLE);
+
+    uint32_t local[CLUSTER_SIZE * CLUSTER_SIZE];
+    for (uint32_t a = 0; a < count; ++a)
+    {
+      localDistances(cx, cz, cluster.nodes[a], local);
+      for (uint32_t b = 0; b < count; ++b)
+        cluster.dist[a * count + b] = local[localIndex(cx, cz, cluster.nodes[b])];
+    }
+  }
+
+  // -- API --
+
+  void init()
+  {
+    if (!_listening)
+    {
+      collide::addListener(onCollideChange);
+      _listening = true;
+    }
+
+    _fullRebuild = true;
+  }
+
+  void shutdown()
+  {
+    if (_listening)
+    {
+      collide::removeListener(onCollideChange);
+      _listening = false;
+    }
+
+    _clusters.clear();
+    _dirty.clear();
+    _fullRebuild = true;
+
+    _stamp.clear();
+    _g.clear();
+    _parent.clear();
+    _closed.clear();
+  }
+
+  void update()
+  {
+    if (_fullRebuild)
+    {
+      _width = collide::width();
+      _height = collide::height();
+      _clustersX = (_width + CLUSTER_SIZE - 1) / CLUSTER_SIZE;
+      _clustersZ = (_height + CLUSTER_SIZE - 1) / CLUSTER_SIZE;
+
+      _clusters.assign(_clustersX * _clustersZ, Cluster());
+      _dirty.clear();
+      for (uint32_t i = 0; i < _clusters.size(); ++i)
+        _dirty.push_back(i);
+
+      _fullRebuild = false;
+    }
+
+    if (_dirty.empty())
+      return;
+
+    // Borders first, nodes depend on the borders of the west and north neighbours
+    for (size_t i = 0; i < _dirty.size(); ++i)
+      buildBorders(_dirty[i] % _clustersX, _dirty[i] / _clustersX);
+
+    for (size_t i = 0; i < _dirty.size(); ++i)
+    {
+      buildNodes(_dirty[i] % _clustersX, _dirty[i] / _clustersX);
+      _clusters[_dirty[i]].dirty = false;
+    }
+
+    _dirty.clear();
+  }
+
+  uint32_t nodeCount()
+  {
+    update();
+
+    uint32_t count = 0;
+    for (size_t i = 0; i < _clusters.size(); ++i)
+      count += _clusters[i].nodes.size();
+
+    return count;
+  }
+
+  // -- Search --
+
+  static bool abstractSearch(uint32_t start, uint32_t goal, std::vector<uint32_t> & cells)
+  {
+    const uint32_t goalX = goal % _width;
+    const uint32_t goalZ = goal / _width;
+    const uint32_t startCluster = clusterOf(start % _width, start / _width);
+    const uint32_t goalCluster = clusterOf(goalX, goalZ);
+
+    if (_stamp.size() != _width * _height)
+    {
+      _stamp.assign(_width * _height, 0);
+      _g.resize(_width * _height);
+      _parent.resize(_width * _height);
+      _closed.resize(_width * _height);
+      _search = 0;
+    }
+
+    if (++_search == 0)
+    {
+      _stamp.assign(_stamp.size(), 0);
+      _search = 1;
+    }
+
+    // Start and goal are inserted into their clusters for this search only
+    uint32_t startLocal[CLUSTER_SIZE * CLUSTER_SIZE];
+    uint32_t goalLocal[CLUSTER_SIZE * CLUSTER_SIZE];
+    localDistances(startCluster % _clustersX, startCluster / _clustersX, start, startLocal);
+    localDistances(goalCluster % _clustersX, goalCluster / _clustersX, goal, goalLocal);
+
+    // Min-heap of (f, cell)
+    _open.clear();
+
+    _stamp[start] = _search;
+    _g[start] = 0;
+    _parent[start] = start;
+    _closed[start] = false;
+    _open.push_back(Edge(grid::octile(start % _width, start / _width, goalX, goalZ), start));
+
+    while (!_open.empty())
+    {
+      std::pop_heap(_open.begin(), _open.end(), std::greater<Edge>());
+      const uint32_t cell = _open.back().second;
+      _open.pop_back();
+
+      if (_closed[cell])
+        continue;
+      _closed[cell] = true;
+
+      if (cell == goal)
+      {
+        for (uint32_t c = goal; ; c = _parent[c])
+        {
+          cells.push_back(c);
+          if (c == start)
+            break;
+        }
+
+        std::reverse(cells.begin(), cells.end());
+        return true;
+      }
+
+      const uint32_t g = _g[cell];
+      const uint32_t clusterIndex = clusterOf(cell % _width, cell / _width);
+      const uint32_t cx = clusterIndex % _clustersX;
+      const uint32_t cz = clusterIndex / _clustersX;
+      const Cluster & cluster = _clusters[clusterIndex];
+
+      // Edges out of the current cell as (target cell, cost)
+      _edges.clear();
+
+      if (cell == start)
+      {
+        for (size_t i = 0; i < cluster.nodes.size(); ++i)
+        {
+          const uint32_t cost = startLocal[localIndex(cx, cz, cluster.nodes[i])];
+          if (cost != UNREACHABLE)
+            _edges.push_back(Edge(cluster.nodes[i], cost));
+        }
+
+        // A start on a transition also crosses into the next cluster
+        const uint32_t a = std::find(cluster.nodes.begin(), cluster.nodes.end(), cell) - cluster.nodes.begin();
+        for (size_t i = 0; i < cluster.links.size(); i += 2)
+          if (cluster.links[i] == a)
+            _edges.push_back(Edge(cluster.links[i + 1], grid::STRAIGHT_COST));
+
+        if (startCluster == goalCluster)
+        {
+          const uint32_t cost = startLocal[localIndex(cx, cz, goal)];
+          if (cost != UNREACHABLE)
+            _edges.push_back(Edge(goal, cost));
+        }
+      }
+      else
+      {
+        const uint32_t count = cluster.nodes.size();
+        const uint32_t a = std::find(cluster.nodes.begin(), cluster.nodes.end(), cell) - cluster.nodes.begin();
+
+        for (uint32_t b = 0; b < count; ++b)
+          if (b != a && cluster.dist[a * count + b] != UNREACHABLE)
+            _edges.push_back(Edge(cluster.nodes[b], cluster.dist[a * count + b]));
+
+        for (size_t i = 0; i < cluster.links.size(); i += 2)
+          if (cluster.links[i] == a)
+            _edges.push_back(Edge(cluster.links[i + 1], grid::STRAIGHT_COST));
+
+        if (clusterIndex == goalCluster)
+        {
+          const uint32_t cost = goalLocal[localIndex(cx, cz, cell)];
+          if (cost != UNREACHABLE)
+            _edges.push_back(Edge(goal, cost));
+        }
+      }
+
+      for (size_t i = 0; i < _edges.size(); ++i)
+      {
+        const uint32_t target = _edges[i].first;
+        const uint32_t cost = g + _edges[i].second;
+
+        if (_stamp[target] == _search && (_closed[target] || _g[target] <= cost))
+          continue;
+
+        _stamp[target] = _search;
+        _g[target] = cost;
+        _parent[target] = cell;
+        _closed[target] = false;
+
+        _open.push_back(Edge(cost + grid::octile(target % _width, target / _width, goalX, goalZ), target));
+        std::push_heap(_open.begin(), _open.end(), std::greater<Edge>());
+      }
+    }
+
+    return false;
+  }
+
+  bool findPath(uint32_t startX, uint32_t startZ, uint32_t goalX, uint32_t goalZ, jps::Path & path, bool refine)
+  {
+    path.clear();
+    update();
+
+    if (blocked(startX, startZ) || blocked(goalX, goalZ))
+      return false;
+
+    // Close by the abstract graph only adds detours, search the bitmap directly
+    if (refine && grid::octile(startX, startZ, goalX, goalZ) < NEAR_DISTANCE)
+      return jps::findPath(startX, startZ, goalX, goalZ, path);
+
+    std::vector<uint32_t> cells;
+    if (!abstractSearch(startZ * _width + startX, goalZ * _width + goalX, cells))
+      return false;
+
+    if (!refine)
+    {
+      for (size_t i = 0; i < cells.size(); ++i)
+      {
+        jps::Point point = { cells[i] % _width, cells[i] / _width };
+        path.push_back(point);
+      }
+      return true;
+    }
+
+    // Each abstract edge is short, so refining it with JPS stays local
+    jps::Path segment;
+    for (size_t i = 1; i < cells.size(); ++i)
+    {
+      if (!jps::findPath(cells[i - 1] % _width, cells[i - 1] / _width, cells[i] % _width, cells[i] / _width, segment))
+        return false;
+
+      path.insert(path.end(), segment.begin() + (path.empty() ? 0 : 1), segment.end());
+    }
+
+    if (path.empty())
+    {
+      jps::Point point = { startX, startZ };
+      path.push_back(point);
+    }
+
+    return true;
+  }
+
+  PROC("hpa:nodeCount", nodeCount);
+
+}
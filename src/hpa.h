@@ -0,0 +1,30 @@
+#pragma once
+
+#include "jps.h"
+
+/// Hierarchical pathfinding (HPA*) over the collide bitmap. The bitmap is cut
+/// into CLUSTER_SIZE x CLUSTER_SIZE clusters, transitions between clusters
+/// become abstract nodes and paths inside a cluster become abstract edges.
+/// Long paths are searched on the small abstract graph and then refined with
+/// jump point search. Changes to the bitmap only rebuild the clusters they
+/// touch, the next time the graph is used.
+namespace hpa
+{
+
+  enum { CLUSTER_SIZE = 16 };
+
+  void init();
+  void shutdown();
+
+  /// Rebuilds the dirty clusters, called by findPath() as needed
+  void update();
+
+  /// Finds a path between two collide cells, the result uses the same format
+  /// as jps::findPath(). When refine is false only the abstract path through
+  /// the cluster transitions is returned.
+  bool findPath(uint32_t startX, uint32_t startZ, uint32_t goalX, uint32_t goalZ, jps::Path & path, bool refine = true);
+
+  /// Number of abstract nodes, for diagnostics
+  uint32_t nodeCount();
+
+}
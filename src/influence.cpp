@@ -0,0 +1,227 @@
+#include "influence.h"
+#include "player.h"
+#include "unit_tracker.h"
+#include "world.h"
+#include "tcl.h"
+
+#include <stdio.h>
+#include <algorithm>
+
+namespace influence
+{
+  namespace {
+    const uint32_t STAMP_SIZE = 2 * RADIUS + 1;
+
+    uint32_t _worldWidth = 0;
+    uint32_t _worldHeight = 0;
+    uint32_t _width = 0;
+    uint32_t _height = 0;
+    uint32_t _players = 0;
+
+    // Strength of each player in each coarse cell, player after player, and
+    // the sum over all players
+    std::vector<int32_t> _maps;
+    std::vector<int32_t> _total;
+
+    // Falloff of a unit at the center of the stamp
+    int32_t _stamp[STAMP_SIZE * STAMP_SIZE];
+
+    // The coarse cell each unit's stamp was added to
+    unit::Tracker _tracker;
+  }
+
+  static void initStamp()
+  {
+    // Full strength in the own cell, falling off with the squared distance
+    const int32_t full = (RADIUS + 1) * (RADIUS + 1);
+    for (int32_t dz = -RADIUS; dz <= RADIUS; ++dz)
+      for (int32_t dx = -RADIUS; dx <= RADIUS; ++dx)
+        _stamp[(dz + RADIUS) * STAMP_SIZE + dx + RADIUS] = std::max(0, full - dx * dx - dz * dz);
+  }
+
+  static void apply(uint32_t owner, uint32_t cell, int32_t sign)
+  {
+    const int32_t cx = cell % _width, cz = cell / _width;
+    const int32_t x0 = std::max(cx - RADIUS, 0), x1 = std::min(cx + RADIUS, (int32_t)_width - 1);
+    const int32_t z0 = std::max(cz - RADIUS, 0), z1 = std::min(cz + RADIUS, (int32_t)_height - 1);
+
+    int32_t * map = &_maps[owner * _width * _height];
+    for (int32_t z = z0; z <= z1; ++z)
+    {
+      const int32_t * weights = &_stamp[(z - cz + RADIUS) * STAMP_SIZE];
+      for (int32_t x = x0; x <= x1; ++x)
+      {
+        const int32_t delta = weights[x - cx + RADIUS] * sign;
+        map[z * _width + x] += delta;
+        _total[z * _width + x] += delta;
+      }
+    }
+  }
+
+  static void removeStamp(uint32_t, uint32_t owner, uint32_t cell)
+  {
+    apply(owner, cell, -1);
+  }
+
+  static void reset()
+  {
+    _worldWidth = world::width();
+    _worldHeight = world::height();
+    _width = (_worldWidth + CELL_SIZE - 1) / CELL_SIZE;
+    _height = (_worldHeight + CELL_SIZE - 1) / CELL_SIZE;
+    _players = player::players().size();
+
+    _maps.assign(_players * _width * _height, 0);
+    _total.assign(_width * _height, 0);
+    _tracker.clear();
+
+    initStamp();
+  }
+
+  // -- API --
+
+  void clear()
+  {
+    _worldWidth = 0;
+    _worldHeight = 0;
+    _width = 0;
+    _height = 0;
+    _players = 0;
+    _maps.clear();
+    _total.clear();
+    _tracker.clear();
+  }
+
+  void update()
+  {
+    if (_worldWidth != world::width() || _worldHeight != world::height() ||
+        _players != player::players().size())
+      reset();
+
+    if (_total.empty())
+      return;
+
+    _tracker.begin();
+
+    for (uint32_t p = 0; p < _players; ++p)
+    {
+      unit::Storage const& units = player::players()[p].units;
+
+      for (uint32_t i = 0; i < units.count; ++i)
+      {
+        // Coarse cell from the world cell integration already found
+        const uint32_t worldCell = units.cell[i];
+        const uint32_t cell = (worldCell / _worldWidth / CELL_SIZE) * _width + (worldCell % _worldWidth) / CELL_SIZE;
+
+        // Stamps only move when a unit crosses into another block
+        uint32_t from, fromOwner;
+        if (!_tracker.move(units.ids[i], p, cell, from, fromOwner))
+          continue;
+
+        if (from != unit::Tracker::NO_CELL)
+          apply(fromOwner, from, -1);
+
+        apply(p, cell, 1);
+      }
+    }
+
+    // Dead units take their stamp with them
+    _tracker.sweep(removeStamp);
+  }
+
+  uint32_t width()
+  {
+    return _width;
+  }
+
+  uint32_t height()
+  {
+    return _height;
+  }
+
+  uint32_t cellAt(float x, float z)
+  {
+    if (_total.empty())
+      return 0;
+
+    const uint32_t worldCell = world::cellAt(x, z);
+    return (worldCell / _worldWidth / CELL_SIZE) * _width + (worldCell % _worldWidth) / CELL_SIZE;
+  }
+
+  int32_t value(uint32_t player, Kind kind, uint32_t cell)
+  {
+    if (player >= _players || cell >= _total.size())
+      return 0;
+
+    const int32_t friendly = _maps[player * _width * _height + cell];
+    switch (kind)
+    {
+      case FRIENDLY: return friendly;
+      case ENEMY:    return _total[cell] - friendly;
+      default:       return friendly - (_total[cell] - friendly);
+    }
+  }
+
+  void query(uint32_t player, Kind kind, uint32_t x0, uint32_t z0, uint32_t x1, uint32_t z1,
+             std::vector<int32_t> & out)
+  {
+    if (player >= _players || _total.empty())
+      return;
+
+    x1 = std::min(x1, _width - 1);
+    z1 = std::min(z1, _height - 1);
+
+    const int32_t * map = &_maps[player * _width * _height];
+    for (uint32_t z = z0; z <= z1; ++z)
+      for (uint32_t x = x0; x <= x1; ++x)
+      {
+        const uint32_t cell = z * _width + x;
+        const int32_t friendly = map[cell];
+        const int32_t enemy = _total[cell] - friendly;
+        out.push_back(kind == FRIENDLY ? friendly : (kind == ENEMY ? enemy : friendly - enemy));
+      }
+  }
+
+  // -- Tcl Bindings --
+
+  static std::string toList(std::vector<int32_t> const& values)
+  {
+    std::string result;
+    char buf[16];
+    for (size_t i = 0; i < values.size(); ++i)
+    {
+      snprintf(buf, sizeof(buf), i ? " %d" : "%d", values[i]);
+      result += buf;
+    }
+
+    return result;
+  }
+
+  static std::string at(uint32_t player, float x, float z)
+  {
+    const uint32_t cell = cellAt(x, z);
+
+    std::vector<int32_t> values;
+    values.push_back(value(player, FRIENDLY, cell));
+    values.push_back(value(player, ENEMY, cell));
+    return toList(values);
+  }
+
+  /// The whole map of one kind, row by row. Kind is 0 for friendly, 1 for
+  /// enemy and 2 for control.
+  static std::string map(uint32_t player, uint32_t kind)
+  {
+    std::vector<int32_t> values;
+    values.reserve(_width * _height);
+    if (_width > 0)
+      query(player, (Kind)std::min<uint32_t>(kind, CONTROL), 0, 0, _width - 1, _height - 1, values);
+
+    return toList(values);
+  }
+
+  PROC("influence:at", at);
+  PROC("influence:map", map);
+  PROC("influence:width", width);
+  PROC("influence:height", height);
+
+}
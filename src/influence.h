@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+/// Influence maps for AI decisions. Each unit adds its strength to the
+/// coarse cells around it with falloff, summed per player. The sums are kept
+/// up to date incrementally, a unit only moves its stamp when it crosses a
+/// coarse cell boundary, so a lookup is a read from a map that is always
+/// current.
+///
+/// Coarse cells cover CELL_SIZE x CELL_SIZE world cells, aligned to the world
+/// cells. Weights are integers, so the maps are exact and the same on every
+/// peer no matter in which order units moved.
+namespace influence
+{
+
+  enum
+  {
+    CELL_SIZE = 4,
+
+    /// Coarse cells a unit reaches in each direction
+    RADIUS = 2
+  };
+
+  enum Kind
+  {
+    FRIENDLY,
+    ENEMY,
+
+    /// Friendly minus enemy, positive where the player is in control
+    CONTROL
+  };
+
+  /// Forgets all units
+  void clear();
+
+  /// Moves the stamps of units that crossed a coarse cell boundary since the
+  /// last update, adds new units and drops dead ones
+  void update();
+
+  uint32_t width();
+  uint32_t height();
+
+  /// Coarse cell containing world position (x, z), clamped to the map
+  uint32_t cellAt(float x, float z);
+
+  /// Value of a single coarse cell as seen by player
+  int32_t value(uint32_t player, Kind kind, uint32_t cell);
+
+  /// Writes the values of the coarse cells in [x0, x1] x [z0, z1] to out,
+  /// row by row. The rectangle is clamped to the map.
+  void query(uint32_t player, Kind kind, uint32_t x0, uint32_t z0, uint32_t x1, uint32_t z1,
+             std::vector<int32_t> & out);
+
+}
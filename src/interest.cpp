@@ -0,0 +1,418 @@
+#include "interest.h"
+#include "player.h"
+#include "unit_tracker.h"
+#include "world.h"
+#include "tcl.h"
+#include "fog.h"
+
+#include <algorithm>
+
+namespace interest
+{
+  namespace {
+    const uint32_t NOT_VISIBLE = 0xffffffff;
+
+    struct Viewer
+    {
+      bool used;
+      float x, z;
+      uint32_t player;
+
+      // Buckets in view, empty when x0 > x1
+      uint32_t x0, z0, x1, z1;
+
+      // The set is rebuilt from the buckets in view on the next update
+      bool refill;
+
+      // Handles the viewer sees and, per registry slot, where in visible the
+      // unit is or NOT_VISIBLE
+      std::vector<unit::ID> visible;
+      std::vector<uint32_t> visibleIndex;
+    };
+
+    float _radius = 40.0f;
+    float _margin = 8.0f;
+
+    uint32_t _width = 0;
+    uint32_t _height = 0;
+
+    // Unit registry slots in each grid cell
+    std::vector<std::vector<uint32_t> > _cells;
+
+    // The cell of each unit and, per registry slot, where it is in that
+    // cell's list
+    unit::Tracker _tracker;
+    std::vector<uint32_t> _listIndex;
+
+    // Per player some viewer is limited to, whether it sees the unit in each
+    // registry slot through the fog of war
+    std::vector<std::vector<uint8_t> > _seen;
+    std::vector<uint32_t> _seenBy;
+
+    // Registry slots that changed bucket or visibility in this update
+    std::vector<uint32_t> _changed;
+
+    std::vector<Viewer> _viewers;
+  }
+
+  // -- Visible sets --
+
+  static void show(Viewer & viewer, uint32_t slot, unit::ID id)
+  {
+    if (slot >= viewer.visibleIndex.size())
+      viewer.visibleIndex.resize(slot + 1, NOT_VISIBLE);
+
+    // A new unit in the slot of a visible one takes its place
+    if (viewer.visibleIndex[slot] != NOT_VISIBLE)
+    {
+      viewer.visible[viewer.visibleIndex[slot]] = id;
+      return;
+    }
+
+    viewer.visibleIndex[slot] = viewer.visible.size();
+    viewer.visible.push_back(id);
+  }
+
+  static void hide(Viewer & viewer, uint32_t slot)
+  {
+    if (slot >= viewer.visibleIndex.size() || viewer.visibleIndex[slot] == NOT_VISIBLE)
+      return;
+
+    const uint32_t index = viewer.visibleIndex[slot];
+    const unit::ID moved = viewer.visible.back();
+
+    viewer.visible[index] = moved;
+    viewer.visibleIndex[unit::index(moved)] = index;
+    viewer.visible.pop_back();
+    viewer.visibleIndex[slot] = NOT_VISIBLE;
+  }
+
+  static bool inView(Viewer const& viewer, uint32_t cell)
+  {
+    const uint32_t x = cell % _width, z = cell / _width;
+    return x >= viewer.x0 && x <= viewer.x1 && z >= viewer.z0 && z <= viewer.z1;
+  }
+
+  /// Whether viewer sees the unit in slot, bucket aside
+  static bool passes(Viewer const& viewer, uint32_t slot)
+  {
+    if (viewer.player >= _seen.size())
+      return true;
+
+    std::vector<uint8_t> const& seen = _seen[viewer.player];
+    return slot < seen.size() && seen[slot];
+  }
+
+  /// Buckets within reach of the camera of viewer
+  static void viewRect(Viewer const& viewer, uint32_t & x0, uint32_t & z0, uint32_t & x1, uint32_t & z1)
+  {
+    x0 = 0, z0 = 0, x1 = _width - 1, z1 = _height - 1;
+    if (_radius == 0.0f)
+      return;
+
+    const float reach = _radius + _margin;
+    const float localX = viewer.x + world::width() * 0.5f;
+    const float localZ = viewer.z + world::height() * 0.5f;
+
+    if (localX + reach < 0.0f || localZ + reach < 0.0f)
+    {
+      x0 = z0 = 1;
+      x1 = z1 = 0;
+      return;
+    }
+
+    x0 = std::max(0.0f, (localX - reach) / CELL_SIZE);
+    z0 = std::max(0.0f, (localZ - reach) / CELL_SIZE);
+    x1 = std::min<uint32_t>((localX + reach) / CELL_SIZE, _width - 1);
+    z1 = std::min<uint32_t>((localZ + reach) / CELL_SIZE, _height - 1);
+  }
+
+  /// Shows or hides every unit of bucket (x, z) for viewer
+  static void showBucket(Viewer & viewer, uint32_t x, uint32_t z, bool visible)
+  {
+    std::vector<uint32_t> const& list = _cells[z * _width + x];
+    for (size_t i = 0; i < list.size(); ++i)
+    {
+      if (!visible)
+        hide(viewer, list[i]);
+      else if (passes(viewer, list[i]))
+        show(viewer, list[i], _tracker.id(list[i]));
+    }
+  }
+
+  static void refill(Viewer & viewer)
+  {
+    viewer.visible.clear();
+    viewer.visibleIndex.clear();
+    viewer.refill = false;
+
+    viewRect(viewer, viewer.x0, viewer.z0, viewer.x1, viewer.z1);
+    for (uint32_t z = viewer.z0; z <= viewer.z1; ++z)
+      for (uint32_t x = viewer.x0; x <= viewer.x1; ++x)
+        showBucket(viewer, x, z, true);
+  }
+
+  /// Applies the buckets that entered or left the view since the last call
+  static void moveView(Viewer & viewer)
+  {
+    uint32_t x0, z0, x1, z1;
+    viewRect(viewer, x0, z0, x1, z1);
+    if (x0 == viewer.x0 && z0 == viewer.z0 && x1 == viewer.x1 && z1 == viewer.z1)
+      return;
+
+    for (uint32_t z = viewer.z0; z <= viewer.z1; ++z)
+      for (uint32_t x = viewer.x0; x <= viewer.x1; ++x)
+        if (x < x0 || x > x1 || z < z0 || z > z1)
+          showBucket(viewer, x, z, false);
+
+    for (uint32_t z = z0; z <= z1; ++z)
+      for (uint32_t x = x0; x <= x1; ++x)
+        if (x < viewer.x0 || x > viewer.x1 || z < viewer.z0 || z > viewer.z1)
+          showBucket(viewer, x, z, true);
+
+    viewer.x0 = x0, viewer.z0 = z0, viewer.x1 = x1, viewer.z1 = z1;
+  }
+
+  // -- Buckets --
+
+  static void insert(uint32_t slot, uint32_t cell)
+  {
+    if (slot >= _listIndex.size())
+      _listIndex.resize(slot + 1, 0);
+
+    _listIndex[slot] = _cells[cell].size();
+    _cells[cell].push_back(slot);
+  }
+
+  static void remove(uint32_t slot, uint32_t, uint32_t cell)
+  {
+    std::vector<uint32_t> & list = _cells[cell];
+    const uint32_t moved = list.back();
+
+    list[_listIndex[slot]] = moved;
+    _listIndex[moved] = _listIndex[slot];
+    list.pop_back();
+  }
+
+  static void drop(uint32_t slot, uint32_t owner, uint32_t cell)
+  {
+    remove(slot, owner, cell);
+
+    for (size_t v = 0; v < _viewers.size(); ++v)
+      hide(_viewers[v], slot);
+
+    for (size_t p = 0; p < _seen.size(); ++p)
+      if (slot < _seen[p].size())
+        _seen[p][slot] = 0;
+  }
+
+  static void reset()
+  {
+    _width = (world::width() + CELL_SIZE - 1) / CELL_SIZE;
+    _height = (world::height() + CELL_SIZE - 1) / CELL_SIZE;
+
+    _cells.assign(_width * _height, std::vector<uint32_t>());
+    _tracker.clear();
+    _listIndex.clear();
+    _seen.clear();
+
+    for (size_t v = 0; v < _viewers.size(); ++v)
+      _viewers[v].refill = true;
+  }
+
+  // -- API --
+
+  void setRadius(float radius)
+  {
+    _radius = radius > 0.0f ? radius : 0.0f;
+    for (size_t v = 0; v < _viewers.size(); ++v)
+      _viewers[v].refill = true;
+  }
+
+  void setMargin(float margin)
+  {
+    _margin = margin > 0.0f ? margin : 0.0f;
+    for (size_t v = 0; v < _viewers.size(); ++v)
+      _viewers[v].refill = true;
+  }
+
+  void clear()
+  {
+    _width = 0;
+    _height = 0;
+    _cells.clear();
+    _tracker.clear();
+    _listIndex.clear();
+    _seen.clear();
+    _viewers.clear();
+  }
+
+  uint32_t addViewer()
+  {
+    Viewer viewer;
+    viewer.used = true;
+    viewer.x = viewer.z = 0.0f;
+    viewer.player = ALL_PLAYERS;
+    viewer.x0 = viewer.z0 = 1;
+    viewer.x1 = viewer.z1 = 0;
+    viewer.refill = true;
+
+    for (size_t i = 0; i < _viewers.size(); ++i)
+      if (!_viewers[i].used)
+      {
+        _viewers[i] = viewer;
+        return i;
+      }
+
+    _viewers.push_back(viewer);
+    return _viewers.size() - 1;
+  }
+
+  void removeViewer(uint32_t viewer)
+  {
+    if (viewer < _viewers.size())
+    {
+      _viewers[viewer].used = false;
+      _viewers[viewer].visible.clear();
+      _viewers[viewer].visibleIndex.clear();
+    }
+  }
+
+  void setView(uint32_t viewer, float x, float z)
+  {
+    if (viewer >= _viewers.size())
+      return;
+
+    Viewer & v = _viewers[viewer];
+    v.x = x;
+    v.z = z;
+
+    // Only crossing into other buckets changes the set
+    if (!v.refill && !_cells.empty())
+      moveView(v);
+  }
+
+  void setPlayer(uint32_t viewer, uint32_t player)
+  {
+    if (viewer < _viewers.size() && _viewers[viewer].player != player)
+    {
+      _viewers[viewer].player = player;
+      _viewers[viewer].refill = true;
+    }
+  }
+
+  void update()
+  {
+    if (_width != (world::width() + CELL_SIZE - 1) / CELL_SIZE ||
+        _height != (world::height() + CELL_SIZE - 1) / CELL_SIZE)
+      reset();
+
+    if (_cells.empty())
+      return;
+
+    const float minX = world::width() * -0.5f;
+    const float minZ = world::height() * -0.5f;
+    const float scale = 1.0f / CELL_SIZE;
+
+    player::PlayerVector const& players = player::players();
+
+    // Fog is only looked at for the players some viewer is limited to
+    _seenBy.clear();
+    for (size_t v = 0; v < _viewers.size(); ++v)
+    {
+      const uint32_t player = _viewers[v].player;
+      if (_viewers[v].used && player < players.size() &&
+          std::find(_seenBy.begin(), _seenBy.end(), player) == _seenBy.end())
+        _seenBy.push_back(player);
+    }
+
+    _seen.resize(players.size());
+
+    _changed.clear();
+    _tracker.begin();
+
+    for (uint32_t p = 0; p < players.size(); ++p)
+    {
+      unit::Storage const& units = players[p].units;
+
+      for (uint32_t i = 0; i < units.count; ++i)
+      {
+        const uint32_t cellX = std::min<uint32_t>(std::max(0.0f, (units.x[i] - minX) * scale), _width - 1);
+        const uint32_t cellZ = std::min<uint32_t>(std::max(0.0f, (units.z[i] - minZ) * scale), _height - 1);
+        const uint32_t cell = cellZ * _width + cellX;
+        const uint32_t slot = unit::index(units.ids[i]);
+
+        // Only units that changed buckets are moved between the lists
+        uint32_t from, fromOwner;
+        bool changed = _tracker.move(units.ids[i], p, cell, from, fromOwner);
+        if (changed)
+        {
+          if (from != unit::Tracker::NO_CELL)
+            remove(slot, fromOwner, from);
+
+          insert(slot, cell);
+        }
+
+        // Integration already found the world cell for the fog
+        for (size_t s = 0; s < _seenBy.size(); ++s)
+        {
+          const uint32_t player = _seenBy[s];
+          std::vector<uint8_t> & seen = _seen[player];
+          if (slot >= seen.size())
+            seen.resize(slot + 1, 0);
+
+          const uint8_t visible = player == p ||
+                                  fog::visible(player, units.cell[i] % world::width(), units.cell[i] / world::width());
+          if (seen[slot] != visible)
+          {
+            seen[slot] = visible;
+            changed = true;
+          }
+        }
+
+        if (changed)
+          _changed.push_back(slot);
+      }
+    }
+
+    // Dead units leave their bucket and every set
+    _tracker.sweep(drop);
+
+    for (size_t v = 0; v < _viewers.size(); ++v)
+    {
+      Viewer & viewer = _viewers[v];
+      if (!viewer.used)
+        continue;
+
+      if (viewer.refill)
+      {
+        refill(viewer);
+        continue;
+      }
+
+      for (size_t c = 0; c < _changed.size(); ++c)
+      {
+        const uint32_t slot = _changed[c];
+        if (inView(viewer, _tracker.cell(slot)) && passes(viewer, slot))
+          show(viewer, slot, _tracker.id(slot));
+        else
+          hide(viewer, slot);
+      }
+    }
+  }
+
+  std::vector<unit::ID> const& collect(uint32_t viewer)
+  {
+    static const std::vector<unit::ID> none;
+    if (viewer >= _viewers.size() || !_viewers[viewer].used)
+      return none;
+
+    return _viewers[viewer].visible;
+  }
+
+  // -- Tcl Bindings --
+
+  PROC("interest:radius", setRadius);
+  PROC("interest:margin", setMargin);
+
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "unit.h"
+
+#include <vector>
+
+/// Area of interest for replication. Units are bucketed in a coarse grid that
+/// is kept up to date incrementally, a unit is only moved between buckets when
+/// it crosses a cell boundary. Each viewer sees the buckets within the view
+/// radius plus a margin around its camera and keeps the set of units it sees,
+/// which only changes for units that crossed a boundary, died or went in or
+/// out of the fog, and for the buckets entering or leaving the view.
+namespace interest
+{
+
+  enum { CELL_SIZE = 16 };
+
+  const uint32_t INVALID_VIEWER = 0xffffffff;
+  const uint32_t ALL_PLAYERS = 0xffffffff;
+
+  /// Radius around the camera that is replicated, 0 replicates everything
+  void setRadius(float radius);
+
+  /// Extra distance so units do not pop in and out right at the edge
+  void setMargin(float margin);
+
+  /// Forgets all units and viewers
+  void clear();
+
+  uint32_t addViewer();
+  void removeViewer(uint32_t viewer);
+  void setView(uint32_t viewer, float x, float z);
+
+  /// Limits viewer to the units of player and the enemies player sees
+  /// through the fog of war, ALL_PLAYERS sees everything. The set of the
+  /// viewer is rebuilt on the next update.
+  void setPlayer(uint32_t viewer, uint32_t player);
+
+  /// Moves units that crossed a cell boundary since the last update, adds
+  /// new units, drops dead ones and brings the set of every viewer up to
+  /// date with them
+  void update();
+
+  /// Handles of all units viewer can see as of the last update, in no
+  /// particular order
+  std::vector<unit::ID> const& collect(uint32_t viewer);
+
+}
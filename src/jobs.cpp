@@ -0,0 +1,258 @@
+#include "jobs.h"
+#include "tcl.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+namespace jobs
+{
+  struct Job
+  {
+    JobFunc func;
+    void * data;
+    Counter * counter;
+  };
+
+  /// Fixed size ring buffer, the owner works on the newest jobs for cache
+  /// locality while thieves take the oldest, which tend to be the largest.
+  struct Queue
+  {
+    enum { CAPACITY = 4096, MASK = CAPACITY - 1 };
+
+    Queue() : head(0), tail(0) { }
+
+    bool push(Job const& job)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (tail - head == CAPACITY)
+        return false;
+
+      jobs[tail++ & MASK] = job;
+      return true;
+    }
+
+    bool pop(Job & job)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (tail == head)
+        return false;
+
+      job = jobs[--tail & MASK];
+      return true;
+    }
+
+    bool steal(Job & job)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (tail == head)
+        return false;
+
+      job = jobs[head++ & MASK];
+      return true;
+    }
+
+    std::mutex mutex;
+    Job jobs[CAPACITY];
+    uint64_t head;
+    uint64_t tail;
+  };
+
+  namespace {
+    std::vector<Queue *> _queues;
+    std::vector<std::thread> _threads;
+
+    std::atomic<bool> _running(false);
+    std::atomic<int32_t> _queued(0);
+
+    std::mutex _sleepMutex;
+    std::condition_variable _wakeUp;
+
+    // Index of the queue owned by the current thread, the thread that called
+    // init() owns queue 0. Threads unknown to the job system use queue 0 too.
+    thread_local uint32_t _queueIndex = 0;
+  }
+
+  static void execute(Job const& job)
+  {
+    job.func(job.data);
+
+    if (job.counter)
+      job.counter->value.fetch_sub(1, std::memory_order_release);
+  }
+
+  static bool findJob(Job & job)
+  {
+    const uint32_t count = _queues.size();
+    bool found = _queues[_queueIndex]->pop(job);
+
+    // Start with the neighbour so that thieves spread out over the queues
+    for (uint32_t i = 1; i < count && !found; ++i)
+      found = _queues[(_queueIndex + i) % count]->steal(job);
+
+    if (found)
+      _queued.fetch_sub(1, std::memory_order_relaxed);
+
+    return found;
+  }
+
+  static void workerMain(uint32_t index)
+  {
+    _queueIndex = index;
+
+    Job job;
+    while (_running.load(std::memory_order_acquire))
+    {
+      if (findJob(job))
+      {
+        execute(job);
+        continue;
+      }
+
+      std::unique_lock<std::mutex> lock(_sleepMutex);
+      _wakeUp.wait(lock, [] { return _queued.load() > 0 || !_running.load(); });
+    }
+  }
+
+  void init(uint32_t workers)
+  {
+    if (!_queues.empty())
+      return;
+
+    if (workers == 0)
+    {
+      const uint32_t hardware = std::thread::hardware_concurrency();
+      workers = hardware > 1 ? hardware - 1 : 0;
+    }
+
+    _queueIndex = 0;
+    for (uint32_t i = 0; i <= workers; ++i)
+      _queues.push_back(new Queue());
+
+    _running = true;
+    for (uint32_t i = 1; i <= workers; ++i)
+      _threads.push_back(std::thread(workerMain, i));
+  }
+
+  void shutdown()
+  {
+    {
+      std::lock_guard<std::mutex> lock(_sleepMutex);
+      _running = false;
+    }
+    _wakeUp.notify_all();
+
+    for (size_t i = 0; i < _threads.size(); ++i)
+      _threads[i].join();
+    _threads.clear();
+
+    for (size_t i = 0; i < _queues.size(); ++i)
+      delete _queues[i];
+    _queues.clear();
+  }
+
+  uint32_t threadCount()
+  {
+    return _queues.size();
+  }
+
+  void run(JobFunc func, void * data, Counter * counter)
+  {
+    Job job = { func, data, counter };
+
+    if (counter)
+      counter->value.fetch_add(1, std::memory_order_relaxed);
+
+    // Without workers, or with a full queue, just run it right away
+    if (_threads.empty() || !_queues[_queueIndex]->push(job))
+    {
+      execute(job);
+      return;
+    }
+
+    {
+      // Taking the lock orders the increment against a worker that is about
+      // to go to sleep, so the wake up can not be lost.
+      std::lock_guard<std::mutex> lock(_sleepMutex);
+      _queued.fetch_add(1, std::memory_order_relaxed);
+    }
+    _wakeUp.notify_one();
+  }
+
+  void wait(Counter & counter)
+  {
+    Job job;
+    while (counter.value.load(std::memory_order_acquire) > 0)
+    {
+      if (!_queues.empty() && findJob(job))
+        execute(job);
+      else
+        std::this_thread::yield();
+    }
+  }
+
+  // -- Parallel for --
+
+  struct Range
+  {
+    RangeFunc func;
+    void * data;
+    uint32_t begin;
+    uint32_t end;
+  };
+
+  static void runRange(void * data)
+  {
+    Range * range = (Range *)data;
+    range->func(range->data, range->begin, range->end);
+  }
+
+  void parallelFor(uint32_t count, uint32_t grain, RangeFunc func, void * data)
+  {
+    if (count == 0)
+      return;
+
+    if (grain == 0)
+      grain = 1;
+
+    // Not worth splitting, or nobody to share with
+    if (count <= grain || threadCount() <= 1)
+    {
+      func(data, 0, count);
+      return;
+    }
+
+    // Ranges live on the stack, wait() keeps them alive until every job is done.
+    // Larger loops are run in several rounds so the stack use stays bounded.
+    enum { MAX_RANGES = 256 };
+    Range ranges[MAX_RANGES];
+    Counter counter;
+
+    uint32_t begin = 0;
+    while (begin < count)
+    {
+      uint32_t used = 0;
+      for (; used < MAX_RANGES && begin < count; ++used, begin += grain)
+      {
+        Range & range = ranges[used];
+        range.func = func;
+        range.data = data;
+        range.begin = begin;
+        range.end = begin + grain < count ? begin + grain : count;
+      }
+
+      // Keep the first range for ourselves
+      for (uint32_t i = 1; i < used; ++i)
+        run(runRange, &ranges[i], &counter);
+
+      runRange(&ranges[0]);
+      wait(counter);
+    }
+  }
+
+  // -- Tcl Bindings --
+
+  PROC("jobs:threadCount", threadCount);
+
+}
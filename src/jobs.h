@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+/// Work-stealing job system. Every worker thread, and the thread calling
+/// init(), owns a job queue. Jobs are pushed to the queue of the thread that
+/// creates them and idle workers steal from the other end of other queues.
+namespace jobs
+{
+
+  typedef void (*JobFunc)(void * data);
+  typedef void (*RangeFunc)(void * data, uint32_t begin, uint32_t end);
+
+  /// Dependency counter, incremented for every job started with it and
+  /// decremented when the job finishes. Zero means all of them are done.
+  struct Counter
+  {
+    Counter() : value(0) { }
+
+    std::atomic<int32_t> value;
+
+  private:
+    Counter(Counter const&);
+    Counter & operator = (Counter const&);
+  };
+
+  /// Starts workers, zero means one per hardware thread besides the caller
+  void init(uint32_t workers = 0);
+  void shutdown();
+
+  /// Number of threads executing jobs, including the one that called init()
+  uint32_t threadCount();
+
+  /// Queues func(data), counter may be NULL
+  void run(JobFunc func, void * data, Counter * counter);
+
+  /// Runs other jobs until counter reaches zero
+  void wait(Counter & counter);
+
+  /// Calls func over [0, count) split in ranges of at most grain items,
+  /// spread over all threads, and returns when all of them are done.
+  void parallelFor(uint32_t count, uint32_t grain, RangeFunc func, void * data);
+
+}
@@ -0,0 +1,390 @@
+#include "jps.h"
+#include "collide.h"
+#include "grid.h"
+#include "util.h"
+
+#include <algorithm>
+
+namespace jps
+{
+  namespace {
+    const int32_t NOT_FOUND = -0x7fffffff;
+    const uint32_t NO_PARENT = 0xffffffff;
+    const uint32_t CLOSED = 0xffffffff;
+
+    // Node pool, sized for the whole bitmap and reused between searches.
+    // A node only counts as initialized when its stamp matches _search, so
+    // starting a new search never has to clear the pool.
+    uint32_t _poolWidth = 0;
+    uint32_t _poolHeight = 0;
+    uint32_t _search = 0;
+    std::vector<uint32_t> _stamp;
+    std::vector<uint32_t> _g;
+    std::vector<uint32_t> _f;
+    std::vector<uint32_t> _parent;
+    std::vector<uint32_t> _heapIndex;
+
+    // Binary min-heap of cell indices ordered by _f
+    std::vector<uint32_t> _heap;
+
+    int32_t _goalX;
+    int32_t _goalZ;
+  }
+
+  static inline bool blocked(int32_t x, int32_t z)
+  {
+    return x < 0 || z < 0 || collide::checkI(x, z);
+  }
+
+  // -- Straight jumps --
+
+  /// Reads 64 bits starting at pos along line, for rows line is z and pos is
+  /// x, for columns it is the other way around.
+  typedef uint64_t (*LineReader)(int32_t line, int32_t pos);
+
+  static uint64_t readRow(int32_t z, int32_t x)
+  {
+    return collide::row64(x, z);
+  }
+
+  static uint64_t readColumn(int32_t x, int32_t z)
+  {
+    return collide::column64(x, z);
+  }
+
+  static inline uint64_t cellAt(LineReader read, int32_t line, int32_t pos)
+  {
+    return read == readRow ? blocked(pos, line) : blocked(line, pos);
+  }
+
+  /// Scans along line from pos (exclusive) in direction dir and returns the
+  /// position of the first jump point, or NOT_FOUND when a wall comes first.
+  /// A cell is a jump point if it is the goal or has a forced neighbour,
+  /// which happens when the cell beside the previous one is blocked but the
+  /// cell beside this one is free.
+  static int32_t jumpLine(LineReader read, int32_t line, int32_t pos, int32_t dir, int32_t goalLine, int32_t goalPos)
+  {
+    if (dir > 0)
+    {
+      for (int32_t base = pos + 1; ; base += 64)
+      {
+        const uint64_t current = read(line, base);
+        const uint64_t before = read(line - 1, base);
+        const uint64_t after = read(line + 1, base);
+
+        // Shift in the cell preceding the window to get the previous cell of every bit
+        const uint64_t forced = (((before << 1) | cellAt(read, line - 1, base - 1)) & ~before) |
+                                (((after << 1) | cellAt(read, line + 1, base - 1)) & ~after);
+
+        uint64_t stop = current | forced;
+        if (goalLine == line && goalPos >= base && goalPos < base + 64)
+          stop |= 1ull << (goalPos - base);
+
+        if (stop)
+        {
+          const uint32_t bit = util::lowestBit(stop);
+          return (current >> bit) & 1 ? NOT_FOUND : base + (int32_t)bit;
+        }
+      }
+    }
+    else
+    {
+      for (int32_t base = pos - 64; ; base -= 64)
+      {
+        // Bit 63 is the cell next to pos, scan from the top down
+        const uint64_t current = read(line, base);
+        const uint64_t before = read(line - 1, base);
+        const uint64_t after = read(line + 1, base);
+
+        const uint64_t forced = (((before >> 1) | (cellAt(read, line - 1, base + 64) << 63)) & ~before) |
+                                (((after >> 1) | (cellAt(read, line + 1, base + 64) << 63)) & ~after);
+
+        uint64_t stop = current | forced;
+        if (goalLine == line && goalPos >= base && goalPos < base + 64)
+          stop |= 1ull << (goalPos - base);
+
+        if (stop)
+        {
+          const uint32_t bit = util::highestBit(stop);
+          return (current >> bit) & 1 ? NOT_FOUND : base + (int32_t)bit;
+        }
+      }
+    }
+  }
+
+  static bool jumpHorizontal(int32_t x, int32_t z, int32_t dx, int32_t & outX)
+  {
+    outX = jumpLine(readRow, z, x, dx, _goalZ, _goalX);
+    return outX != NOT_FOUND;
+  }
+
+  static bool jumpVertical(int32_t x, int32_t z, int32_t dz, int32_t & outZ)
+  {
+    outZ = jumpLine(readColumn, x, z, dz, _goalX, _goalZ);
+    return outZ != NOT_FOUND;
+  }
+
+  // -- Diagonal jumps --
+
+  static bool jumpDiagonal(int32_t x, int32_t z, int32_t dx, int32_t dz, int32_t & outX, int32_t & outZ)
+  {
+    int32_t found;
+
+    while (true)
+    {
+      // No corner cutting, both orthogonal cells have to be free
+      if (blocked(x + dx, z) || blocked(x, z + dz) || blocked(x + dx, z + dz))
+        return false;
+
+      x += dx;
+      z += dz;
+
+      if ((x == _goalX && z == _goalZ) ||
+          jumpHorizontal(x, z, dx, found) ||
+          jumpVertical(x, z, dz, found))
+      {
+        outX = x;
+        outZ = z;
+        return true;
+      }
+    }
+  }
+
+  // -- Open list --
+
+  static void heapSwap(uint32_t a, uint32_t b)
+  {
+    const uint32_t cellA = _heap[a];
+    _heap[a] = _heap[b];
+    _heap[b] = cellA;
+    _heapIndex[_heap[a]] = a;
+    _heapIndex[_heap[b]] = b;
+  }
+
+  static void heapUp(uint32_t index)
+  {
+    while (index > 0)
+    {
+      const uint32_t parent = (index - 1) / 2;
+      if (_f[_heap[parent]] <= _f[_heap[index]])
+        break;
+
+      heapSwap(parent, index);
+      index = parent;
+    }
+  }
+
+  static void heapDown(uint32_t index)
+  {
+    const uint32_t size = _heap.size();
+    while (true)
+    {
+      const uint32_t left = index * 2 + 1;
+      const uint32_t right = left + 1;
+      uint32_t smallest = index;
+
+      if (left < size && _f[_heap[left]] < _f[_heap[smallest]])
+        smallest = left;
+      if (right < size && _f[_heap[right]] < _f[_heap[smallest]])
+        smallest = right;
+
+      if (smallest == index)
+        break;
+
+      heapSwap(index, smallest);
+      index = smallest;
+    }
+  }
+
+  static uint32_t heapPop()
+  {
+    const uint32_t top = _heap[0];
+    heapSwap(0, _heap.size() - 1);
+    _heap.pop_back();
+    if (!_heap.empty())
+      heapDown(0);
+
+    _heapIndex[top] = CLOSED;
+    return top;
+  }
+
+  // -- Search --
+
+  static void preparePool()
+  {
+    const uint32_t width = collide::width();
+    const uint32_t height = collide::height();
+
+    if (width != _poolWidth || height != _poolHeight)
+    {
+      const uint32_t size = width * height;
+      _stamp.assign(size, 0);
+      _g.resize(size);
+      _f.resize(size);
+      _parent.resize(size);
+      _heapIndex.resize(size);
+      _poolWidth = width;
+      _poolHeight = height;
+      _search = 0;
+    }
+
+    // Restart the stamps when they wrap so stale nodes can never match
+    if (++_search == 0)
+    {
+      _stamp.assign(_stamp.size(), 0);
+      _search = 1;
+    }
+
+    _heap.clear();
+  }
+
+  static void visit(uint32_t from, int32_t x, int32_t z)
+  {
+    const uint32_t cell = z * _poolWidth + x;
+    const uint32_t g = _g[from] + grid::octile(from % _poolWidth, from / _poolWidth, x, z);
+
+    if (_stamp[cell] != _search)
+    {
+      _stamp[cell] = _search;
+      _g[cell] = g;
+      _f[cell] = g + grid::octile(x, z, _goalX, _goalZ);
+      _parent[cell] = from;
+      _heapIndex[cell] = _heap.size();
+      _heap.push_back(cell);
+      heapUp(_heap.size() - 1);
+    }
+    else if (_heapIndex[cell] != CLOSED && g < _g[cell])
+    {
+      _f[cell] -= _g[cell] - g;
+      _g[cell] = g;
+      _parent[cell] = from;
+      heapUp(_heapIndex[cell]);
+    }
+  }
+
+  static void expand(uint32_t cell, int32_t dx, int32_t dz)
+  {
+    const int32_t x = cell % _poolWidth;
+    const int32_t z = cell / _poolWidth;
+    int32_t foundX, foundZ;
+
+    if (dx != 0 && dz != 0)
+    {
+      if (jumpHorizontal(x, z, dx, foundX))
+        visit(cell, foundX, z);
+      if (jumpVertical(x, z, dz, foundZ))
+        visit(cell, x, foundZ);
+      if (jumpDiagonal(x, z, dx, dz, foundX, foundZ))
+        visit(cell, foundX, foundZ);
+    }
+    else if (dx != 0)
+    {
+      if (jumpHorizontal(x, z, dx, foundX))
+        visit(cell, foundX, z);
+
+      for (int32_t side = -1; side <= 1; side += 2)
+      {
+        if (blocked(x - dx, z + side) && !blocked(x, z + side))
+        {
+          if (jumpVertical(x, z, side, foundZ))
+            visit(cell, x, foundZ);
+          if (jumpDiagonal(x, z, dx, side, foundX, foundZ))
+            visit(cell, foundX, foundZ);
+        }
+      }
+    }
+    else
+    {
+      if (jumpVertical(x, z, dz, foundZ))
+        visit(cell, x, foundZ);
+
+      for (int32_t side = -1; side <= 1; side += 2)
+      {
+        if (blocked(x + side, z - dz) && !blocked(x + side, z))
+        {
+          if (jumpHorizontal(x, z, side, foundX))
+            visit(cell, foundX, z);
+          if (jumpDiagonal(x, z, side, dz, foundX, foundZ))
+            visit(cell, foundX, foundZ);
+        }
+      }
+    }
+  }
+
+  static inline int32_t sign(int32_t value)
+  {
+    return (value > 0) - (value < 0);
+  }
+
+  bool findPath(uint32_t startX, uint32_t startZ, uint32_t goalX, uint32_t goalZ, Path & path)
+  {
+    path.clear();
+
+    if (blocked(startX, startZ) || blocked(goalX, goalZ))
+      return false;
+
+    preparePool();
+
+    _goalX = goalX;
+    _goalZ = goalZ;
+
+    const uint32_t start = startZ * _poolWidth + startX;
+    const uint32_t goal = goalZ * _poolWidth + goalX;
+
+    _stamp[start] = _search;
+    _g[start] = 0;
+    _parent[start] = NO_PARENT;
+    _heapIndex[start] = CLOSED;
+
+    if (start != goal)
+    {
+      // The start node has no parent, so every direction is open
+      for (int32_t dz = -1; dz <= 1; ++dz)
+        for (int32_t dx = -1; dx <= 1; ++dx)
+          if (dx != 0 || dz != 0)
+            expand(start, dx, dz);
+    }
+
+    bool found = start == goal;
+    while (!found && !_heap.empty())
+    {
+      const uint32_t cell = heapPop();
+      if (cell == goal)
+      {
+        found = true;
+        break;
+      }
+
+      const uint32_t parent = _parent[cell];
+      expand(cell,
+             sign((int32_t)(cell % _poolWidth) - (int32_t)(parent % _poolWidth)),
+             sign((int32_t)(cell / _poolWidth) - (int32_t)(parent / _poolWidth)));
+    }
+
+    if (!found)
+      return false;
+
+    for (uint32_t cell = goal; cell != NO_PARENT; cell = _parent[cell])
+    {
+      Point point = { cell % _poolWidth, cell / _poolWidth };
+      path.push_back(point);
+    }
+
+    std::reverse(path.begin(), path.end());
+
+    return true;
+  }
+
+  void shutdown()
+  {
+    _stamp.clear();
+    _g.clear();
+    _f.clear();
+    _parent.clear();
+    _heapIndex.clear();
+    _heap.clear();
+    _poolWidth = 0;
+    _poolHeight = 0;
+  }
+
+}
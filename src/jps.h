@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+/// Jump point search directly on the collide bitmap. Straight jumps scan 64
+/// cells at a time using collide::row64() and collide::column64(). Moves are
+/// 8-connected without corner cutting, the same rules as the flow fields.
+namespace jps
+{
+
+  struct Point
+  {
+    uint32_t x, z;
+  };
+
+  typedef std::vector<Point> Path;
+
+  /// Finds a shortest path between two collide cells. On success path holds
+  /// the jump points from start to goal, both included, consecutive points
+  /// are connected by a straight or diagonal line.
+  bool findPath(uint32_t startX, uint32_t startZ, uint32_t goalX, uint32_t goalZ, Path & path);
+
+  /// Releases the search pools
+  void shutdown();
+
+}
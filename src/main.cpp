@@ -5,6 +5,7 @@
 #include "gfx.h"
 #include "gfxe.h"
 #include "tcl.h"
+#include "sim.h"
 #include "world.h"
 #include "player.h"
 #include "input.h"
@@ -43,8 +44,7 @@ void mainLoop();
   SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_COMPATIBILITY);
   //SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
 
-  tcl::init();
-  player::init();
+  sim::init();
   input::init();
 
   if (SDL_Init(SDL_INIT_VIDEO) < 0)
@@ -76,21 +76,6 @@ void mainLoop();
 
   tcl::exec("data/default.tcl");
 
-  // Make sure we are always running on the same core, otherwise we can get timing issues
-  #if defined(WIN32) || defined(_WINDOWS)
-    ULONG_PTR affinity_mask;
-    ULONG_PTR process_affinity_mask;
-    ULONG_PTR system_affinity_mask;
-
-    if (!GetProcessAffinityMask(GetCurrentProcess(), &process_affinity_mask, &system_affinity_mask))
-      return 0;
-
-    // run on the first core
-    affinity_mask = (ULONG_PTR)1 << 0;
-    if (affinity_mask & process_affinity_mask)
-      SetThreadAffinityMask(GetCurrentThread(), affinity_mask);
-  #endif
-
   gfx::setProjection(50, 1.0, 1000.0);
 
   // Create an empty default world
@@ -98,12 +83,11 @@ void mainLoop();
 
   mainLoop();
 
-  world::clear();
-
-  player::shutdown();
+  world::shutdownGfx();
   gfxe::shutdown();
   gfx::shutdown();
-  tcl::shutdown();
+
+  sim::shutdown();
   input::shutdown();
 
   SDL_GL_DeleteContext(_context);
@@ -152,15 +136,14 @@ void mainLoop()
   while (_running)
   {
     uint64_t now = SDL_GetPerformanceCounter();
-    double dt = (now - oldTimeStamp) / (double)SDL_GetPerformanceFrequency();
+    double frameTime = (now - oldTimeStamp) / (double)SDL_GetPerformanceFrequency();
     oldTimeStamp = now;
 
-    if (dt > 0.1f)
-      dt = 1.0f / 60.0f;
-
     SDL_GL_SwapWindow(_window);
 
-    player::tick(dt);
+    // The simulation always runs at a fixed rate, slow frames only change how
+    // many ticks we run (up to the catch-up limit) and never the tick length.
+    sim::advance(frameTime);
 
     while (SDL_PollEvent(&event))
     {
@@ -229,8 +212,10 @@ void mainLoop()
 
     gfx::clear(0.1, 0.3, 0.4);
 
-    player::setCamera();
+    const float alpha = sim::alpha();
+
+    player::setCamera(alpha);
     world::render();
-    player::render();
+    player::render(alpha);
   }
 }
@@ -0,0 +1,69 @@
+#include "sim.h"
+#include "tcl.h"
+#include "world.h"
+#include "platform.h"
+#include "ai.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static void usage(const char * name)
+{
+  printf("Usage: %s [ticks] [script.tcl]\n", name);
+  printf("  Runs the simulation without a window for the given number of ticks\n");
+  printf("  (default 10000) as fast as possible and reports ticks per second.\n");
+}
+
+int main(int argc, char * argv[])
+{
+  uint64_t ticks = 10000;
+  const char * script = NULL;
+
+  if (argc > 1)
+  {
+    ticks = strtoull(argv[1], NULL, 10);
+    if (ticks == 0)
+    {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (argc > 2)
+    script = argv[2];
+
+  sim::init();
+
+  // Create an empty default world, the script is free to replace it
+  world::createEmpty(100, 100);
+
+  if (script && tcl::exec(script) == tcl::RET_ERROR)
+  {
+    sim::shutdown();
+    return 1;
+  }
+
+  const double dt = sim::tickDuration();
+  const double start = platform::time();
+
+  for (uint64_t i = 0; i < ticks; ++i)
+    sim::tick(dt);
+
+  const double elapsed = platform::time() - start;
+
+  printf("Simulated %llu ticks at %u Hz in %.3f s (%.1f ticks/s, %.3f us/tick)\n",
+         (unsigned long long)ticks,
+         sim::tickRate(),
+         elapsed,
+         elapsed > 0.0 ? ticks / elapsed : 0.0,
+         elapsed * 1e6 / ticks);
+
+  printf("AI made %u decisions in %.3f us on the last tick, %u units engaged\n",
+         ai::stats().decisions,
+         ai::stats().seconds * 1e6,
+         ai::stats().engaged);
+
+  sim::shutdown();
+
+  return 0;
+}
@@ -0,0 +1,997 @@
+#include "net.h"
+#include "sim.h"
+#include "player.h"
+#include "unit.h"
+#include "snapshot.h"
+#include "interest.h"
+#include "replay.h"
+#include "tcl.h"
+
+#include <enet/enet.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+namespace net
+{
+  namespace {
+    enum MessageType
+    {
+      MSG_START = 1,
+      MSG_TURN = 2,
+      MSG_JOIN = 3,
+      MSG_SNAPSHOT = 4,
+      MSG_ACK = 5,
+      MSG_HASH = 6,
+      MSG_DESYNC = 7
+    };
+
+    // Lockstep traffic must arrive, snapshots are only useful while fresh
+    enum Channel
+    {
+      CHANNEL_LOCKSTEP,
+      CHANNEL_SNAPSHOT,
+      CHANNEL_COUNT
+    };
+
+    enum Role
+    {
+      ROLE_NONE,
+      ROLE_PLAYER,
+      ROLE_SPECTATOR
+    };
+
+    /// What the host knows about each connection, indexed like _host->peers
+    struct Client
+    {
+      Client()
+        : role(ROLE_NONE),
+          player(0),
+          acked(snapshot::NO_BASELINE),
+          viewer(interest::INVALID_VIEWER)
+      { }
+
+      uint32_t role;
+      uint32_t player;
+      uint32_t acked;
+
+      // Spectators only see their area of interest, so every one of them
+      // has its own snapshot history to delta against
+      uint32_t viewer;
+      std::vector<snapshot::Snapshot> history;
+    };
+
+    // Peers run at most inputDelay ticks ahead of us and send batches for up
+    // to inputDelay ticks ahead of that, the ring must hold both.
+    const uint32_t MAX_INPUT_DELAY = 30;
+    const uint32_t TURN_BUFFER = 64;
+    const uint32_t NO_TURN = 0xffffffff;
+
+    // Header is type, player, command count and turn, then 13 bytes per command
+    const uint32_t TURN_HEADER_SIZE = 8;
+    const uint32_t COMMAND_SIZE = 13;
+
+    // Type, player count, local player, input delay and hash interval, then
+    // the sim::save() state of the host
+    const uint32_t START_HEADER_SIZE = 6;
+
+    const uint32_t MAX_SPECTATORS = 8;
+
+    // Snapshots kept on both ends to delta against, a client that has not
+    // acknowledged any of them gets a full snapshot
+    const uint32_t SNAPSHOT_HISTORY = 32;
+
+    struct Turn
+    {
+      uint32_t turn;
+      uint32_t received;
+      std::vector<Command> commands[MAX_PLAYERS];
+    };
+
+    // Clients send their state hash to the host every hash interval ticks.
+    // They may be ahead of the host, so the host keeps the hashes of several
+    // checkpoints around until it gets there itself.
+    const uint32_t HASH_HISTORY = 64;
+    const uint32_t HASH_MESSAGE_SIZE = 5 + 8 * sim::HASH_PART_COUNT;
+
+    struct Checkpoint
+    {
+      uint32_t turn;
+      bool local;
+      uint32_t received;
+      sim::Hash hash;
+      sim::Hash remote[MAX_PLAYERS];
+    };
+
+    ENetHost * _host = NULL;
+    ENetPeer * _server = NULL;
+    bool _hosting = false;
+    bool _spectating = false;
+    bool _started = false;
+
+    uint32_t _playerCount = 1;
+    uint32_t _expectedPlayers = 1;
+    uint32_t _localPlayer = 0;
+    uint32_t _inputDelay = 4;
+    uint64_t _startTick = 0;
+
+    Turn _turns[TURN_BUFFER];
+
+    Checkpoint _checkpoints[HASH_HISTORY];
+    uint32_t _hashInterval = 30;
+    bool _desynced = false;
+
+    // Local commands waiting for the next endTurn()
+    std::vector<Command> _pending;
+
+    std::vector<Client> _clients;
+
+    // Received snapshots on spectators
+    snapshot::Snapshot _snapshots[SNAPSHOT_HISTORY];
+    uint32_t _snapshotSequence = 0;
+    uint32_t _snapshotInterval = 2;
+    uint32_t _spectatePlayer = interest::ALL_PLAYERS;
+    std::vector<uint8_t> _snapshotBuffer;
+  }
+
+  // -- Serialization --
+
+  static void put8(std::vector<uint8_t> & buffer, uint8_t value)
+  {
+    buffer.push_back(value);
+  }
+
+  static void put16(std::vector<uint8_t> & buffer, uint16_t value)
+  {
+    buffer.push_back(value & 0xff);
+    buffer.push_back(value >> 8);
+  }
+
+  static void put32(std::vector<uint8_t> & buffer, uint32_t value)
+  {
+    for (uint32_t i = 0; i < 4; ++i)
+      buffer.push_back((value >> (i * 8)) & 0xff);
+  }
+
+  static void put64(std::vector<uint8_t> & buffer, uint64_t value)
+  {
+    for (uint32_t i = 0; i < 8; ++i)
+      buffer.push_back((value >> (i * 8)) & 0xff);
+  }
+
+  static uint32_t get32(const uint8_t * data)
+  {
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+  }
+
+  static uint64_t get64(const uint8_t * data)
+  {
+    return get32(data) | ((uint64_t)get32(data + 4) << 32);
+  }
+
+  static uint32_t floatBits(float value)
+  {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+  }
+
+  static float bitsFloat(uint32_t bits)
+  {
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+
+  static void send(ENetPeer * peer, std::vector<uint8_t> const& buffer)
+  {
+    ENetPacket * packet = enet_packet_create(&buffer[0], buffer.size(), ENET_PACKET_FLAG_RELIABLE);
+    enet_peer_send(peer, CHANNEL_LOCKSTEP, packet);
+  }
+
+  /// Unreliable packets on a channel are sequenced, stale ones are dropped
+  static void sendUnreliable(ENetPeer * peer, std::vector<uint8_t> const& buffer)
+  {
+    ENetPacket * packet = enet_packet_create(&buffer[0], buffer.size(), 0);
+    enet_peer_send(peer, CHANNEL_SNAPSHOT, packet);
+  }
+
+  static Client & clientOf(ENetPeer * peer)
+  {
+    return _clients[peer - _host->peers];
+  }
+
+  /// Sends to every player except one, only used by the host
+  static void broadcast(std::vector<uint8_t> const& buffer, ENetPeer * except)
+  {
+    for (size_t i = 0; i < _host->peerCount; ++i)
+    {
+      ENetPeer * peer = &_host->peers[i];
+      if (peer->state == ENET_PEER_STATE_CONNECTED && peer != except && _clients[i].role == ROLE_PLAYER)
+        send(peer, buffer);
+    }
+  }
+
+  // -- Turns --
+
+  static Turn & turnSlot(uint32_t turn)
+  {
+    Turn & slot = _turns[turn % TURN_BUFFER];
+    if (slot.turn != turn)
+    {
+      slot.turn = turn;
+      slot.received = 0;
+      for (uint32_t i = 0; i < MAX_PLAYERS; ++i)
+        slot.commands[i].clear();
+    }
+
+    return slot;
+  }
+
+  void apply(Command const& command)
+  {
+    replay::command(sim::tickCount(), command);
+
+    if (command.player >= player::players().size())
+      return;
+
+    player::Player * player = &player::player(command.player);
+
+    switch (command.type)
+    {
+      case CMD_RALLY:
+        player->hasRally = true;
+        player->rallyX = command.x;
+        player->rallyZ = command.z;
+        break;
+
+      case CMD_KILL:
+        unit::kill(command.unit);
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  static void startSession(uint32_t players, uint32_t local, uint32_t delay, uint32_t hashInterval)
+  {
+    _playerCount = players;
+    _localPlayer = local;
+    _inputDelay = delay;
+    _hashInterval = hashInterval;
+    _startTick = sim::tickCount();
+    _started = true;
+    _desynced = false;
+
+    for (uint32_t i = 0; i < TURN_BUFFER; ++i)
+      _turns[i].turn = NO_TURN;
+
+    for (uint32_t i = 0; i < HASH_HISTORY; ++i)
+      _checkpoints[i].turn = NO_TURN;
+
+    player::setup(players, local);
+  }
+
+  static void endSession()
+  {
+    if (_host)
+    {
+      if (_server)
+        enet_peer_disconnect_now(_server);
+
+      enet_host_destroy(_host);
+    }
+
+    _host = NULL;
+    _server = NULL;
+    _hosting = false;
+    _spectating = false;
+    _started = false;
+    _clients.clear();
+    interest::clear();
+
+    for (uint32_t i = 0; i < SNAPSHOT_HISTORY; ++i)
+      _snapshots[i] = snapshot::Snapshot();
+  }
+
+  // -- Events --
+
+  static void onConnect(ENetPeer * peer)
+  {
+    if (_hosting)
+    {
+      clientOf(peer) = Client();
+      return;
+    }
+
+    std::vector<uint8_t> buffer;
+    put8(buffer, MSG_JOIN);
+    put8(buffer, _spectating ? ROLE_SPECTATOR : ROLE_PLAYER);
+    send(peer, buffer);
+  }
+
+  static void onJoin(ENetPeer * peer, uint32_t role)
+  {
+    Client & client = clientOf(peer);
+    if (client.role != ROLE_NONE)
+      return;
+
+    uint32_t players = 1;
+    uint32_t spectators = 0;
+    uint32_t used = 1;
+    for (size_t i = 0; i < _clients.size(); ++i)
+    {
+      if (_clients[i].role == ROLE_PLAYER)
+      {
+        ++players;
+        used |= 1 << _clients[i].player;
+      }
+      else if (_clients[i].role == ROLE_SPECTATOR)
+        ++spectators;
+    }
+
+    // Spectators may come and go at any time, they only get snapshots
+    if (role == ROLE_SPECTATOR)
+    {
+      if (spectators >= MAX_SPECTATORS)
+      {
+        enet_peer_disconnect(peer);
+      }
+      else
+      {
+        client.role = ROLE_SPECTATOR;
+        client.viewer = interest::addViewer();
+        client.history.resize(SNAPSHOT_HISTORY);
+      }
+
+      return;
+    }
+
+    if (_started || players >= _expectedPlayers)
+    {
+      enet_peer_disconnect(peer);
+      return;
+    }
+
+    // Player 0 is the host, clients take the lowest free index
+    uint32_t index = 1;
+    while (used & (1 << index))
+      ++index;
+
+    client.role = ROLE_PLAYER;
+    client.player = index;
+
+    if (players + 1 < _expectedPlayers)
+      return;
+
+    // Everyone is here. Until now every peer simulated on its own, so the
+    // host's state goes along as the keyframe all of them start from.
+    player::setup(_expectedPlayers, 0);
+
+    std::vector<uint8_t> keyframe;
+    sim::save(keyframe);
+
+    for (size_t i = 0; i < _host->peerCount; ++i)
+    {
+      if (_clients[i].role != ROLE_PLAYER)
+        continue;
+
+      std::vector<uint8_t> buffer;
+      put8(buffer, MSG_START);
+      put8(buffer, _expectedPlayers);
+      put8(buffer, _clients[i].player);
+      put8(buffer, _inputDelay);
+      put16(buffer, _hashInterval);
+      buffer.insert(buffer.end(), keyframe.begin(), keyframe.end());
+      send(&_host->peers[i], buffer);
+    }
+
+    startSession(_expectedPlayers, 0, _inputDelay, _hashInterval);
+  }
+
+  static void onStart(const uint8_t * data, size_t size)
+  {
+    // Turn 0 has to be the same everywhere, the host's state is taken over
+    // before the first turn runs
+    if (!sim::load(data + START_HEADER_SIZE, size - START_HEADER_SIZE))
+    {
+      fprintf(stderr, "Could not load the state from the host, leaving the session\n");
+      endSession();
+      return;
+    }
+
+    startSession(data[1], data[2], data[3], data[4] | (data[5] << 8));
+  }
+
+  static void onDisconnect(ENetPeer * peer)
+  {
+    if (_hosting)
+    {
+      Client & client = clientOf(peer);
+      const bool player = client.role == ROLE_PLAYER;
+      interest::removeViewer(client.viewer);
+      client = Client();
+
+      // Spectators and players that left before the start are not missed
+      if (!player || !_started)
+        return;
+    }
+    else if (peer != _server)
+      return;
+
+    // A missing player can never complete a turn again
+    fprintf(stderr, "Peer disconnected, leaving the session\n");
+    endSession();
+  }
+
+  static void onTurn(ENetPeer * peer, const uint8_t * data, size_t size)
+  {
+    if (!_started || size < TURN_HEADER_SIZE)
+      return;
+
+    // The host knows who sent the batch, clients trust the host
+    if (_hosting && clientOf(peer).role != ROLE_PLAYER)
+      return;
+
+    const uint32_t player = _hosting ? clientOf(peer).player : data[1];
+    const uint32_t count = data[2] | (data[3] << 8);
+    const uint32_t turn = get32(data + 4);
+
+    if (player >= _playerCount || size < TURN_HEADER_SIZE + count * COMMAND_SIZE)
+      return;
+
+    Turn & slot = turnSlot(turn);
+    std::vector<Command> & commands = slot.commands[player];
+    commands.clear();
+
+    const uint8_t * cursor = data + TURN_HEADER_SIZE;
+    for (uint32_t i = 0; i < count; ++i, cursor += COMMAND_SIZE)
+    {
+      Command command;
+      command.type = cursor[0];
+      command.player = player;
+      command.x = bitsFloat(get32(cursor + 1));
+      command.z = bitsFloat(get32(cursor + 5));
+      command.unit = get32(cursor + 9);
+      commands.push_back(command);
+    }
+
+    slot.received |= 1 << player;
+
+    if (_hosting)
+    {
+      std::vector<uint8_t> buffer(data, data + size);
+      buffer[1] = player;
+      broadcast(buffer, peer);
+    }
+  }
+
+  // -- Desync detection --
+
+  static Checkpoint & checkpointSlot(uint32_t turn)
+  {
+    Checkpoint & slot = _checkpoints[(turn / _hashInterval) % HASH_HISTORY];
+    if (slot.turn != turn)
+    {
+      slot.turn = turn;
+      slot.local = false;
+      slot.received = 0;
+    }
+
+    return slot;
+  }
+
+  static void putHash(std::vector<uint8_t> & buffer, uint8_t type, uint32_t turn, sim::Hash const& hash)
+  {
+    put8(buffer, type);
+    put32(buffer, turn);
+    for (uint32_t i = 0; i < sim::HASH_PART_COUNT; ++i)
+      put64(buffer, hash.parts[i]);
+  }
+
+  static void getHash(const uint8_t * data, sim::Hash & hash)
+  {
+    for (uint32_t i = 0; i < sim::HASH_PART_COUNT; ++i)
+      hash.parts[i] = get64(data + 5 + i * 8);
+  }
+
+  /// Prints both hashes and names the first subsystem that differs. Returns
+  /// false when they match.
+  static bool report(uint32_t turn, uint32_t player, sim::Hash const& local, sim::Hash const& remote)
+  {
+    uint32_t first = 0;
+    while (first < sim::HASH_PART_COUNT && local.parts[first] == remote.parts[first])
+      ++first;
+
+    if (first == sim::HASH_PART_COUNT)
+      return false;
+
+    fprintf(stderr, "Desync with player %u after tick %llu, first divergent subsystem: %s\n",
+            player, (unsigned long long)(_startTick + turn), sim::hashPartName(first));
+
+    for (uint32_t i = 0; i < sim::HASH_PART_COUNT; ++i)
+      fprintf(stderr, "  %-8s local %016llx remote %016llx%s\n", sim::hashPartName(i),
+              (unsigned long long)local.parts[i], (unsigned long long)remote.parts[i],
+              local.parts[i] != remote.parts[i] ? " <-" : "");
+
+    // Once out of sync every later checkpoint differs too
+    _desynced = true;
+    return true;
+  }
+
+  /// Host only, compares what player sent for a checkpoint with our own
+  static void compare(Checkpoint const& slot, uint32_t player)
+  {
+    if (_desynced || !slot.local || !(slot.received & (1 << player)))
+      return;
+
+    if (!report(slot.turn, player, slot.hash, slot.remote[player]))
+      return;
+
+    // Let the client print its side too
+    std::vector<uint8_t> buffer;
+    putHash(buffer, MSG_DESYNC, slot.turn, slot.hash);
+
+    for (size_t i = 0; i < _host->peerCount; ++i)
+      if (_clients[i].role == ROLE_PLAYER && _clients[i].player == player)
+        send(&_host->peers[i], buffer);
+  }
+
+  static void onHash(ENetPeer * peer, const uint8_t * data, size_t size)
+  {
+    if (!_started || _hashInterval == 0 || size < HASH_MESSAGE_SIZE || clientOf(peer).role != ROLE_PLAYER)
+      return;
+
+    const uint32_t player = clientOf(peer).player;
+    const uint32_t turn = get32(data + 1);
+    if (turn % _hashInterval != 0)
+      return;
+
+    Checkpoint & slot = checkpointSlot(turn);
+    getHash(data, slot.remote[player]);
+    slot.received |= 1 << player;
+    compare(slot, player);
+  }
+
+  static void onDesync(const uint8_t * data, size_t size)
+  {
+    if (!_started || _desynced || _hashInterval == 0 || size < HASH_MESSAGE_SIZE)
+      return;
+
+    const uint32_t turn = get32(data + 1);
+    Checkpoint const& slot = _checkpoints[(turn / _hashInterval) % HASH_HISTORY];
+    if (slot.turn != turn || !slot.local)
+      return;
+
+    sim::Hash host;
+    getHash(data, host);
+    report(turn, 0, slot.hash, host);
+  }
+
+  /// Called once tick turn has run
+  static void checkpoint(uint32_t turn)
+  {
+    if (_hashInterval == 0 || turn % _hashInterval != 0 || _desynced)
+      return;
+
+    Checkpoint & slot = checkpointSlot(turn);
+    sim::hash(slot.hash);
+    slot.local = true;
+
+    if (_hosting)
+    {
+      for (uint32_t player = 1; player < _playerCount; ++player)
+        compare(slot, player);
+    }
+    else if (_server)
+    {
+      std::vector<uint8_t> buffer;
+      putHash(buffer, MSG_HASH, turn, slot.hash);
+      send(_server, buffer);
+    }
+  }
+
+  // -- Snapshots --
+
+  static void onSnapshot(ENetPeer * peer, const uint8_t * data, size_t size)
+  {
+    const uint32_t baselineSequence = snapshot::baselineOf(data, size);
+    snapshot::Snapshot const* baseline = NULL;
+    if (baselineSequence != snapshot::NO_BASELINE)
+    {
+      baseline = &_snapshots[baselineSequence % SNAPSHOT_HISTORY];
+      if (baseline->sequence != baselineSequence)
+        return;
+    }
+
+    snapshot::Snapshot received;
+    if (!snapshot::decode(data, size, baseline, received))
+      return;
+
+    // The host never deltas against anything this old, so the slot is free
+    snapshot::Snapshot & slot = _snapshots[received.sequence % SNAPSHOT_HISTORY];
+    std::swap(slot, received);
+    snapshot::apply(slot);
+
+    // The camera rides along, the host uses it to pick what we get to see
+    std::vector<uint8_t> buffer;
+    put8(buffer, MSG_ACK);
+    put32(buffer, slot.sequence);
+    put32(buffer, floatBits(player::camera().x));
+    put32(buffer, floatBits(player::camera().z));
+    put8(buffer, _spectatePlayer < MAX_PLAYERS ? _spectatePlayer : 0xff);
+    sendUnreliable(peer, buffer);
+  }
+
+  static void publishSnapshot(uint32_t turn)
+  {
+    if (_snapshotInterval == 0 || turn % _snapshotInterval != 0)
+      return;
+
+    bool spectators = false;
+    for (size_t i = 0; i < _clients.size(); ++i)
+      spectators |= _clients[i].role == ROLE_SPECTATOR;
+
+    if (!spectators)
+      return;
+
+    // Sequence 0 is never sent, it is what empty history slots hold
+    const uint32_t sequence = ++_snapshotSequence;
+    interest::update();
+
+    for (size_t i = 0; i < _clients.size(); ++i)
+    {
+      Client & client = _clients[i];
+      if (client.role != ROLE_SPECTATOR)
+        continue;
+
+
+      snapshot::Snapshot & current = client.history[sequence % SNAPSHOT_HISTORY];
+      snapshot::capture(current, sequence, interest::collect(client.viewer));
+
+      snapshot::Snapshot const* baseline = NULL;
+      if (client.acked != snapshot::NO_BASELINE && sequence - client.acked < SNAPSHOT_HISTORY)
+      {
+        baseline = &client.history[client.acked % SNAPSHOT_HISTORY];
+        if (baseline->sequence != client.acked)
+          baseline = NULL;
+      }
+
+      _snapshotBuffer.clear();
+      put8(_snapshotBuffer, MSG_SNAPSHOT);
+      snapshot::encode(current, baseline, _snapshotBuffer);
+      sendUnreliable(&_host->peers[i], _snapshotBuffer);
+    }
+  }
+
+  static void onReceive(ENetPeer * peer, ENetPacket * packet)
+  {
+    const uint8_t * data = packet->data;
+    const size_t size = packet->dataLength;
+
+    if (size == 0)
+      return;
+
+    switch (data[0])
+    {
+      case MSG_START:
+        if (!_hosting && !_spectating && !_started && size >= START_HEADER_SIZE && data[1] <= MAX_PLAYERS && data[2] < data[1])
+          onStart(data, size);
+        break;
+
+      case MSG_TURN:
+        onTurn(peer, data, size);
+        break;
+
+      case MSG_JOIN:
+        if (_hosting && size >= 2)
+          onJoin(peer, data[1]);
+        break;
+
+      case MSG_SNAPSHOT:
+        if (_spectating)
+          onSnapshot(peer, data + 1, size - 1);
+        break;
+
+      case MSG_HASH:
+        if (_hosting)
+          onHash(peer, data, size);
+        break;
+
+      case MSG_DESYNC:
+        if (!_hosting && !_spectating)
+          onDesync(data, size);
+        break;
+
+      case MSG_ACK:
+        if (_hosting && size >= 13 && clientOf(peer).role == ROLE_SPECTATOR)
+        {
+          // Acks may arrive out of order, only ever move forwards
+          Client & client = clientOf(peer);
+          const uint32_t sequence = get32(data + 1);
+          if (client.acked == snapshot::NO_BASELINE || (int32_t)(sequence - client.acked) > 0)
+          {
+            client.acked = sequence;
+            interest::setView(client.viewer, bitsFloat(get32(data + 5)), bitsFloat(get32(data + 9)));
+            if (size >= 14)
+              interest::setPlayer(client.viewer, data[13] < MAX_PLAYERS ? data[13] : interest::ALL_PLAYERS);
+          }
+        }
+        break;
+    }
+  }
+
+  // -- API --
+
+  void init()
+  {
+    if (enet_initialize() != 0)
+      fprintf(stderr, "Could not initialize enet\n");
+
+    _pending.clear();
+  }
+
+  void shutdown()
+  {
+    disconnect();
+    enet_deinitialize();
+  }
+
+  bool host(uint32_t port, uint32_t players)
+  {
+    disconnect();
+
+    if (players < 1 || players > MAX_PLAYERS)
+      return false;
+
+    ENetAddress address;
+    address.host = ENET_HOST_ANY;
+    address.port = port;
+
+    _host = enet_host_create(&address, MAX_PLAYERS - 1 + MAX_SPECTATORS, 0, 0);
+    if (!_host)
+    {
+      fprintf(stderr, "Could not host on port %u\n", port);
+      return false;
+    }
+
+    _hosting = true;
+    _clients.assign(_host->peerCount, Client());
+    _snapshotSequence = 0;
+    _expectedPlayers = players;
+
+    if (players == 1)
+      startSession(1, 0, _inputDelay, _hashInterval);
+
+    return true;
+  }
+
+  static bool connect(std::string const& address, uint32_t port, bool spectate)
+  {
+    disconnect();
+
+    ENetAddress serverAddress;
+    serverAddress.port = port;
+    if (enet_address_set_host(&serverAddress, address.c_str()) < 0)
+    {
+      fprintf(stderr, "Could not resolve '%s'\n", address.c_str());
+      return false;
+    }
+
+    _host = enet_host_create(NULL, 1, 0, 0);
+    if (!_host)
+      return false;
+
+    _server = enet_host_connect(_host, &serverAddress, CHANNEL_COUNT);
+    if (!_server)
+    {
+      endSession();
+      return false;
+    }
+
+    _spectating = spectate;
+    return true;
+  }
+
+  bool join(std::string const& address, uint32_t port)
+  {
+    return connect(address, port, false);
+  }
+
+  bool spectate(std::string const& address, uint32_t port)
+  {
+    return connect(address, port, true);
+  }
+
+  void disconnect()
+  {
+    if (_host)
+    {
+      if (_hosting)
+        for (size_t i = 0; i < _host->peerCount; ++i)
+          if (_host->peers[i].state == ENET_PEER_STATE_CONNECTED)
+            enet_peer_disconnect_now(&_host->peers[i]);
+
+      enet_host_flush(_host);
+    }
+
+    endSession();
+  }
+
+  bool active()
+  {
+    return _host != NULL;
+  }
+
+  bool started()
+  {
+    return _started;
+  }
+
+  uint32_t localPlayer()
+  {
+    return _localPlayer;
+  }
+
+  void setInputDelay(uint32_t ticks)
+  {
+    // Every peer must use the same delay, it is fixed once the game started
+    if (!_started)
+      _inputDelay = ticks < MAX_INPUT_DELAY ? ticks : MAX_INPUT_DELAY;
+  }
+
+  uint32_t inputDelay()
+  {
+    return _inputDelay;
+  }
+
+  void setSnapshotInterval(uint32_t ticks)
+  {
+    _snapshotInterval = ticks;
+  }
+
+  void setSpectatePlayer(uint32_t player)
+  {
+    _spectatePlayer = player;
+  }
+
+  void setHashInterval(uint32_t ticks)
+  {
+    // Like the input delay, the host decides for everyone at the start
+    if (!_started)
+      _hashInterval = ticks < 0xffff ? ticks : 0xffff;
+  }
+
+  bool desynced()
+  {
+    return _desynced;
+  }
+
+  bool spectating()
+  {
+    return _spectating;
+  }
+
+  void service()
+  {
+    ENetEvent event;
+    while (_host && enet_host_service(_host, &event, 0) > 0)
+    {
+      switch (event.type)
+      {
+        case ENET_EVENT_TYPE_CONNECT:
+          onConnect(event.peer);
+          break;
+
+        case ENET_EVENT_TYPE_RECEIVE:
+          onReceive(event.peer, event.packet);
+          if (event.packet->referenceCount == 0)
+            enet_packet_destroy(event.packet);
+          break;
+
+        case ENET_EVENT_TYPE_DISCONNECT:
+          onDisconnect(event.peer);
+          break;
+
+        default:
+          break;
+      }
+    }
+  }
+
+  void issue(Command const& command)
+  {
+    _pending.push_back(command);
+    _pending.back().player = _localPlayer;
+  }
+
+  bool turnReady(uint64_t tick)
+  {
+    // Spectators run freely between snapshots. Until the start everyone runs
+    // on their own, the host's state replaces it then.
+    if (!_host || _spectating || !_started)
+      return true;
+
+    // The first inputDelay turns can not have any commands
+    const uint32_t turn = tick - _startTick;
+    if (turn < _inputDelay)
+      return true;
+
+    Turn const& slot = _turns[turn % TURN_BUFFER];
+    return slot.turn == turn && slot.received == (1u << _playerCount) - 1;
+  }
+
+  void execute(uint64_t tick)
+  {
+    if (!_started)
+    {
+      for (size_t i = 0; i < _pending.size(); ++i)
+        apply(_pending[i]);
+
+      _pending.clear();
+      return;
+    }
+
+    const uint32_t turn = tick - _startTick;
+    Turn const& slot = _turns[turn % TURN_BUFFER];
+    if (slot.turn != turn)
+      return;
+
+    for (uint32_t player = 0; player < _playerCount; ++player)
+      for (size_t i = 0; i < slot.commands[player].size(); ++i)
+        apply(slot.commands[player][i]);
+  }
+
+  void endTurn(uint64_t tick)
+  {
+    if (!_started)
+      return;
+
+    const uint32_t turn = tick - _startTick + _inputDelay;
+
+    Turn & slot = turnSlot(turn);
+    slot.commands[_localPlayer] = _pending;
+    slot.received |= 1 << _localPlayer;
+
+    std::vector<uint8_t> buffer;
+    buffer.reserve(TURN_HEADER_SIZE + _pending.size() * COMMAND_SIZE);
+    put8(buffer, MSG_TURN);
+    put8(buffer, _localPlayer);
+    put16(buffer, _pending.size());
+    put32(buffer, turn);
+
+    for (size_t i = 0; i < _pending.size(); ++i)
+    {
+      put8(buffer, _pending[i].type);
+      put32(buffer, floatBits(_pending[i].x));
+      put32(buffer, floatBits(_pending[i].z));
+      put32(buffer, _pending[i].unit);
+    }
+
+    _pending.clear();
+
+    if (_hosting)
+    {
+      broadcast(buffer, NULL);
+      publishSnapshot(turn - _inputDelay);
+    }
+    else if (_server)
+      send(_server, buffer);
+
+    checkpoint(turn - _inputDelay);
+  }
+
+  // -- Tcl Bindings --
+
+  PROC("net:host", host);
+  PROC("net:join", join);
+  PROC("net:disconnect", disconnect);
+  PROC("net:inputDelay", setInputDelay);
+  PROC("net:spectate", spectate);
+  PROC("net:snapshotInterval", setSnapshotInterval);
+  PROC("net:spectatePlayer", setSpectatePlayer);
+  PROC("net:hashInterval", setHashInterval);
+
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+/// Deterministic lockstep over enet. Once started only player commands go over
+/// the wire, never unit state, so bandwidth does not grow with the number of
+/// units.
+///
+/// A command issued during tick T is scheduled for tick T + inputDelay and
+/// every participant sends its batch for that tick, even when it is empty.
+/// A tick may only run once the batches of all players have arrived, which
+/// is the turn barrier sim::advance() waits on.
+///
+/// The host relays batches between clients, so clients only ever talk to the
+/// host. Without a session commands run on the next tick. Peers simulate on
+/// their own until everyone joined, then the host sends its sim::save() state
+/// along with the start and every client loads it, so the lockstep starts
+/// from the same tick and state everywhere.
+///
+/// Spectators do not take part in the lockstep. The host sends them delta
+/// compressed snapshots (see snapshot.h) on an unreliable channel, and they
+/// can join at any time, also after the game has started.
+namespace net
+{
+
+  enum { MAX_PLAYERS = 8 };
+
+  enum CommandType
+  {
+    CMD_NONE,
+    CMD_RALLY,  // Rally point at (x, z)
+    CMD_KILL    // Kills unit
+  };
+
+  struct Command
+  {
+    uint8_t type;
+    uint8_t player;
+    float x, z;
+    uint32_t unit;
+  };
+
+  void init();
+  void shutdown();
+
+  /// Hosts a session on port, the game starts once players - 1 clients joined
+  bool host(uint32_t port, uint32_t players);
+  bool join(std::string const& address, uint32_t port);
+  bool spectate(std::string const& address, uint32_t port);
+  void disconnect();
+
+  /// True while hosting or joined, also before the game has started
+  bool active();
+
+  /// True once every player is connected and the lockstep has started
+  bool started();
+
+  bool spectating();
+
+  /// Index of the local player, 0 is the host
+  uint32_t localPlayer();
+
+  void setInputDelay(uint32_t ticks);
+  uint32_t inputDelay();
+
+  /// Ticks between snapshots sent to spectators, 0 turns them off
+  void setSnapshotInterval(uint32_t ticks);
+
+  /// On spectators, only receive what player sees through the fog of war.
+  /// interest::ALL_PLAYERS, the default, receives everything.
+  void setSpectatePlayer(uint32_t player);
+
+  /// Ticks between state hash comparisons, 0 turns them off. Clients send
+  /// sim::hash() to the host, which reports the first subsystem that differs
+  /// on both ends. Only takes effect on the host, before the game starts.
+  void setHashInterval(uint32_t ticks);
+
+  /// True once a state hash mismatch was found in this session
+  bool desynced();
+
+  /// Sends and receives pending packets, call once per frame
+  void service();
+
+  /// Queues a command from the local player
+  void issue(Command const& command);
+
+  /// True when the commands of all players for tick have arrived
+  bool turnReady(uint64_t tick);
+
+  /// Applies the commands for tick, in player order so every peer agrees
+  void execute(uint64_t tick);
+
+  /// Runs a single command on the simulation right away
+  void apply(Command const& command);
+
+  /// Sends the local batch once tick has run
+  void endTurn(uint64_t tick);
+
+}
@@ -1,4 +1,3 @@
-
 #pragma once
 
 #include <string>
@@ -7,4 +6,7 @@ namespace platform
 {
   void messageBox(const char * title, const char * message);
   std::string resourcePath(const char * file);
-}
\ No newline at end of file
+
+  /// High resolution monotonic time in seconds, does not depend on SDL
+  double time();
+}
@@ -2,6 +2,7 @@
 #import <Cocoa/Cocoa.h>
 #import <Foundation/Foundation.h>
 #import <string>
+#import <mach/mach_time.h>
 
 namespace platform
 {
@@ -44,4 +45,13 @@ namespace platform
     #endif
   }
 
-}
\ No newline at end of file
+  double time()
+  {
+    static mach_timebase_info_data_t timebase = { 0, 0 };
+    if (timebase.denom == 0)
+      mach_timebase_info(&timebase);
+
+    return mach_absolute_time() * (double)timebase.numer / timebase.denom * 1e-9;
+  }
+
+}
@@ -1,5 +1,5 @@
-
 #include <stdio.h>
+#include <time.h>
 #include <string>
 
 namespace platform
@@ -15,4 +15,11 @@ namespace platform
     return std::string(file);
   }
 
-}
\ No newline at end of file
+  double time()
+  {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+  }
+
+}
@@ -18,4 +18,13 @@ namespace platform
     return std::string(file);
   }
 
+  double time()
+  {
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER now;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&now);
+    return now.QuadPart / (double)frequency.QuadPart;
+  }
+
 }
@@ -2,20 +2,38 @@
 #include "player.h"
 #include "world.h"
 #include "tcl.h"
-#include "gfxe.h"
-#include "fpumath.h"
+#include "jobs.h"
+#include "flowfield.h"
+#include "net.h"
+#include "ai.h"
+#include "crowd.h"
+#include "util.h"
+#include "fixed.h"
+#include "collide.h"
 
 #include <vector>
-#include <memory.h>
+#include <stddef.h>
 
 namespace player
 {
-  typedef std::vector<Player *> PlayerVector;
-
   namespace {
     PlayerVector _allPlayers;
-    Player * _human;
+    uint32_t _local = 0;
+
+    Camera _camera;
+    std::string _name = "noname";
     float _cameraMoveSpeed = 20.0f;
+
+    // The plain data part of Player, hasRally is the last field before units
+    const size_t STATE_SIZE = offsetof(Player, hasRally) + sizeof(bool);
+
+    const uint32_t INTEGRATE_GRAIN = 4096;
+
+    // Half the size of a soldier, for sliding along walls
+    const float UNIT_RADIUS = 0.15f;
+
+    // Change to the unit hash of each integrated range
+    std::vector<uint64_t> _rangeHashes;
   }
 
   // -- Player --
@@ -23,55 +41,199 @@ namespace player
   Player::Player()
     : startX(0),
       startZ(0),
-      cameraX(0),
-      cameraZ(0),
-      cameraDir(30),
-      cameraMoveForward(0),
-      cameraMoveSideways(0),
       spawnRate(10.0),
       timeToNextSpawn(10.0),
-      name("noname"),
-      unitCount(0)
+      rallyX(0),
+      rallyZ(0),
+      unitSpeed(2.0),
+      hasRally(false)
+  {
+  }
+
+  // -- Camera --
+
+  Camera::Camera()
+    : x(0),
+      z(0),
+      dir(30),
+      prevX(0),
+      prevZ(0),
+      moveForward(0),
+      moveSideways(0)
   {
-    memset(units, 0, sizeof(Unit) * MAX_UNITS);
   }
 
   // -- API --
 
   void init()
   {
-    _human = new Player();
-    _allPlayers.push_back(_human);
+    _allPlayers.resize(1);
+    _local = 0;
+    _camera = Camera();
   }
 
   void shutdown()
   {
-    for (PlayerVector::iterator it = _allPlayers.begin(); it != _allPlayers.end(); ++it)
-      delete *it;
-
     _allPlayers.clear();
   }
 
+  void setup(uint32_t count, uint32_t local)
+  {
+    if (count == 0)
+      count = 1;
+
+    // Players are only ever added and removed at the end, so the storage of
+    // each keeps its unit registry index
+    _allPlayers.resize(count);
+    _local = local < count ? local : 0;
+  }
+
   void setName(std::string const& name)
   {
-    player().name = name;
+    _name = name;
+  }
+
+  std::string const& name()
+  {
+    return _name;
   }
 
   Player & player()
   {
-    return *_human;
-  };
+    return _allPlayers[_local];
+  }
+
+  Player & player(uint32_t index)
+  {
+    return _allPlayers[index];
+  }
+
+  PlayerVector const& players()
+  {
+    return _allPlayers;
+  }
+
+  Camera & camera()
+  {
+    return _camera;
+  }
 
   static void spawnUnit(Player * player)
   {
-    printf("Spawning for player '%s'\n", player->name.c_str());
+    unit::Storage & units = player->units;
+    unit::ID id = unit::spawn(units);
+    if (id == unit::INVALID_ID)
+      return;
+
+    uint32_t i = 0;
+    unit::find(id, &i);
+    units.stateHash ^= unit::hash(units, i, i + 1);
+
+    units.x[i] = units.prevX[i] = player->startX;
+    units.z[i] = units.prevZ[i] = player->startZ + 1.5f;
+    units.cell[i] = world::cellAt(units.x[i], units.z[i]);
+
+    units.stateHash ^= unit::hash(units, i, i + 1);
+  }
+
+  struct IntegrateJob
+  {
+    unit::Storage * units;
+    float dt;
+    uint64_t * hashes;  // One per range
+  };
+
+  static void integrateRange(void * data, uint32_t begin, uint32_t end)
+  {
+    IntegrateJob * job = (IntegrateJob *)data;
+    unit::Storage & units = *job->units;
+    unit::integrate(units, begin, end, job->dt,
+                    world::width() * -0.5f, world::height() * -0.5f,
+                    world::width(), world::height());
+
+    // The collide bitmap starts at the world corner
+    const float cornerX = world::width() * 0.5f;
+    const float cornerZ = world::height() * 0.5f;
+
+    // Only units that moved change their hash, the velocities were folded in
+    // when they were set
+    uint64_t changed = 0;
+
+    for (uint32_t i = begin; i < end; ++i)
+    {
+      if (!unit::moved(units, i))
+        continue;
+
+      changed ^= unit::hash(units.registryIndex, units.ids[i],
+                            units.prevX[i], units.prevY[i], units.prevZ[i],
+                            units.vx[i], units.vy[i], units.vz[i]);
+
+      float x = units.x[i] + cornerX;
+      float z = units.z[i] + cornerZ;
+      const uint32_t blocked = collide::sweep(units.prevX[i] + cornerX, units.prevZ[i] + cornerZ, x, z, UNIT_RADIUS);
+      if (blocked)
+      {
+        // Slide along the wall, the blocked part of the move is dropped
+        units.x[i] = x - cornerX;
+        units.z[i] = z - cornerZ;
+        if (blocked & collide::BLOCKED_X)
+          units.vx[i] = 0.0f;
+        if (blocked & collide::BLOCKED_Z)
+          units.vz[i] = 0.0f;
+
+        units.cell[i] = world::cellAt(units.x[i], units.z[i]);
+      }
+
+      changed ^= unit::hash(units, i, i + 1);
+    }
+
+    job->hashes[begin / INTEGRATE_GRAIN] = changed;
   }
 
   void tick(double dt)
   {
     for (PlayerVector::iterator it = _allPlayers.begin(), end = _allPlayers.end(); it != end; ++it)
     {
-      Player * player = *it;
+      Player * player = &*it;
+      if (player->units.count == 0)
+        continue;
+
+      // Velocities are made fresh every tick, units without anywhere to go
+      // only move when the AI or the crowd pushes them
+      if (!player->hasRally)
+      {
+        unit::Storage & units = player->units;
+        for (uint32_t i = 0; i < units.count; ++i)
+          units.stateHash ^= unit::setVelocity(units, i, 0.0f, 0.0f);
+        continue;
+      }
+
+      const uint32_t goal = world::cellAt(player->rallyX, player->rallyZ);
+      flowfield::Field const& field = flowfield::get(goal % world::width(), goal / world::width());
+      flowfield::steer(player->units, field, player->unitSpeed);
+    }
+
+    // Units in combat leave their flow field to chase their target
+    ai::tick();
+
+    for (PlayerVector::iterator it = _allPlayers.begin(), end = _allPlayers.end(); it != end; ++it)
+      crowd::separate(it->units, it->unitSpeed);
+
+    for (PlayerVector::iterator it = _allPlayers.begin(), end = _allPlayers.end(); it != end; ++it)
+    {
+      _rangeHashes.assign(it->units.count / INTEGRATE_GRAIN + 1, 0);
+      IntegrateJob job = { &it->units, (float)dt, &_rangeHashes[0] };
+
+      // The grain is a multiple of the storage padding, as integrate() requires
+      jobs::parallelFor(job.units->count, INTEGRATE_GRAIN, integrateRange, &job);
+
+      for (size_t i = 0; i < _rangeHashes.size(); ++i)
+        it->units.stateHash ^= _rangeHashes[i];
+    }
+
+    for (PlayerVector::iterator it = _allPlayers.begin(), end = _allPlayers.end(); it != end; ++it)
+    {
+      Player * player = &*it;
 
       player->timeToNextSpawn -= dt;
       if (player->timeToNextSpawn < 0.0f)
@@ -82,48 +244,112 @@ namespace player
     }
 
     { // Update player camera
-      Player & player = player::player();
-      const float forwardX = -std::cos(math::frad(player.cameraDir));
-      const float forwardZ = -std::sin(math::frad(player.cameraDir));
+      Camera & camera = _camera;
+      camera.prevX = camera.x;
+      camera.prevZ = camera.z;
+
+      // Table trig, libm sin and cos differ between platforms
+      const math::Fixed dir = math::Fixed::fromFloat(camera.dir);
+      const math::Fixed right = dir + math::Fixed::fromInt(90);
+
+      const float forwardX = -math::fixed::cos(dir).toFloat();
+      const float forwardZ = -math::fixed::sin(dir).toFloat();
 
-      const float sidewaysX = std::cos(math::frad(player.cameraDir + 90));
-      const float sidewaysZ = std::sin(math::frad(player.cameraDir + 90));
+      const float sidewaysX = math::fixed::cos(right).toFloat();
+      const float sidewaysZ = math::fixed::sin(right).toFloat();
 
-      player.cameraX += (forwardX * player.cameraMoveForward + sidewaysX * player.cameraMoveSideways) * _cameraMoveSpeed * dt;
-      player.cameraZ += (forwardZ * player.cameraMoveForward + sidewaysZ * player.cameraMoveSideways) * _cameraMoveSpeed * dt;
+      camera.x += (forwardX * camera.moveForward + sidewaysX * camera.moveSideways) * _cameraMoveSpeed * dt;
+      camera.z += (forwardZ * camera.moveForward + sidewaysZ * camera.moveSideways) * _cameraMoveSpeed * dt;
     }
   }
 
-  void setCamera()
+  void save(std::vector<uint8_t> & out)
   {
-    const float dirX = std::cos(math::frad(player().cameraDir));
-    const float dirZ = std::sin(math::frad(player().cameraDir));
+    const uint32_t count = _allPlayers.size();
+    util::append(out, count);
+
+    // Loading recreates the players first, that kills their old units, so
+    // the registry has to come after.
+    unit::saveRegistry(out);
+
+    for (PlayerVector::iterator it = _allPlayers.begin(); it != _allPlayers.end(); ++it)
+    {
+      util::append(out, &*it, STATE_SIZE);
+      it->units.save(out);
+    }
+  }
+
+  bool load(util::Reader & reader)
+  {
+    uint32_t count = 0;
+    if (!reader.read(count) || count == 0 || count > 256)
+      return false;
+
+    setup(count, _local);
 
-    gfx::setCamera(player().cameraX + dirX * 10.0f, 15, player().cameraZ + dirZ * 10.0f, player().cameraX, 0, player().cameraZ);
+    if (!unit::loadRegistry(reader))
+      return false;
+
+    for (PlayerVector::iterator it = _allPlayers.begin(); it != _allPlayers.end(); ++it)
+      if (!reader.read(&*it, STATE_SIZE) || !it->units.load(reader))
+        return false;
+
+    return !reader.failed;
   }
 
-  void render()
+  void saveKeyframe(std::vector<uint8_t> & out)
   {
-    gfxe::beginCube();
+    const uint32_t count = _allPlayers.size();
+    util::append(out, count);
+    unit::saveRegistryKeyframe(out);
 
-    for (PlayerVector::const_iterator it = _allPlayers.begin(), end = _allPlayers.end(); it != end; ++it)
+    for (PlayerVector::iterator it = _allPlayers.begin(); it != _allPlayers.end(); ++it)
     {
-      Player * player = *it;
+      util::append(out, &*it, STATE_SIZE);
+      it->units.saveKeyframe(out);
+    }
+  }
 
-      const float startY = world::getHeight(player->startX, player->startZ);
+  bool loadKeyframe(util::Reader & reader)
+  {
+    uint32_t count = 0;
+    if (!reader.read(count) || count == 0 || count > 256)
+      return false;
 
-      // Draw spawn point
-      gfx::setTintColor(1, 0, 0);
-      gfx::setTransform(player->startX, startY + 0.25, player->startZ, 0, 0, 0, 1.5, 1, 1.5);
-      gfxe::drawCube(); // Walls
+    setup(count, _local);
 
-      gfx::setTintColor(0.1, 0.1, 0.1);
-      gfx::setTransform(player->startX, startY + 0.75, player->startZ, 45, 0, 0, 1.45, 1.1, 1.1);
-      gfxe::drawCube(); // Roof
+    if (!unit::loadRegistryKeyframe(reader))
+      return false;
 
+    for (PlayerVector::iterator it = _allPlayers.begin(); it != _allPlayers.end(); ++it)
+    {
+      unit::Storage & units = it->units;
+      if (!reader.read(&*it, STATE_SIZE) || !units.loadKeyframe(reader))
+        return false;
+
+      for (uint32_t i = 0; i < units.count; ++i)
+        units.cell[i] = world::cellAt(units.x[i], units.z[i]);
     }
 
-    gfxe::endCube();
+    return !reader.failed;
+  }
+
+  uint64_t hash()
+  {
+    uint64_t result = util::mix64(_allPlayers.size());
+    for (PlayerVector::iterator it = _allPlayers.begin(); it != _allPlayers.end(); ++it)
+      result = util::hash64(&*it, STATE_SIZE, result);
+
+    return result;
+  }
+
+  uint64_t unitHash()
+  {
+    uint64_t result = 0;
+    for (PlayerVector::iterator it = _allPlayers.begin(); it != _allPlayers.end(); ++it)
+      result ^= it->units.stateHash;
+
+    return result;
   }
 
   // -- Tcl Bindings --
@@ -133,19 +359,35 @@ namespace player
     _cameraMoveSpeed = speed;
   }
 
+  static void setRally(float x, float z)
+  {
+    // Goes through net so every peer applies it on the same tick
+    net::Command command = { net::CMD_RALLY, 0, x, z, 0 };
+    net::issue(command);
+  }
+
+  static void killUnit(unit::ID id)
+  {
+    // Same as the rally point, a kill on one peer only would desync
+    net::Command command = { net::CMD_KILL, 0, 0.0f, 0.0f, id };
+    net::issue(command);
+  }
+
   static void panForward(int32_t dir)
   {
-    player().cameraMoveForward = dir;
+    _camera.moveForward = dir;
   }
 
   static void panSideways(int32_t dir)
   {
-    player().cameraMoveSideways = dir;
+    _camera.moveSideways = dir;
   }
 
   PROC("player:setName", setName);
   PROC("player:cameraSpeed", setCameraSpeed);
+  PROC("player:rally", setRally);
   PROC("player:panForward", panForward);
   PROC("player:panSideways", panSideways);
+  PROC("unit:kill", killUnit);
 
 }
\ No newline at end of file
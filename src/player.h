@@ -3,42 +3,87 @@
 
 #include <stdint.h>
 #include <string>
+#include <vector>
 
-namespace player
-{
-  enum { MAX_UNITS = 128 };
+#include "unit.h"
 
-  struct Unit
-  {
-    float pos[3];
-    float vel[3];
-  };
+namespace util { struct Reader; }
 
+namespace player
+{
+  /// Simulation state of a player. Everything up to units is plain data, so
+  /// sim::save() copies it in one go.
   struct Player
   {
     Player();
 
     float startX, startZ;
-    float cameraX, cameraZ, cameraDir;
-    float cameraMoveForward, cameraMoveSideways;
 
     float spawnRate;
     float timeToNextSpawn;
 
-    std::string name;
+    float rallyX, rallyZ;
+    float unitSpeed;
+
+    // Units walk towards the rally point along a flow field
+    bool hasRally;
+
+    unit::Storage units;
+  };
+
+  /// The view of the local player, not part of the simulation state
+  struct Camera
+  {
+    Camera();
 
-    Unit units[MAX_UNITS];
-    uint32_t unitCount;
+    float x, z, dir;
+    float prevX, prevZ;
+    float moveForward, moveSideways;
   };
 
+  /// Players are stored by value, moving them around relinks their units
+  typedef std::vector<Player> PlayerVector;
+
   void init();
   void shutdown();
 
+  /// Creates or removes players until there are count, local is the one
+  /// controlled from this machine. Used when a lockstep session starts.
+  void setup(uint32_t count, uint32_t local);
+
   Player & player();
+  Player & player(uint32_t index);
+  PlayerVector const& players();
+
+  Camera & camera();
 
   void setName(std::string const& name);
+  std::string const& name();
 
-  void setCamera();
-  void render();
   void tick(double dt);
+
+  /// Hash of the player state, computed on the spot, there is little of it
+  uint64_t hash();
+
+  /// Hash of all units, the XOR of the running hash of every storage. Only
+  /// units that spawn, die, move or change velocity are hashed again.
+  uint64_t unitHash();
+
+  /// Players, their units and the unit registry, part of the state written
+  /// by sim::save(). The camera and name are local and not saved.
+  void save(std::vector<uint8_t> & out);
+  bool load(util::Reader & reader);
+
+  /// Same for replay keyframes, the units only keep their handles, positions
+  /// and velocities, the rest is derived again on load. The world has to be
+  /// loaded first.
+  void saveKeyframe(std::vector<uint8_t> & out);
+  bool loadKeyframe(util::Reader & reader);
+
+  // -- Rendering, implemented in player_gfx.cpp --
+
+  /// alpha is the fraction of a tick that has passed since the last one,
+  /// state is interpolated between the previous and current tick.
+  void setCamera(float alpha);
+  void render(float alpha);
 }
\ No newline at end of file
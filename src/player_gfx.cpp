@@ -0,0 +1,66 @@
+#include "player.h"
+#include "world.h"
+#include "fog.h"
+#include "gfxe.h"
+#include "fpumath.h"
+
+namespace player
+{
+
+  // -- Rendering --
+
+  void setCamera(float alpha)
+  {
+    Camera const& view = camera();
+    const float dirX = std::cos(math::frad(view.dir));
+    const float dirZ = std::sin(math::frad(view.dir));
+
+    const float x = math::flerp(view.prevX, view.x, alpha);
+    const float z = math::flerp(view.prevZ, view.z, alpha);
+
+    gfx::setCamera(x + dirX * 10.0f, 15, z + dirZ * 10.0f, x, 0, z);
+  }
+
+  void render(float alpha)
+  {
+    gfxe::beginCube();
+
+    const uint32_t local = &player() - &players()[0];
+
+    for (PlayerVector::const_iterator it = players().begin(), end = players().end(); it != end; ++it)
+    {
+      Player const* player = &*it;
+      const bool own = player == &players()[local];
+
+      const float startY = world::getHeight(player->startX, player->startZ);
+
+      // Draw spawn point
+      gfx::setTintColor(1, 0, 0);
+      gfx::setTransform(player->startX, startY + 0.25, player->startZ, 0, 0, 0, 1.5, 1, 1.5);
+      gfxe::drawCube(); // Walls
+
+      gfx::setTintColor(0.1, 0.1, 0.1);
+      gfx::setTransform(player->startX, startY + 0.75, player->startZ, 45, 0, 0, 1.45, 1.1, 1.1);
+      gfxe::drawCube(); // Roof
+
+      // Draw units
+      gfx::setTintColor(0.2, 0.2, 0.8);
+      const unit::Storage & units = player->units;
+      for (uint32_t i = 0; i < units.count; ++i)
+      {
+        // Enemies are only drawn where the fog of war lets us see them
+        if (!own && !fog::visible(local, units.cell[i] % world::width(), units.cell[i] / world::width()))
+          continue;
+
+        gfx::setTransform(math::flerp(units.prevX[i], units.x[i], alpha),
+                          math::flerp(units.prevY[i], units.y[i], alpha) + 0.25,
+                          math::flerp(units.prevZ[i], units.z[i], alpha),
+                          0, 0, 0, 0.3, 0.5, 0.3);
+        gfxe::drawCube();
+      }
+    }
+
+    gfxe::endCube();
+  }
+
+}
@@ -0,0 +1,370 @@
+#include "replay.h"
+#include "sim.h"
+#include "tcl.h"
+
+#include <zlib.h>
+
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+namespace replay
+{
+  namespace {
+    const char MAGIC[8] = { 'S', 'R', 'T', 'S', 'D', 'E', 'M', 'O' };
+    const uint32_t VERSION = 3;
+
+    enum Record
+    {
+      RECORD_COMMANDS = 1,
+      RECORD_KEYFRAME = 2,
+      RECORD_END = 3
+    };
+
+    struct Keyframe
+    {
+      uint64_t tick;
+      std::vector<uint8_t> state;
+    };
+
+    struct Recorded
+    {
+      uint64_t tick;
+      net::Command command;
+
+      bool operator < (Recorded const& other) const
+      {
+        return tick < other.tick;
+      }
+    };
+
+    // Recording
+    gzFile _file = NULL;
+    uint32_t _keyframeInterval = 3600;
+    uint64_t _lastKeyframe = 0;
+    uint64_t _pendingTick = 0;
+    std::vector<net::Command> _pending;
+    std::vector<uint8_t> _buffer;
+
+    // Playback
+    bool _playing = false;
+    std::vector<Keyframe> _keyframes;
+    std::vector<Recorded> _commands;
+    size_t _cursor = 0;
+    uint64_t _endTick = 0;
+  }
+
+  static inline bool isLittleEndian()
+  {
+    const uint16_t probe = 1;
+    return *(const uint8_t *)&probe == 1;
+  }
+
+  // -- Recording --
+
+  static void write(const void * data, uint32_t size)
+  {
+    gzwrite(_file, data, size);
+  }
+
+  template <typename T>
+  static void write(T const& value)
+  {
+    write(&value, sizeof(T));
+  }
+
+  static void flushCommands()
+  {
+    if (_pending.empty())
+      return;
+
+    write((uint8_t)RECORD_COMMANDS);
+    write(_pendingTick);
+    write((uint16_t)_pending.size());
+
+    for (size_t i = 0; i < _pending.size(); ++i)
+    {
+      write(_pending[i].type);
+      write(_pending[i].player);
+      write(_pending[i].x);
+      write(_pending[i].z);
+      write(_pending[i].unit);
+    }
+
+    _pending.clear();
+  }
+
+  static void writeKeyframe(uint64_t tick)
+  {
+    _buffer.clear();
+    sim::saveKeyframe(_buffer);
+
+    write((uint8_t)RECORD_KEYFRAME);
+    write(tick);
+    write((uint32_t)_buffer.size());
+    write(&_buffer[0], _buffer.size());
+
+    _lastKeyframe = tick;
+  }
+
+  bool record(std::string const& filename)
+  {
+    stop();
+
+    _file = gzopen(filename.c_str(), "wb9");
+    if (!_file)
+    {
+      fprintf(stderr, "Could not open '%s' for recording\n", filename.c_str());
+      return false;
+    }
+
+    write(MAGIC, sizeof(MAGIC));
+    write((uint8_t)isLittleEndian());
+    write(VERSION);
+    write(sim::tickRate());
+
+    writeKeyframe(sim::tickCount());
+    return true;
+  }
+
+  void beginTick(uint64_t tick)
+  {
+    if (!_file)
+      return;
+
+    flushCommands();
+
+    if (tick - _lastKeyframe >= _keyframeInterval)
+      writeKeyframe(tick);
+  }
+
+  void command(uint64_t tick, net::Command const& command)
+  {
+    if (!_file)
+      return;
+
+    if (tick != _pendingTick || _pending.size() == 0xffff)
+      flushCommands();
+
+    _pendingTick = tick;
+    _pending.push_back(command);
+  }
+
+  // -- Playback --
+
+  static bool read(gzFile file, void * data, uint32_t size)
+  {
+    return gzread(file, data, size) == (int)size;
+  }
+
+  template <typename T>
+  static bool read(gzFile file, T & value)
+  {
+    return read(file, &value, sizeof(T));
+  }
+
+  /// Loads the last keyframe at or before tick and simulates up to tick. The
+  /// load is skipped when the running playback is already between that
+  /// keyframe and tick, unless force is set.
+  static bool restore(uint64_t tick, bool force)
+  {
+    tick = std::max(startTick(), std::min(tick, _endTick));
+
+    size_t keyframe = 0;
+    while (keyframe + 1 < _keyframes.size() && _keyframes[keyframe + 1].tick <= tick)
+      ++keyframe;
+
+    if (force || sim::tickCount() > tick || sim::tickCount() < _keyframes[keyframe].tick)
+    {
+      Keyframe const& frame = _keyframes[keyframe];
+      if (!sim::loadKeyframe(&frame.state[0], frame.state.size()))
+        return false;
+    }
+
+    Recorded target;
+    target.tick = sim::tickCount();
+    _cursor = std::lower_bound(_commands.begin(), _commands.end(), target) - _commands.begin();
+
+    while (sim::tickCount() < tick)
+      sim::tick(sim::tickDuration());
+
+    return true;
+  }
+
+  bool play(std::string const& filename)
+  {
+    stop();
+
+    gzFile file = gzopen(filename.c_str(), "rb");
+    if (!file)
+    {
+      fprintf(stderr, "Could not open replay '%s'\n", filename.c_str());
+      return false;
+    }
+
+    // Like Cube's demos, replays only load on machines of the same endianness
+    char magic[sizeof(MAGIC)];
+    uint8_t littleEndian = 0;
+    uint32_t version = 0, tickRate = 0;
+
+    if (!read(file, magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), MAGIC) ||
+        !read(file, littleEndian) || littleEndian != isLittleEndian() ||
+        !read(file, version) || version != VERSION || !read(file, tickRate))
+    {
+      fprintf(stderr, "'%s' is not a replay\n", filename.c_str());
+      gzclose(file);
+      return false;
+    }
+
+    _endTick = 0;
+    uint8_t type = 0;
+
+    // A truncated file still plays up to the last complete record
+    while (read(file, type))
+    {
+      uint64_t tick = 0;
+      if (!read(file, tick))
+        break;
+
+      _endTick = std::max(_endTick, tick);
+
+      if (type == RECORD_COMMANDS)
+      {
+        uint16_t count = 0;
+        if (!read(file, count))
+          break;
+
+        uint16_t i = 0;
+        for (; i < count; ++i)
+        {
+          Recorded recorded;
+          recorded.tick = tick;
+          if (!read(file, recorded.command.type) || !read(file, recorded.command.player) ||
+              !read(file, recorded.command.x) || !read(file, recorded.command.z) ||
+              !read(file, recorded.command.unit))
+            break;
+
+          _commands.push_back(recorded);
+        }
+
+        // The rest of a cut off record is not there to parse
+        if (i < count)
+          break;
+      }
+      else if (type == RECORD_KEYFRAME)
+      {
+        uint32_t size = 0;
+        _keyframes.push_back(Keyframe());
+        _keyframes.back().tick = tick;
+
+        if (!read(file, size))
+          break;
+
+        _keyframes.back().state.resize(size);
+        if (size == 0 || !read(file, &_keyframes.back().state[0], size))
+        {
+          _keyframes.pop_back();
+          break;
+        }
+      }
+      else
+        break;
+    }
+
+    gzclose(file);
+
+    if (_keyframes.empty())
+    {
+      fprintf(stderr, "Replay '%s' has no keyframes\n", filename.c_str());
+      return false;
+    }
+
+    sim::setTickRate(tickRate);
+    _playing = true;
+
+    // Whatever ran before has nothing to do with the replay, so the first
+    // keyframe is always loaded
+    if (!restore(_keyframes.front().tick, true))
+    {
+      stop();
+      return false;
+    }
+
+    return true;
+  }
+
+  bool seek(uint64_t tick)
+  {
+    // Seeking forward within the same keyframe interval just keeps going,
+    // the state came from this replay
+    return _playing && restore(tick, false);
+  }
+
+  void execute(uint64_t tick)
+  {
+    while (_cursor < _commands.size() && _commands[_cursor].tick < tick)
+      ++_cursor;
+
+    for (; _cursor < _commands.size() && _commands[_cursor].tick == tick; ++_cursor)
+      net::apply(_commands[_cursor].command);
+  }
+
+  // -- API --
+
+  void stop()
+  {
+    if (_file)
+    {
+      flushCommands();
+      write((uint8_t)RECORD_END);
+      write(sim::tickCount());
+      gzclose(_file);
+      _file = NULL;
+    }
+
+    _playing = false;
+    _keyframes.clear();
+    _commands.clear();
+    _cursor = 0;
+    _endTick = 0;
+  }
+
+  bool recording()
+  {
+    return _file != NULL;
+  }
+
+  bool playing()
+  {
+    return _playing;
+  }
+
+  void setKeyframeInterval(uint32_t ticks)
+  {
+    _keyframeInterval = ticks > 0 ? ticks : 1;
+  }
+
+  uint64_t startTick()
+  {
+    return _keyframes.empty() ? 0 : _keyframes.front().tick;
+  }
+
+  uint64_t endTick()
+  {
+    return _endTick;
+  }
+
+  // -- Tcl Bindings --
+
+  static bool seekSeconds(float seconds)
+  {
+    return seek(startTick() + (uint64_t)std::max(0.0f, seconds * sim::tickRate()));
+  }
+
+  PROC("replay:record", record);
+  PROC("replay:play", play);
+  PROC("replay:stop", stop);
+  PROC("replay:seek", seekSeconds);
+  PROC("replay:keyframeInterval", setKeyframeInterval);
+
+}
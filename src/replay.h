@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+#include "net.h"
+
+/// Replays store the commands run on each tick plus a keyframe of the
+/// simulation state (sim::saveKeyframe()) every keyframe interval, gzip
+/// compressed. Seeking restores the last keyframe before the target and runs
+/// the simulation forward from there without rendering.
+///
+/// Only commands are recorded, changes made directly from scripts while
+/// recording are not part of the replay.
+namespace replay
+{
+
+  /// Starts recording, the current state becomes the first keyframe
+  bool record(std::string const& filename);
+
+  /// Loads a replay and restores its first keyframe
+  bool play(std::string const& filename);
+
+  /// Stops recording or playback
+  void stop();
+
+  bool recording();
+  bool playing();
+
+  /// Ticks between keyframes while recording
+  void setKeyframeInterval(uint32_t ticks);
+
+  /// Jumps playback to an absolute tick inside the replay
+  bool seek(uint64_t tick);
+
+  /// First and last tick of the replay being played
+  uint64_t startTick();
+  uint64_t endTick();
+
+  // -- Called by the simulation --
+
+  /// Writes a keyframe when one is due, before anything runs on tick
+  void beginTick(uint64_t tick);
+
+  /// Records a command that runs on tick
+  void command(uint64_t tick, net::Command const& command);
+
+  /// Runs the recorded commands for tick during playback
+  void execute(uint64_t tick);
+
+}
@@ -0,0 +1,261 @@
+#include "sim.h"
+#include "tcl.h"
+#include "world.h"
+#include "player.h"
+#include "spatial.h"
+#include "jobs.h"
+#include "flowfield.h"
+#include "jps.h"
+#include "hpa.h"
+#include "net.h"
+#include "replay.h"
+#include "ai.h"
+#include "influence.h"
+#include "fog.h"
+#include "collide.h"
+#include "util.h"
+
+#include <cmath>
+
+namespace sim
+{
+  namespace {
+    uint64_t _tickCount = 0;
+    spatial::StorageVector _storages;
+
+    uint32_t _tickRate = 60;
+    double _tickDuration = 1.0 / 60.0;
+    uint32_t _maxCatchUpTicks = 5;
+    double _accumulator = 0.0;
+
+    // Bumped whenever the layout written by save() changes
+    const uint32_t STATE_VERSION = 6;
+
+    // Same for saveKeyframe()
+    const uint32_t KEYFRAME_VERSION = 1;
+  }
+
+  static void buildSpatial()
+  {
+    _storages.clear();
+    for (uint32_t i = 0; i < player::players().size(); ++i)
+      _storages.push_back(&player::player(i).units);
+
+    spatial::build(_storages, world::width() * -0.5f, world::height() * -0.5f, world::width(), world::height());
+  }
+
+  void init()
+  {
+    jobs::init();
+    net::init();
+    tcl::init();
+    player::init();
+    hpa::init();
+    ai::clear();
+    influence::clear();
+    fog::clear();
+
+    _tickCount = 0;
+    _accumulator = 0.0;
+  }
+
+  void shutdown()
+  {
+    replay::stop();
+    ai::clear();
+    influence::clear();
+    fog::clear();
+    flowfield::clearCache();
+    hpa::shutdown();
+    jps::shutdown();
+    world::clear();
+    player::shutdown();
+    tcl::shutdown();
+    net::shutdown();
+    jobs::shutdown();
+  }
+
+  void tick(double dt)
+  {
+    replay::beginTick(_tickCount);
+
+    if (replay::playing())
+      replay::execute(_tickCount);
+    else
+      net::execute(_tickCount);
+
+    player::tick(dt);
+
+    // Everything after movement sees the unit positions of this tick
+    buildSpatial();
+    influence::update();
+    fog::update();
+
+    net::endTurn(_tickCount);
+    ++_tickCount;
+  }
+
+  void save(std::vector<uint8_t> & out)
+  {
+    util::append(out, STATE_VERSION);
+    util::append(out, _tickCount);
+
+    world::save(out);
+    collide::save(out);
+    player::save(out);
+    ai::save(out);
+    spatial::save(out);
+  }
+
+  bool load(const uint8_t * data, size_t size)
+  {
+    util::Reader reader(data, size);
+
+    uint32_t version = 0;
+    uint64_t tickCount = 0;
+    if (!reader.read(version) || version != STATE_VERSION || !reader.read(tickCount))
+      return false;
+
+    if (!world::load(reader) || !collide::load(reader) || !player::load(reader) ||
+        !ai::load(reader))
+      return false;
+
+    _tickCount = tickCount;
+
+    // Flow fields and the collide listeners notice changed walls through the
+    // revisions, an unchanged map keeps its caches
+    if (!spatial::load(reader))
+    {
+      if (reader.failed)
+        return false;
+
+      buildSpatial();
+    }
+
+    // Derived from the units alone, moving the units that differ brings the
+    // maps back in line with the restored state
+    influence::update();
+    fog::update();
+
+    return true;
+  }
+
+  void saveKeyframe(std::vector<uint8_t> & out)
+  {
+    util::append(out, KEYFRAME_VERSION);
+    util::append(out, _tickCount);
+
+    world::save(out);
+    collide::save(out);
+    player::saveKeyframe(out);
+    ai::saveKeyframe(out);
+  }
+
+  bool loadKeyframe(const uint8_t * data, size_t size)
+  {
+    util::Reader reader(data, size);
+
+    uint32_t version = 0;
+    uint64_t tickCount = 0;
+    if (!reader.read(version) || version != KEYFRAME_VERSION || !reader.read(tickCount))
+      return false;
+
+    if (!world::load(reader) || !collide::load(reader) || !player::loadKeyframe(reader) ||
+        !ai::loadKeyframe(reader))
+      return false;
+
+    _tickCount = tickCount;
+
+    // The grid of the last tick was built from the positions just loaded
+    buildSpatial();
+    influence::update();
+    fog::update();
+
+    return true;
+  }
+
+  void hash(Hash & out)
+  {
+    out.parts[HASH_WORLD] = world::hash();
+    out.parts[HASH_COLLIDE] = collide::hash();
+    out.parts[HASH_PLAYERS] = player::hash();
+    out.parts[HASH_AI] = ai::hash();
+    out.parts[HASH_UNITS] = player::unitHash();
+  }
+
+  const char * hashPartName(uint32_t part)
+  {
+    static const char * names[HASH_PART_COUNT] = { "world", "collide", "players", "ai", "units" };
+    return part < HASH_PART_COUNT ? names[part] : "unknown";
+  }
+
+  uint64_t tickCount()
+  {
+    return _tickCount;
+  }
+
+  void setTickRate(uint32_t hz)
+  {
+    if (hz == 0)
+      return;
+
+    _tickRate = hz;
+    _tickDuration = 1.0 / hz;
+  }
+
+  uint32_t tickRate()
+  {
+    return _tickRate;
+  }
+
+  double tickDuration()
+  {
+    return _tickDuration;
+  }
+
+  void setMaxCatchUpTicks(uint32_t ticks)
+  {
+    _maxCatchUpTicks = ticks > 0 ? ticks : 1;
+  }
+
+  uint32_t advance(double frameTime)
+  {
+    net::service();
+
+    _accumulator += frameTime;
+
+    uint32_t ticks = 0;
+    while (_accumulator >= _tickDuration && ticks < _maxCatchUpTicks)
+    {
+      // Lockstep barrier, wait for the inputs of every player
+      if (!net::turnReady(_tickCount))
+        break;
+
+      // Playback holds on the last recorded tick
+      if (replay::playing() && _tickCount >= replay::endTick())
+        break;
+
+      tick(_tickDuration);
+      _accumulator -= _tickDuration;
+      ++ticks;
+    }
+
+    // We could not keep up, throw away whole ticks but keep the fraction so
+    // alpha() stays continuous.
+    if (_accumulator >= _tickDuration)
+      _accumulator = std::fmod(_accumulator, _tickDuration);
+
+    return ticks;
+  }
+
+  float alpha()
+  {
+    return _accumulator / _tickDuration;
+  }
+
+  // -- Tcl Bindings --
+
+  PROC("sim:tickRate", setTickRate);
+  PROC("sim:maxCatchUp", setMaxCatchUpTicks);
+
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+/// The simulation layer. Everything reachable from here must build and run
+/// without a window or GL context, so it can be driven by the headless target.
+namespace sim
+{
+
+  void init();
+  void shutdown();
+
+  /// Runs a single simulation tick of dt seconds
+  void tick(double dt);
+
+  /// Number of ticks simulated since init()
+  uint64_t tickCount();
+
+  /// Appends the complete simulation state to out. Loading it back and
+  /// running the same commands gives the same ticks again. A failed load
+  /// leaves the simulation in an undefined state.
+  void save(std::vector<uint8_t> & out);
+  bool load(const uint8_t * data, size_t size);
+
+  /// Compact version of save() for replay keyframes. Only the authoritative
+  /// state is written, the spatial grid, previous positions and unit cells
+  /// are rebuilt on load, which makes it slower to load than save().
+  void saveKeyframe(std::vector<uint8_t> & out);
+  bool loadKeyframe(const uint8_t * data, size_t size);
+
+  // -- State hash --
+
+  /// Parts of the state hash, in the order they are compared so a desync
+  /// report names the first subsystem that differs
+  enum HashPart
+  {
+    HASH_WORLD,
+    HASH_COLLIDE,
+    HASH_PLAYERS,
+    HASH_AI,
+    HASH_UNITS,
+    HASH_PART_COUNT
+  };
+
+  struct Hash
+  {
+    uint64_t parts[HASH_PART_COUNT];
+  };
+
+  /// Hash of the simulation state per subsystem. Each subsystem keeps its
+  /// part up to date as the state changes, so this is cheap every tick.
+  void hash(Hash & out);
+
+  const char * hashPartName(uint32_t part);
+
+  // -- Fixed timestep --
+
+  void setTickRate(uint32_t hz);
+  uint32_t tickRate();
+  double tickDuration();
+
+  /// Limits how many ticks advance() may run for a single frame, time beyond
+  /// that is dropped so a long stall does not snowball into even longer frames.
+  void setMaxCatchUpTicks(uint32_t ticks);
+
+  /// Accumulates frameTime seconds and runs as many fixed ticks as fit.
+  /// Returns the number of ticks run.
+  uint32_t advance(double frameTime);
+
+  /// How far we are between the last tick and the next one, in [0, 1).
+  /// Used by rendering to interpolate between previous and current state.
+  float alpha();
+
+}
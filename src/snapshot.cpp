@@ -0,0 +1,491 @@
+#include "snapshot.h"
+#include "player.h"
+#include "world.h"
+#include "sim.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace snapshot
+{
+  namespace {
+    const uint32_t VELOCITY_BITS = 16;
+    const int32_t VELOCITY_LIMIT = (1 << (VELOCITY_BITS - 1)) - 1;
+
+    // Differences from the prediction up to this size get a short code
+    const uint32_t SMALL_BITS = 4;
+    const int32_t SMALL_LIMIT = (1 << (SMALL_BITS - 1)) - 1;
+
+    const uint32_t PLAYER_BITS = 4;
+
+    struct BitWriter
+    {
+      BitWriter(std::vector<uint8_t> & out)
+        : out(out), bits(0), count(0)
+      { }
+
+      void write(uint32_t value, uint32_t n)
+      {
+        bits |= (uint64_t)(value & (((uint64_t)1 << n) - 1)) << count;
+        count += n;
+
+        while (count >= 8)
+        {
+          out.push_back(bits & 0xff);
+          bits >>= 8;
+          count -= 8;
+        }
+      }
+
+      void flush()
+      {
+        if (count > 0)
+          out.push_back(bits & 0xff);
+
+        bits = 0;
+        count = 0;
+      }
+
+      std::vector<uint8_t> & out;
+      uint64_t bits;
+      uint32_t count;
+    };
+
+    struct BitReader
+    {
+      BitReader(const uint8_t * data, uint32_t size)
+        : data(data), size(size), position(0), overrun(false)
+      { }
+
+      uint32_t read(uint32_t n)
+      {
+        uint64_t result = 0;
+        uint32_t done = 0;
+
+        while (done < n)
+        {
+          const uint32_t byte = position >> 3;
+          if (byte >= size)
+          {
+            overrun = true;
+            return 0;
+          }
+
+          const uint32_t offset = position & 7;
+          const uint32_t take = std::min(8 - offset, n - done);
+          result |= (uint64_t)((data[byte] >> offset) & ((1 << take) - 1)) << done;
+
+          done += take;
+          position += take;
+        }
+
+        return (uint32_t)result;
+      }
+
+      const uint8_t * data;
+      uint32_t size;
+      uint32_t position;
+      bool overrun;
+    };
+  }
+
+  Snapshot::Snapshot()
+    : sequence(0),
+      tick(0),
+      tickRate(0),
+      width(0),
+      height(0),
+      players(0)
+  {
+  }
+
+  // -- Coding helpers --
+
+  static uint32_t bitsFor(uint32_t value)
+  {
+    uint32_t bits = 1;
+    while (bits < 32 && (value >> bits) != 0)
+      ++bits;
+    return bits;
+  }
+
+  /// Exp-Golomb, small values take few bits
+  static void writeGamma(BitWriter & writer, uint32_t value)
+  {
+    const uint64_t v = (uint64_t)value + 1;
+    uint32_t n = 0;
+    while ((v >> (n + 1)) != 0)
+      ++n;
+
+    writer.write(0, n);
+    writer.write(1, 1);
+    writer.write((uint32_t)(v & (((uint64_t)1 << n) - 1)), n);
+  }
+
+  static uint32_t readGamma(BitReader & reader)
+  {
+    uint32_t n = 0;
+    while (reader.read(1) == 0)
+    {
+      if (reader.overrun || ++n > 32)
+      {
+        reader.overrun = true;
+        return 0;
+      }
+    }
+
+    const uint64_t v = ((uint64_t)1 << n) | reader.read(n);
+    return (uint32_t)(v - 1);
+  }
+
+  static inline uint32_t zigzag(int32_t value)
+  {
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+  }
+
+  static inline int32_t unzigzag(uint32_t value)
+  {
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+  }
+
+  static inline int32_t signExtend(uint32_t value, uint32_t bits)
+  {
+    const uint32_t sign = 1u << (bits - 1);
+    return (int32_t)((value ^ sign) - sign);
+  }
+
+  /// "0" matches the prediction, "10" plus a small difference, "11" plus the full value
+  static void writeField(BitWriter & writer, int32_t value, int32_t predicted, uint32_t bits)
+  {
+    const int32_t delta = value - predicted;
+
+    if (delta == 0)
+    {
+      writer.write(0, 1);
+    }
+    else if (delta >= -SMALL_LIMIT && delta <= SMALL_LIMIT)
+    {
+      writer.write(1, 1);
+      writer.write(0, 1);
+      writer.write(zigzag(delta), SMALL_BITS);
+    }
+    else
+    {
+      writer.write(1, 1);
+      writer.write(1, 1);
+      writer.write(value, bits);
+    }
+  }
+
+  static int32_t readField(BitReader & reader, int32_t predicted, uint32_t bits, bool isSigned)
+  {
+    if (reader.read(1) == 0)
+      return predicted;
+
+    if (reader.read(1) == 0)
+      return predicted + unzigzag(reader.read(SMALL_BITS));
+
+    const uint32_t value = reader.read(bits);
+    return isSigned ? signExtend(value, bits) : (int32_t)value;
+  }
+
+  static int32_t predict(int32_t position, int32_t velocity, uint32_t ticks, uint32_t tickRate, int32_t limit)
+  {
+    if (tickRate == 0)
+      return position;
+
+    // Velocity is per second in VELOCITY_SCALE, positions are in POSITION_SCALE
+    const int64_t numerator = (int64_t)velocity * ticks * POSITION_SCALE;
+    const int64_t denominator = (int64_t)VELOCITY_SCALE * tickRate;
+    const int64_t offset = numerator >= 0 ? (numerator + denominator / 2) / denominator
+                                          : -((-numerator + denominator / 2) / denominator);
+
+    return (int32_t)std::max<int64_t>(0, std::min<int64_t>(limit, position + offset));
+  }
+
+  static int32_t quantize(float value, float scale, int32_t low, int32_t high)
+  {
+    const int32_t result = (int32_t)std::floor(value * scale + 0.5f);
+    return std::max(low, std::min(high, result));
+  }
+
+  static bool compareUnits(Unit const& a, Unit const& b)
+  {
+    if (a.player != b.player)
+      return a.player < b.player;
+
+    return unit::index(a.id) < unit::index(b.id);
+  }
+
+  static void begin(Snapshot & snapshot, uint32_t sequence)
+  {
+    snapshot.sequence = sequence;
+    snapshot.tick = (uint32_t)sim::tickCount();
+    snapshot.tickRate = sim::tickRate();
+    snapshot.width = world::width();
+    snapshot.height = world::height();
+    snapshot.players = std::min<uint32_t>(player::players().size(), 1 << PLAYER_BITS);
+    snapshot.units.clear();
+  }
+
+  static void add(Snapshot & snapshot, unit::Storage const& units, uint32_t i, uint32_t player)
+  {
+    const float minX = snapshot.width * -0.5f;
+    const float minZ = snapshot.height * -0.5f;
+
+    Unit unit;
+    unit.id = units.ids[i];
+    unit.player = player;
+    unit.x = quantize(units.x[i] - minX, POSITION_SCALE, 0, snapshot.width * POSITION_SCALE);
+    unit.z = quantize(units.z[i] - minZ, POSITION_SCALE, 0, snapshot.height * POSITION_SCALE);
+    unit.vx = quantize(units.vx[i], VELOCITY_SCALE, -VELOCITY_LIMIT, VELOCITY_LIMIT);
+    unit.vz = quantize(units.vz[i], VELOCITY_SCALE, -VELOCITY_LIMIT, VELOCITY_LIMIT);
+    snapshot.units.push_back(unit);
+  }
+
+  // -- API --
+
+  void capture(Snapshot & snapshot, uint32_t sequence)
+  {
+    player::PlayerVector const& players = player::players();
+    begin(snapshot, sequence);
+
+    for (uint32_t p = 0; p < snapshot.players; ++p)
+      for (uint32_t i = 0; i < players[p].units.count; ++i)
+        add(snapshot, players[p].units, i, p);
+
+    // Storage order changes whenever a unit is killed, slot order does not
+    std::sort(snapshot.units.begin(), snapshot.units.end(), compareUnits);
+  }
+
+  void capture(Snapshot & snapshot, uint32_t sequence, std::vector<unit::ID> const& ids)
+  {
+    player::PlayerVector const& players = player::players();
+    begin(snapshot, sequence);
+
+    for (size_t i = 0; i < ids.size(); ++i)
+    {
+      uint32_t index = 0;
+      unit::Storage const* units = unit::find(ids[i], &index);
+      if (!units)
+        continue;
+
+      for (uint32_t p = 0; p < snapshot.players; ++p)
+        if (&players[p].units == units)
+        {
+          add(snapshot, *units, index, p);
+          break;
+        }
+    }
+
+    std::sort(snapshot.units.begin(), snapshot.units.end(), compareUnits);
+  }
+
+  void encode(Snapshot const& snapshot, Snapshot const* baseline, std::vector<uint8_t> & out)
+  {
+    BitWriter writer(out);
+
+    writer.write(snapshot.sequence, 32);
+    writer.write(baseline ? baseline->sequence : (uint32_t)NO_BASELINE, 32);
+    writer.write(snapshot.tick, 32);
+    writer.write(snapshot.tickRate, 16);
+    writer.write(snapshot.width, 16);
+    writer.write(snapshot.height, 16);
+    writer.write(snapshot.players, PLAYER_BITS + 1);
+
+    const int32_t maxX = snapshot.width * POSITION_SCALE;
+    const int32_t maxZ = snapshot.height * POSITION_SCALE;
+    const uint32_t bitsX = bitsFor(maxX);
+    const uint32_t bitsZ = bitsFor(maxZ);
+    const uint32_t ticks = baseline ? snapshot.tick - baseline->tick : 0;
+
+    size_t current = 0;
+    size_t base = 0;
+    const size_t baseEnd = baseline ? baseline->units.size() : 0;
+
+    for (uint32_t p = 0; p < snapshot.players; ++p)
+    {
+      size_t end = current;
+      while (end < snapshot.units.size() && snapshot.units[end].player == p)
+        ++end;
+
+      writeGamma(writer, end - current);
+
+      uint32_t expected = 0;
+      for (; current < end; ++current)
+      {
+        Unit const& unit = snapshot.units[current];
+        const uint32_t index = unit::index(unit.id);
+
+        writeGamma(writer, index - expected);
+        expected = index + 1;
+
+        while (base < baseEnd && (baseline->units[base].player < p ||
+               (baseline->units[base].player == p && unit::index(baseline->units[base].id) < index)))
+          ++base;
+
+        if (base < baseEnd && baseline->units[base].player == p && baseline->units[base].id == unit.id)
+        {
+          Unit const& previous = baseline->units[base];
+          const int32_t predictedX = predict(previous.x, previous.vx, ticks, snapshot.tickRate, maxX);
+          const int32_t predictedZ = predict(previous.z, previous.vz, ticks, snapshot.tickRate, maxZ);
+
+          writer.write(1, 1);
+
+          if (unit.x == predictedX && unit.z == predictedZ && unit.vx == previous.vx && unit.vz == previous.vz)
+          {
+            writer.write(0, 1);
+            continue;
+          }
+
+          writer.write(1, 1);
+          writeField(writer, unit.x, predictedX, bitsX);
+          writeField(writer, unit.z, predictedZ, bitsZ);
+          writeField(writer, unit.vx, previous.vx, VELOCITY_BITS);
+          writeField(writer, unit.vz, previous.vz, VELOCITY_BITS);
+        }
+        else
+        {
+          writer.write(0, 1);
+          writer.write(unit::generation(unit.id), unit::GENERATION_BITS);
+          writer.write(unit.x, bitsX);
+          writer.write(unit.z, bitsZ);
+          writer.write(unit.vx, VELOCITY_BITS);
+          writer.write(unit.vz, VELOCITY_BITS);
+        }
+      }
+    }
+
+    writer.flush();
+  }
+
+  uint32_t baselineOf(const uint8_t * data, uint32_t size)
+  {
+    BitReader reader(data, size);
+    reader.read(32);
+    const uint32_t baseline = reader.read(32);
+    return reader.overrun ? (uint32_t)NO_BASELINE : baseline;
+  }
+
+  bool decode(const uint8_t * data, uint32_t size, Snapshot const* baseline, Snapshot & snapshot)
+  {
+    BitReader reader(data, size);
+
+    snapshot.sequence = reader.read(32);
+    const uint32_t baselineSequence = reader.read(32);
+    snapshot.tick = reader.read(32);
+    snapshot.tickRate = reader.read(16);
+    snapshot.width = reader.read(16);
+    snapshot.height = reader.read(16);
+    snapshot.players = reader.read(PLAYER_BITS + 1);
+    snapshot.units.clear();
+
+    if (baselineSequence == NO_BASELINE)
+      baseline = NULL;
+    else if (!baseline || baseline->sequence != baselineSequence)
+      return false;
+
+    const int32_t maxX = snapshot.width * POSITION_SCALE;
+    const int32_t maxZ = snapshot.height * POSITION_SCALE;
+    const uint32_t bitsX = bitsFor(maxX);
+    const uint32_t bitsZ = bitsFor(maxZ);
+    const uint32_t ticks = baseline ? snapshot.tick - baseline->tick : 0;
+
+    size_t base = 0;
+    const size_t baseEnd = baseline ? baseline->units.size() : 0;
+
+    for (uint32_t p = 0; p < snapshot.players && !reader.overrun; ++p)
+    {
+      const uint32_t count = readGamma(reader);
+      uint32_t expected = 0;
+
+      for (uint32_t i = 0; i < count && !reader.overrun; ++i)
+      {
+        const uint32_t index = expected + readGamma(reader);
+        expected = index + 1;
+
+        while (base < baseEnd && (baseline->units[base].player < p ||
+               (baseline->units[base].player == p && unit::index(baseline->units[base].id) < index)))
+          ++base;
+
+        Unit unit;
+        unit.player = p;
+
+        if (reader.read(1))
+        {
+          if (base >= baseEnd || baseline->units[base].player != p || unit::index(baseline->units[base].id) != index)
+            return false;
+
+          Unit const& previous = baseline->units[base];
+          const int32_t predictedX = predict(previous.x, previous.vx, ticks, snapshot.tickRate, maxX);
+          const int32_t predictedZ = predict(previous.z, previous.vz, ticks, snapshot.tickRate, maxZ);
+
+          unit.id = previous.id;
+
+          if (reader.read(1))
+          {
+            unit.x = readField(reader, predictedX, bitsX, false);
+            unit.z = readField(reader, predictedZ, bitsZ, false);
+            unit.vx = readField(reader, previous.vx, VELOCITY_BITS, true);
+            unit.vz = readField(reader, previous.vz, VELOCITY_BITS, true);
+          }
+          else
+          {
+            unit.x = predictedX;
+            unit.z = predictedZ;
+            unit.vx = previous.vx;
+            unit.vz = previous.vz;
+          }
+        }
+        else
+        {
+          unit.id = (reader.read(unit::GENERATION_BITS) << unit::INDEX_BITS) | index;
+          unit.x = reader.read(bitsX);
+          unit.z = reader.read(bitsZ);
+          unit.vx = signExtend(reader.read(VELOCITY_BITS), VELOCITY_BITS);
+          unit.vz = signExtend(reader.read(VELOCITY_BITS), VELOCITY_BITS);
+        }
+
+        snapshot.units.push_back(unit);
+      }
+    }
+
+    return !reader.overrun;
+  }
+
+  void apply(Snapshot const& snapshot)
+  {
+    player::setup(snapshot.players, 0);
+    player::PlayerVector const& players = player::players();
+
+    const float minX = snapshot.width * -0.5f;
+    const float minZ = snapshot.height * -0.5f;
+
+    size_t current = 0;
+    for (uint32_t p = 0; p < players.size(); ++p)
+    {
+      unit::Storage & units = player::player(p).units;
+      units.clear();
+
+      // The local ids are unrelated to the ones on the server
+      for (; current < snapshot.units.size() && snapshot.units[current].player == p; ++current)
+      {
+        Unit const& unit = snapshot.units[current];
+        const uint32_t i = units.count;
+        if (unit::spawn(units) == unit::INVALID_ID)
+          return;
+
+        units.stateHash ^= unit::hash(units, i, i + 1);
+
+        units.x[i] = units.prevX[i] = minX + unit.x * (1.0f / POSITION_SCALE);
+        units.z[i] = units.prevZ[i] = minZ + unit.z * (1.0f / POSITION_SCALE);
+        units.vx[i] = unit.vx * (1.0f / VELOCITY_SCALE);
+        units.vz[i] = unit.vz * (1.0f / VELOCITY_SCALE);
+        units.cell[i] = world::cellAt(units.x[i], units.z[i]);
+
+        units.stateHash ^= unit::hash(units, i, i + 1);
+      }
+    }
+  }
+
+}
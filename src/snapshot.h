@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "unit.h"
+
+/// Quantized copies of the unit state, for replicating a game to clients that
+/// do not run the simulation themselves (spectators, late joiners).
+///
+/// A snapshot is encoded against a baseline the client already has. Units are
+/// matched by id. Positions are predicted from the baseline velocity, and only
+/// the difference from that prediction is written, so a unit walking in a
+/// straight line costs a few bits.
+namespace snapshot
+{
+
+  /// Positions in 1/64 units, velocities in 1/256 units per second
+  enum { POSITION_SCALE = 64, VELOCITY_SCALE = 256 };
+
+  struct Unit
+  {
+    unit::ID id;
+    uint8_t player;
+    int32_t x, z;
+    int32_t vx, vz;
+  };
+
+  struct Snapshot
+  {
+    Snapshot();
+
+    uint32_t sequence;
+    uint32_t tick;
+    uint32_t tickRate;
+    uint32_t width, height;
+    uint32_t players;
+
+    /// Sorted by player and then by unit index
+    std::vector<Unit> units;
+  };
+
+  /// Captures the state of all players from the running simulation
+  void capture(Snapshot & snapshot, uint32_t sequence);
+
+  /// Same as above for the given units only, stale handles are skipped
+  void capture(Snapshot & snapshot, uint32_t sequence, std::vector<unit::ID> const& ids);
+
+  /// baseline may be NULL, the snapshot is then encoded in full
+  void encode(Snapshot const& snapshot, Snapshot const* baseline, std::vector<uint8_t> & out);
+
+  /// The sequence of the baseline a packet was encoded against, NO_BASELINE
+  /// when it was encoded in full. Used to look up the baseline for decode().
+  enum { NO_BASELINE = 0xffffffff };
+  uint32_t baselineOf(const uint8_t * data, uint32_t size);
+
+  /// Returns false when the data is truncated or does not match the baseline
+  bool decode(const uint8_t * data, uint32_t size, Snapshot const* baseline, Snapshot & snapshot);
+
+  /// Replaces the units of every player with the ones in snapshot
+  void apply(Snapshot const& snapshot);
+
+}
@@ -0,0 +1,321 @@
+#include "spatial.h"
+#include "util.h"
+#include "tcl.h"
+
+#include <cmath>
+
+namespace spatial
+{
+  namespace {
+    float _cellSize = 4.0f;
+    float _invCellSize = 0.25f;
+
+    float _minX = 0.0f;
+    float _minZ = 0.0f;
+    uint32_t _gridWidth = 0;
+    uint32_t _gridHeight = 0;
+
+    // _cellStart[c] .. _cellStart[c + 1] is the range of _entries in cell c
+    std::vector<uint32_t> _cellStart;
+    std::vector<uint32_t> _cellOf;
+    std::vector<Entry> _entries;
+  }
+
+  static inline uint32_t clampCell(int32_t value, uint32_t size)
+  {
+    return value < 0 ? 0 : (value >= (int32_t)size ? size - 1 : value);
+  }
+
+  static inline uint32_t cellX(float x)
+  {
+    return clampCell((int32_t)std::floor((x - _minX) * _invCellSize), _gridWidth);
+  }
+
+  static inline uint32_t cellZ(float z)
+  {
+    return clampCell((int32_t)std::floor((z - _minZ) * _invCellSize), _gridHeight);
+  }
+
+  void setCellSize(float size)
+  {
+    if (size <= 0.0f)
+      return;
+
+    _cellSize = size;
+    _invCellSize = 1.0f / size;
+  }
+
+  float cellSize()
+  {
+    return _cellSize;
+  }
+
+  void build(StorageVector const& storages, float minX, float minZ, uint32_t width, uint32_t height)
+  {
+    _minX = minX;
+    _minZ = minZ;
+    _gridWidth = (uint32_t)std::ceil(width * _invCellSize);
+    _gridHeight = (uint32_t)std::ceil(height * _invCellSize);
+    if (_gridWidth == 0) _gridWidth = 1;
+    if (_gridHeight == 0) _gridHeight = 1;
+
+    const uint32_t cellCount = _gridWidth * _gridHeight;
+
+    uint32_t total = 0;
+    for (StorageVector::const_iterator it = storages.begin(), end = storages.end(); it != end; ++it)
+      total += (*it)->count;
+
+    // resize() only allocates when the grid or unit count grows past its peak
+    _cellStart.assign(cellCount + 1, 0);
+    _cellOf.resize(total);
+    _entries.resize(total);
+
+    // Count units per cell, shifted by one so the prefix sum yields start offsets
+    uint32_t n = 0;
+    for (StorageVector::const_iterator it = storages.begin(), end = storages.end(); it != end; ++it)
+    {
+      const unit::Storage & storage = **it;
+      for (uint32_t i = 0; i < storage.count; ++i, ++n)
+      {
+        const uint32_t cell = cellZ(storage.z[i]) * _gridWidth + cellX(storage.x[i]);
+        _cellOf[n] = cell;
+        ++_cellStart[cell + 1];
+      }
+    }
+
+    for (uint32_t c = 0; c < cellCount; ++c)
+      _cellStart[c + 1] += _cellStart[c];
+
+    // Scatter, using the start of the next cell as a cursor that we rewind afterwards
+    n = 0;
+    for (StorageVector::const_iterator it = storages.begin(), end = storages.end(); it != end; ++it)
+    {
+      const unit::Storage & storage = **it;
+      for (uint32_t i = 0; i < storage.count; ++i, ++n)
+      {
+        Entry & entry = _entries[_cellStart[_cellOf[n]]++];
+        entry.x = storage.x[i];
+        entry.z = storage.z[i];
+        entry.id = storage.ids[i];
+        entry.owner = storage.registryIndex;
+      }
+    }
+
+    for (uint32_t c = cellCount; c > 0; --c)
+      _cellStart[c] = _cellStart[c - 1];
+    _cellStart[0] = 0;
+  }
+
+  template <typename T>
+  static inline void write(T * results, uint32_t index, Entry const& entry);
+
+  template <>
+  inline void write<unit::ID>(unit::ID * results, uint32_t index, Entry const& entry)
+  {
+    results[index] = entry.id;
+  }
+
+  template <>
+  inline void write<Entry>(Entry * results, uint32_t index, Entry const& entry)
+  {
+    results[index] = entry;
+  }
+
+  template <typename T>
+  static uint32_t radiusImpl(float x, float z, float radius, T * results, uint32_t maxResults)
+  {
+    if (_entries.empty())
+      return 0;
+
+    const uint32_t x0 = cellX(x - radius), x1 = cellX(x + radius);
+    const uint32_t z0 = cellZ(z - radius), z1 = cellZ(z + radius);
+    const float radiusSq = radius * radius;
+
+    uint32_t found = 0;
+    for (uint32_t cz = z0; cz <= z1; ++cz)
+      for (uint32_t cx = x0; cx <= x1; ++cx)
+      {
+        const uint32_t cell = cz * _gridWidth + cx;
+        for (uint32_t i = _cellStart[cell], end = _cellStart[cell + 1]; i < end; ++i)
+        {
+          const Entry & entry = _entries[i];
+          const float dx = entry.x - x;
+          const float dz = entry.z - z;
+
+          if (dx * dx + dz * dz <= radiusSq)
+          {
+            if (found == maxResults)
+              return found;
+            write(results, found++, entry);
+          }
+        }
+      }
+
+    return found;
+  }
+
+  uint32_t queryRadius(float x, float z, float radius, unit::ID * results, uint32_t maxResults)
+  {
+    return radiusImpl(x, z, radius, results, maxResults);
+  }
+
+  uint32_t queryRadius(float x, float z, float radius, Entry * results, uint32_t maxResults)
+  {
+    return radiusImpl(x, z, radius, results, maxResults);
+  }
+
+  uint32_t queryBox(float minX, float minZ, float maxX, float maxZ, unit::ID * results, uint32_t maxResults)
+  {
+    if (_entries.empty())
+      return 0;
+
+    const uint32_t x0 = cellX(minX), x1 = cellX(maxX);
+    const uint32_t z0 = cellZ(minZ), z1 = cellZ(maxZ);
+
+    uint32_t found = 0;
+    for (uint32_t cz = z0; cz <= z1; ++cz)
+      for (uint32_t cx = x0; cx <= x1; ++cx)
+      {
+        const uint32_t cell = cz * _gridWidth + cx;
+        for (uint32_t i = _cellStart[cell], end = _cellStart[cell + 1]; i < end; ++i)
+        {
+          const Entry & entry = _entries[i];
+          if (entry.x >= minX && entry.x <= maxX && entry.z >= minZ && entry.z <= maxZ)
+          {
+            if (found == maxResults)
+              return found;
+            results[found++] = entry.id;
+          }
+        }
+      }
+
+    return found;
+  }
+
+  static inline void visitNearest(uint32_t cell, float x, float z, uint32_t excludeOwner,
+                                  float & bestSq, Entry * result, bool & found,
+                                  uint32_t & visited, uint32_t maxVisited)
+  {
+    for (uint32_t i = _cellStart[cell], end = _cellStart[cell + 1]; i < end && visited < maxVisited; ++i)
+    {
+      // Friendly entries are skipped without counting, a unit inside its
+      // own army still reaches the enemies around it
+      const Entry & entry = _entries[i];
+      if (entry.owner == excludeOwner)
+        continue;
+
+      ++visited;
+
+      const float dx = entry.x - x;
+      const float dz = entry.z - z;
+      const float distSq = dx * dx + dz * dz;
+
+      if (distSq < bestSq || (!found && distSq == bestSq))
+      {
+        bestSq = distSq;
+        *result = entry;
+        found = true;
+      }
+    }
+  }
+
+  bool queryNearest(float x, float z, float radius, uint32_t excludeOwner, uint32_t maxVisited, Entry * result)
+  {
+    if (_entries.empty())
+      return false;
+
+    const int32_t centerX = cellX(x), centerZ = cellZ(z);
+    const int32_t w = _gridWidth, h = _gridHeight;
+
+    float bestSq = radius * radius;
+    bool found = false;
+    uint32_t visited = 0;
+
+    // Rings of cells around the center, anything in ring r + 1 is at least
+    // r cells away
+    for (int32_t r = 0; ; ++r)
+    {
+      for (int32_t cz = centerZ - r; cz <= centerZ + r; ++cz)
+      {
+        if (cz < 0 || cz >= h)
+          continue;
+
+        // Only the first and last row of the ring are full rows
+        const int32_t step = (cz == centerZ - r || cz == centerZ + r) ? 1 : 2 * r;
+        for (int32_t cx = centerX - r; cx <= centerX + r; cx += step)
+          if (cx >= 0 && cx < w)
+            visitNearest(cz * w + cx, x, z, excludeOwner, bestSq, result, found, visited, maxVisited);
+      }
+
+      const float reached = r * _cellSize;
+      if (reached * reached >= bestSq || visited >= maxVisited)
+        break;
+      if (r > w && r > h)
+        break;
+    }
+
+    return found;
+  }
+
+  void save(std::vector<uint8_t> & out)
+  {
+    const uint32_t starts = _cellStart.size();
+    const uint32_t count = _entries.size();
+
+    util::append(out, _cellSize);
+    util::append(out, _minX);
+    util::append(out, _minZ);
+    util::append(out, _gridWidth);
+    util::append(out, _gridHeight);
+    util::append(out, starts);
+    util::append(out, count);
+
+    if (starts > 0)
+      util::append(out, &_cellStart[0], sizeof(uint32_t) * starts);
+    if (count > 0)
+      util::append(out, &_entries[0], sizeof(Entry) * count);
+  }
+
+  bool load(util::Reader & reader)
+  {
+    float size = 0.0f, minX = 0.0f, minZ = 0.0f;
+    uint32_t gridWidth = 0, gridHeight = 0, starts = 0, count = 0;
+
+    if (!reader.read(size) || !reader.read(minX) || !reader.read(minZ) ||
+        !reader.read(gridWidth) || !reader.read(gridHeight) ||
+        !reader.read(starts) || !reader.read(count))
+      return false;
+
+    const size_t bytes = sizeof(uint32_t) * starts + sizeof(Entry) * count;
+    if ((size_t)(reader.end - reader.cursor) < bytes)
+    {
+      reader.failed = true;
+      return false;
+    }
+
+    // Saved before the first build, or with another cell size
+    if (size != _cellSize || starts != gridWidth * gridHeight + 1)
+    {
+      reader.cursor += bytes;
+      return false;
+    }
+
+    _minX = minX;
+    _minZ = minZ;
+    _gridWidth = gridWidth;
+    _gridHeight = gridHeight;
+    _cellStart.resize(starts);
+    _entries.resize(count);
+
+    reader.read(&_cellStart[0], sizeof(uint32_t) * starts);
+    if (count > 0)
+      reader.read(&_entries[0], sizeof(Entry) * count);
+
+    return true;
+  }
+
+  // -- Tcl Bindings --
+
+  PROC("spatial:cellSize", setCellSize);
+
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "unit.h"
+
+#include <vector>
+
+namespace util { struct Reader; }
+
+/// Uniform grid over all unit positions, rebuilt from scratch every tick with
+/// a counting sort so units sharing a grid cell are stored next to each other.
+namespace spatial
+{
+
+  struct Entry
+  {
+    float x, z;
+    unit::ID id;
+    uint32_t owner; // unit::Storage::registryIndex of the owning storage
+  };
+
+  typedef std::vector<unit::Storage *> StorageVector;
+
+  /// Size of a grid cell in world units, takes effect on the next build()
+  void setCellSize(float size);
+  float cellSize();
+
+  /// Rebuilds the grid from all units in storages. The grid covers the world
+  /// rectangle starting at (minX, minZ) of width x height world units.
+  void build(StorageVector const& storages, float minX, float minZ, uint32_t width, uint32_t height);
+
+  /// Writes up to maxResults handles of units within radius of (x, z) to
+  /// results and returns how many were written.
+  uint32_t queryRadius(float x, float z, float radius, unit::ID * results, uint32_t maxResults);
+
+  /// Writes up to maxResults handles of units inside the box to results and
+  /// returns how many were written.
+  uint32_t queryBox(float minX, float minZ, float maxX, float maxZ, unit::ID * results, uint32_t maxResults);
+
+  /// Same as queryRadius() but returns the full entries
+  uint32_t queryRadius(float x, float z, float radius, Entry * results, uint32_t maxResults);
+
+  /// Finds the closest unit within radius of (x, z) not owned by the storage
+  /// with registry index excludeOwner. Searches outwards from the cell of
+  /// (x, z) and gives up on farther cells once maxVisited candidates, units
+  /// not owned by excludeOwner, were looked at, so enemy crowds cost the same
+  /// as open ground. Ties go to the unit found first.
+  bool queryNearest(float x, float z, float radius, uint32_t excludeOwner, uint32_t maxVisited, Entry * result);
+
+  /// The grid from the last build(), part of the state written by
+  /// sim::save() so a restore does not have to sort every unit again. load()
+  /// fails when the cell size changed since, the grid must be rebuilt then.
+  void save(std::vector<uint8_t> & out);
+  bool load(util::Reader & reader);
+
+}
@@ -1,5 +1,4 @@
 
-#include "config.h"
 #include "tcl.h"
 #include "util.h"
 
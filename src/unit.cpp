@@ -1,24 +1,586 @@
-
 #include "unit.h"
-#include "gfx.h"
-#include "gfxe.h"
+#include "util.h"
+#include "tcl.h"
+
+#include <memory.h>
+#include <vector>
 
 namespace unit
 {
-  struct Unit
+  struct Slot
   {
-    float x, y;
+    uint32_t generation;
+    uint32_t storage;  // Index into _storages, NO_STORAGE when the slot is free
+    uint32_t dense;    // Index inside the storage, or the next free slot
   };
 
+  typedef std::vector<Slot> SlotVector;
+  typedef std::vector<Storage *> StorageVector;
+
+  namespace {
+    const uint32_t FLOAT_STREAM_COUNT = 9;
+
+    // Position and velocity, the previous position is derived from them
+    const uint32_t KEYFRAME_STREAM_COUNT = 6;
+
+    const uint32_t MIN_CAPACITY = 64;
+    const uint32_t NO_STORAGE = 0xffffffff;
+    const uint32_t NO_SLOT = 0xffffffff;
+
+    SlotVector _slots;
+    StorageVector _storages;
 
-  ID spawn()
+    // Free slots are kept in a FIFO so a slot rests as long as possible
+    // before reuse, which keeps generation wrap-around far away.
+    uint32_t _freeHead = NO_SLOT;
+    uint32_t _freeTail = NO_SLOT;
+    uint32_t _liveCount = 0;
+  }
+
+  static void pushFree(uint32_t slotIndex)
   {
-    return 0;
+    Slot & slot = _slots[slotIndex];
+    slot.storage = NO_STORAGE;
+    slot.dense = NO_SLOT;
+
+    if (_freeTail == NO_SLOT)
+      _freeHead = slotIndex;
+    else
+      _slots[_freeTail].dense = slotIndex;
+
+    _freeTail = slotIndex;
+  }
+
+  /// Returns NO_SLOT once every slot an ID can address is in use
+  static uint32_t popFree()
+  {
+    if (_freeHead == NO_SLOT)
+    {
+      // A larger index would spill into the generation bits
+      if (_slots.size() > INDEX_MASK)
+        return NO_SLOT;
+
+      // Slot 0 is never handed out, so INVALID_ID can never be a live handle
+      if (_slots.empty())
+      {
+        Slot reserved = { 0, NO_STORAGE, NO_SLOT };
+        _slots.push_back(reserved);
+      }
+
+      Slot slot = { 1, NO_STORAGE, NO_SLOT };
+      _slots.push_back(slot);
+      return _slots.size() - 1;
+    }
+
+    const uint32_t slotIndex = _freeHead;
+    _freeHead = _slots[slotIndex].dense;
+    if (_freeHead == NO_SLOT)
+      _freeTail = NO_SLOT;
+
+    return slotIndex;
+  }
+
+  static Slot * lookup(ID id)
+  {
+    const uint32_t slotIndex = index(id);
+    if (slotIndex == 0 || slotIndex >= _slots.size())
+      return NULL;
+
+    Slot & slot = _slots[slotIndex];
+    if (slot.storage == NO_STORAGE || slot.generation != generation(id))
+      return NULL;
+
+    return &slot;
+  }
+
+  // -- Storage --
+
+  Storage::Storage()
+    : x(NULL), y(NULL), z(NULL),
+      vx(NULL), vy(NULL), vz(NULL),
+      prevX(NULL), prevY(NULL), prevZ(NULL),
+      ids(NULL),
+      cell(NULL),
+      stateHash(0),
+      count(0),
+      capacity(0),
+      registryIndex(_storages.size())
+  {
+    _storages.push_back(this);
+  }
+
+  Storage::Storage(Storage && other)
+    : x(other.x), y(other.y), z(other.z),
+      vx(other.vx), vy(other.vy), vz(other.vz),
+      prevX(other.prevX), prevY(other.prevY), prevZ(other.prevZ),
+      ids(other.ids),
+      cell(other.cell),
+      stateHash(other.stateHash),
+      count(other.count),
+      capacity(other.capacity),
+      registryIndex(other.registryIndex)
+  {
+    _storages[registryIndex] = this;
+
+    other.x = other.y = other.z = NULL;
+    other.vx = other.vy = other.vz = NULL;
+    other.prevX = other.prevY = other.prevZ = NULL;
+    other.ids = NULL;
+    other.cell = NULL;
+    other.stateHash = 0;
+    other.count = 0;
+    other.capacity = 0;
+    other.registryIndex = NO_STORAGE;
+  }
+
+  Storage::~Storage()
+  {
+    // Moved from, the registry belongs to someone else now
+    if (registryIndex == NO_STORAGE)
+      return;
+
+    clear();
+    _storages[registryIndex] = NULL;
+
+    while (!_storages.empty() && _storages.back() == NULL)
+      _storages.pop_back();
+
+    util::alignedFree(x);
+  }
+
+  void Storage::reserve(uint32_t newCapacity)
+  {
+    if (newCapacity <= capacity)
+      return;
+
+    newCapacity = (newCapacity + STORAGE_PADDING - 1) & ~(STORAGE_PADDING - 1);
+
+    // All streams live in a single block, one after the other, the integer streams last
+    const size_t blockSize = (sizeof(float) * FLOAT_STREAM_COUNT + sizeof(ID) + sizeof(uint32_t)) * newCapacity;
+    uint8_t * block = (uint8_t *)util::alignedAlloc(blockSize, 32);
+    memset(block, 0, blockSize);
+
+    float * oldBlock = x;
+    float ** streams[FLOAT_STREAM_COUNT] = { &x, &y, &z, &vx, &vy, &vz, &prevX, &prevY, &prevZ };
+    for (uint32_t i = 0; i < FLOAT_STREAM_COUNT; ++i)
+    {
+      float * stream = (float *)block + newCapacity * i;
+      if (count > 0)
+        memcpy(stream, *streams[i], sizeof(float) * count);
+      *streams[i] = stream;
+    }
+
+    ID * newIds = (ID *)(block + sizeof(float) * FLOAT_STREAM_COUNT * newCapacity);
+    if (count > 0)
+      memcpy(newIds, ids, sizeof(ID) * count);
+    ids = newIds;
+
+    uint32_t * newCell = (uint32_t *)(newIds + newCapacity);
+    if (count > 0)
+      memcpy(newCell, cell, sizeof(uint32_t) * count);
+    cell = newCell;
+
+    util::alignedFree(oldBlock);
+    capacity = newCapacity;
+  }
+
+  void Storage::clear()
+  {
+    for (uint32_t i = 0; i < count; ++i)
+    {
+      Slot & slot = _slots[index(ids[i])];
+      slot.generation = (slot.generation + 1) & GENERATION_MASK;
+      pushFree(index(ids[i]));
+    }
+
+    _liveCount -= count;
+    count = 0;
+    stateHash = 0;
+  }
+
+  void Storage::save(std::vector<uint8_t> & out) const
+  {
+    util::append(out, registryIndex);
+    util::append(out, count);
+    util::append(out, stateHash);
+
+    const float * streams[FLOAT_STREAM_COUNT] = { x, y, z, vx, vy, vz, prevX, prevY, prevZ };
+    for (uint32_t i = 0; i < FLOAT_STREAM_COUNT; ++i)
+      util::append(out, streams[i], sizeof(float) * count);
+
+    util::append(out, ids, sizeof(ID) * count);
+    util::append(out, cell, sizeof(uint32_t) * count);
+  }
+
+  bool Storage::load(util::Reader & reader)
+  {
+    uint32_t savedIndex = 0, newCount = 0;
+    uint64_t savedHash = 0;
+    if (!reader.read(savedIndex) || !reader.read(newCount) || !reader.read(savedHash))
+      return false;
+
+    if ((size_t)(reader.end - reader.cursor) < (sizeof(float) * FLOAT_STREAM_COUNT + sizeof(ID) + sizeof(uint32_t)) * newCount)
+    {
+      reader.failed = true;
+      return false;
+    }
+
+    // The registry was loaded already, the old units must not touch it
+    count = 0;
+    reserve(newCount);
+
+    float * streams[FLOAT_STREAM_COUNT] = { x, y, z, vx, vy, vz, prevX, prevY, prevZ };
+    for (uint32_t i = 0; i < FLOAT_STREAM_COUNT; ++i)
+      reader.read(streams[i], sizeof(float) * newCount);
+
+    reader.read(ids, sizeof(ID) * newCount);
+    reader.read(cell, sizeof(uint32_t) * newCount);
+    count = newCount;
+    stateHash = savedHash;
+
+    // The slots already point here unless the storages were created in a
+    // different order than when saving
+    if (savedIndex == registryIndex)
+      return true;
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+      const uint32_t slotIndex = index(ids[i]);
+      if (slotIndex >= _slots.size())
+      {
+        reader.failed = true;
+        return false;
+      }
+
+      _slots[slotIndex].storage = registryIndex;
+    }
+
+    // The saved hash is keyed on the old registry index
+    stateHash = hash(*this, 0, count);
+    return true;
+  }
+
+  void Storage::saveKeyframe(std::vector<uint8_t> & out) const
+  {
+    util::append(out, count);
+
+    const float * streams[KEYFRAME_STREAM_COUNT] = { x, y, z, vx, vy, vz };
+    for (uint32_t i = 0; i < KEYFRAME_STREAM_COUNT; ++i)
+      util::appendPlanes(out, streams[i], count, sizeof(float));
+
+    util::appendPlanes(out, ids, count, sizeof(ID));
+  }
+
+  bool Storage::loadKeyframe(util::Reader & reader)
+  {
+    uint32_t newCount = 0;
+    if (!reader.read(newCount))
+      return false;
+
+    if ((size_t)(reader.end - reader.cursor) < (sizeof(float) * KEYFRAME_STREAM_COUNT + sizeof(ID)) * newCount)
+    {
+      reader.failed = true;
+      return false;
+    }
+
+    // The registry was loaded already, the old units must not touch it
+    count = 0;
+    reserve(newCount);
+
+    float * streams[KEYFRAME_STREAM_COUNT] = { x, y, z, vx, vy, vz };
+    for (uint32_t i = 0; i < KEYFRAME_STREAM_COUNT; ++i)
+      reader.readPlanes(streams[i], newCount, sizeof(float));
+
+    reader.readPlanes(ids, newCount, sizeof(ID));
+    count = newCount;
+
+    if (count > 0)
+    {
+      memcpy(prevX, x, sizeof(float) * count);
+      memcpy(prevY, y, sizeof(float) * count);
+      memcpy(prevZ, z, sizeof(float) * count);
+    }
+
+    stateHash = hash(*this, 0, count);
+
+    // The keyframe registry only knows which slots are live, where each
+    // unit is comes from here
+    for (uint32_t i = 0; i < count; ++i)
+    {
+      const uint32_t slotIndex = index(ids[i]);
+      if (slotIndex >= _slots.size())
+      {
+        reader.failed = true;
+        return false;
+      }
+
+      _slots[slotIndex].storage = registryIndex;
+      _slots[slotIndex].dense = i;
+    }
+
+    return true;
+  }
+
+  // -- API --
+
+  void reserve(uint32_t units)
+  {
+    _slots.reserve(units + 1);
+  }
+
+  ID spawn(Storage & storage)
+  {
+    const uint32_t slotIndex = popFree();
+    if (slotIndex == NO_SLOT)
+      return INVALID_ID;
+
+    if (storage.count == storage.capacity)
+      storage.reserve(storage.capacity < MIN_CAPACITY ? MIN_CAPACITY : storage.capacity * 2);
+
+    Slot & slot = _slots[slotIndex];
+
+    // Generation 0 is skipped so that slot 0 generation 0 stays INVALID_ID
+    if (slot.generation == 0)
+      slot.generation = 1;
+
+    const uint32_t i = storage.count++;
+    slot.storage = storage.registryIndex;
+    slot.dense = i;
+
+    const ID id = (slot.generation << INDEX_BITS) | slotIndex;
+
+    storage.x[i] = storage.y[i] = storage.z[i] = 0.0f;
+    storage.vx[i] = storage.vy[i] = storage.vz[i] = 0.0f;
+    storage.prevX[i] = storage.prevY[i] = storage.prevZ[i] = 0.0f;
+    storage.ids[i] = id;
+    storage.cell[i] = 0;
+    storage.stateHash ^= hash(storage, i, i + 1);
+
+    ++_liveCount;
+    return id;
   }
 
   void kill(ID id)
   {
+    Slot * slot = lookup(id);
+    if (!slot)
+      return;
+
+    Storage & storage = *_storages[slot->storage];
+    const uint32_t i = slot->dense;
+    storage.stateHash ^= hash(storage, i, i + 1);
+
+    const uint32_t last = --storage.count;
+
+    if (i != last)
+    {
+      storage.x[i] = storage.x[last];
+      storage.y[i] = storage.y[last];
+      storage.z[i] = storage.z[last];
+      storage.vx[i] = storage.vx[last];
+      storage.vy[i] = storage.vy[last];
+      storage.vz[i] = storage.vz[last];
+      storage.prevX[i] = storage.prevX[last];
+      storage.prevY[i] = storage.prevY[last];
+      storage.prevZ[i] = storage.prevZ[last];
+      storage.ids[i] = storage.ids[last];
+      storage.cell[i] = storage.cell[last];
+
+      _slots[index(storage.ids[i])].dense = i;
+    }
+
+    slot->generation = (slot->generation + 1) & GENERATION_MASK;
+    pushFree(index(id));
+    --_liveCount;
+  }
+
+  bool alive(ID id)
+  {
+    return lookup(id) != NULL;
+  }
+
+  Storage * find(ID id, uint32_t * indexInStorage)
+  {
+    Slot * slot = lookup(id);
+    if (!slot)
+      return NULL;
+
+    if (indexInStorage)
+      *indexInStorage = slot->dense;
+
+    return _storages[slot->storage];
+  }
+
+  uint32_t count()
+  {
+    return _liveCount;
+  }
+
+  void saveRegistry(std::vector<uint8_t> & out)
+  {
+    const uint32_t slotCount = _slots.size();
+    util::append(out, slotCount);
+    util::append(out, _freeHead);
+    util::append(out, _freeTail);
+    util::append(out, _liveCount);
+
+    // Slots only hold indices, so they are copied as they are
+    if (slotCount > 0)
+      util::append(out, &_slots[0], sizeof(Slot) * slotCount);
+  }
+
+  bool loadRegistry(util::Reader & reader)
+  {
+    uint32_t slotCount = 0;
+    if (!reader.read(slotCount) || (size_t)(reader.end - reader.cursor) < sizeof(uint32_t) * 3 + sizeof(Slot) * slotCount)
+    {
+      reader.failed = true;
+      return false;
+    }
+
+    reader.read(_freeHead);
+    reader.read(_freeTail);
+    reader.read(_liveCount);
+
+    _slots.resize(slotCount);
+    if (slotCount > 0)
+      reader.read(&_slots[0], sizeof(Slot) * slotCount);
+
+    return true;
+  }
+
+  void saveRegistryKeyframe(std::vector<uint8_t> & out)
+  {
+    const uint32_t slotCount = _slots.size();
+    util::append(out, slotCount);
+    util::append(out, _liveCount);
+
+    // Generations fit 16 bits, the rest of a live slot is rebuilt from the
+    // storages
+    std::vector<uint16_t> generations(slotCount);
+    for (uint32_t i = 0; i < slotCount; ++i)
+      generations[i] = _slots[i].generation;
+
+    if (slotCount > 0)
+      util::appendPlanes(out, &generations[0], slotCount, sizeof(uint16_t));
+
+    // Free slots in the order they are handed out again
+    std::vector<uint32_t> freeSlots;
+    for (uint32_t slot = _freeHead; slot != NO_SLOT; slot = _slots[slot].dense)
+      freeSlots.push_back(slot);
+
+    const uint32_t freeCount = freeSlots.size();
+    util::append(out, freeCount);
+    if (freeCount > 0)
+      util::append(out, &freeSlots[0], sizeof(uint32_t) * freeCount);
+  }
+
+  bool loadRegistryKeyframe(util::Reader & reader)
+  {
+    uint32_t slotCount = 0, liveCount = 0;
+    if (!reader.read(slotCount) || !reader.read(liveCount) || slotCount > INDEX_MASK + 1 ||
+        (size_t)(reader.end - reader.cursor) < sizeof(uint16_t) * slotCount)
+    {
+      reader.failed = true;
+      return false;
+    }
+
+    std::vector<uint16_t> generations(slotCount);
+    if (slotCount > 0)
+      reader.readPlanes(&generations[0], slotCount, sizeof(uint16_t));
+
+    _slots.resize(slotCount);
+    for (uint32_t i = 0; i < slotCount; ++i)
+    {
+      _slots[i].generation = generations[i];
+      _slots[i].storage = NO_STORAGE;
+      _slots[i].dense = NO_SLOT;
+    }
+
+    uint32_t freeCount = 0;
+    if (!reader.read(freeCount) || freeCount > slotCount)
+    {
+      reader.failed = true;
+      return false;
+    }
+
+    _freeHead = _freeTail = NO_SLOT;
+    for (uint32_t i = 0; i < freeCount; ++i)
+    {
+      uint32_t slot = 0;
+      if (!reader.read(slot) || slot == 0 || slot >= slotCount)
+      {
+        reader.failed = true;
+        return false;
+      }
+
+      pushFree(slot);
+    }
+
+    _liveCount = liveCount;
+    return true;
+  }
+
+  static inline uint64_t bits(float a, float b)
+  {
+    uint32_t low, high;
+    memcpy(&low, &a, sizeof(low));
+    memcpy(&high, &b, sizeof(high));
+    return ((uint64_t)high << 32) | low;
+  }
+
+  // Bit for bit, 0.0 and -0.0 hash differently
+  static inline bool same(float a, float b)
+  {
+    return memcmp(&a, &b, sizeof(float)) == 0;
+  }
+
+  uint64_t hash(uint32_t registryIndex, ID id, float x, float y, float z, float vx, float vy, float vz)
+  {
+    const uint64_t key = ((uint64_t)registryIndex << 32) | id;
+    const uint64_t position = bits(x, z);
+    const uint64_t velocity = bits(vx, vz);
+    const uint64_t height = bits(y, vy);
+
+    // A single mix per unit, the multiplies keep the fields from cancelling
+    // each other out
+    const uint64_t motion = (velocity ^ ((height << 32) | (height >> 32))) * 0x9e3779b97f4a7c15ULL;
+    return util::mix64((key * 0xc2b2ae3d27d4eb4fULL) ^ position ^ motion);
+  }
+
+  uint64_t hash(Storage const& storage, uint32_t begin, uint32_t end)
+  {
+    uint64_t result = 0;
 
+    for (uint32_t i = begin; i < end; ++i)
+      result ^= hash(storage.registryIndex, storage.ids[i],
+                     storage.x[i], storage.y[i], storage.z[i],
+                     storage.vx[i], storage.vy[i], storage.vz[i]);
+
+    return result;
+  }
+
+  uint64_t setVelocity(Storage & storage, uint32_t i, float vx, float vz)
+  {
+    if (same(storage.vx[i], vx) && same(storage.vz[i], vz))
+      return 0;
+
+    const uint64_t before = hash(storage, i, i + 1);
+    storage.vx[i] = vx;
+    storage.vz[i] = vz;
+    return before ^ hash(storage, i, i + 1);
   }
 
-}
\ No newline at end of file
+  bool moved(Storage const& storage, uint32_t i)
+  {
+    return !same(storage.x[i], storage.prevX[i]) ||
+           !same(storage.y[i], storage.prevY[i]) ||
+           !same(storage.z[i], storage.prevZ[i]);
+  }
+
+  // -- Tcl Bindings --
+
+  PROC("unit:alive", alive);
+  PROC("unit:count", count);
+
+}
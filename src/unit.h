@@ -1,14 +1,158 @@
-
 #pragma once
 
 #include <stdint.h>
+#include <vector>
+
+namespace util { struct Reader; }
 
 namespace unit
 {
 
+  /// Generational handle, the low INDEX_BITS select a registry slot and the
+  /// remaining bits hold the slot generation at the time of spawn. A handle
+  /// goes stale as soon as its unit is killed, even if the slot is reused.
   typedef uint32_t ID;
 
-  ID spawn();
+  enum
+  {
+    INDEX_BITS = 20,
+    INDEX_MASK = (1 << INDEX_BITS) - 1,
+    GENERATION_BITS = 32 - INDEX_BITS,
+    GENERATION_MASK = (1 << GENERATION_BITS) - 1
+  };
+
+  /// Never returned by spawn()
+  const ID INVALID_ID = 0;
+
+  inline uint32_t index(ID id) { return id & INDEX_MASK; }
+  inline uint32_t generation(ID id) { return id >> INDEX_BITS; }
+
+  /// Structure-of-arrays unit storage. Live units are kept densely packed in
+  /// [0, count) so loops only ever touch live data. Every array is 32 byte
+  /// aligned and capacity is a multiple of STORAGE_PADDING, which lets SIMD
+  /// kernels process whole vectors past count without a scalar tail.
+  ///
+  /// Units are created and destroyed through spawn() and kill(), which keep
+  /// the handle registry in sync when units move around inside the arrays.
+  struct Storage
+  {
+    enum { STORAGE_PADDING = 8 };
+
+    Storage();
+    ~Storage();
+
+    /// Takes over the units of other, so players can live in a vector
+    Storage(Storage && other);
+
+    void reserve(uint32_t capacity);
+
+    /// Kills all units in the storage
+    void clear();
+
+    /// Writes the live units. load() must run after unit::loadRegistry(), the
+    /// registry slots only need relinking when the storage was saved from a
+    /// different registry index.
+    void save(std::vector<uint8_t> & out) const;
+    bool load(util::Reader & reader);
+
+    /// Compact version of save() for replay keyframes, only handles,
+    /// positions and velocities are written. Loading starts the previous
+    /// positions at the current ones and hashes the units again, the cell
+    /// stream is left for the caller to fill in.
+    void saveKeyframe(std::vector<uint8_t> & out) const;
+    bool loadKeyframe(util::Reader & reader);
+
+    float * x;
+    float * y;
+    float * z;
+
+    float * vx;
+    float * vy;
+    float * vz;
+
+    // Position at the start of the last tick, used for render interpolation
+    float * prevX;
+    float * prevY;
+    float * prevZ;
+
+    // Handle of the unit stored at each index
+    ID * ids;
+
+    // World cell the unit is in, written by integrate()
+    uint32_t * cell;
+
+    // XOR of hash() over the live units. spawn() and kill() keep it up to
+    // date, everything else that changes a position or velocity has to fold
+    // the change in as well, see setVelocity().
+    uint64_t stateHash;
+
+    uint32_t count;
+    uint32_t capacity;
+
+    // Index of this storage in the registry
+    uint32_t registryIndex;
+
+  private:
+    Storage(Storage const&);
+    Storage & operator = (Storage const&);
+  };
+
+  /// Reserves registry slots up front so spawning never allocates
+  void reserve(uint32_t units);
+
+  /// Adds a zeroed unit to storage and returns its handle, or INVALID_ID
+  /// when all 2^INDEX_BITS registry slots are taken
+  ID spawn(Storage & storage);
+
+  /// Removes the unit, the last unit in its storage takes its place.
+  /// Killing a stale handle does nothing.
   void kill(ID id);
 
-}
\ No newline at end of file
+  bool alive(ID id);
+
+  /// Returns the storage holding the unit and its current index in it, or
+  /// NULL if the handle is stale.
+  Storage * find(ID id, uint32_t * indexInStorage);
+
+  /// Number of live units over all storages
+  uint32_t count();
+
+  /// The registry slots as they are, so handles stay valid across a save and
+  /// load. The units themselves are saved with their storage.
+  void saveRegistry(std::vector<uint8_t> & out);
+  bool loadRegistry(util::Reader & reader);
+
+  /// Compact version for replay keyframes, only the generations and the free
+  /// list. Storage::loadKeyframe() links the live slots to their units.
+  void saveRegistryKeyframe(std::vector<uint8_t> & out);
+  bool loadRegistryKeyframe(util::Reader & reader);
+
+  /// XOR of the hashes of units [begin, end), covering handle, position and
+  /// velocity. Being a XOR, ranges can be hashed in parallel and combined in
+  /// any order, and a single unit can be added or removed later on.
+  uint64_t hash(Storage const& storage, uint32_t begin, uint32_t end);
+
+  /// Hash of a single unit of the storage at registryIndex from its fields,
+  /// for units whose old state is no longer in the storage
+  uint64_t hash(uint32_t registryIndex, ID id, float x, float y, float z, float vx, float vy, float vz);
+
+  /// Sets the velocity of unit i in the ground plane and returns the change
+  /// to its hash, zero when the velocity stays the same bit for bit. The
+  /// caller folds it into stateHash, so ranges can be steered in parallel.
+  uint64_t setVelocity(Storage & storage, uint32_t i, float vx, float vz);
+
+  /// Whether the last integrate() changed the position of unit i
+  bool moved(Storage const& storage, uint32_t i);
+
+  /// Moves every unit in storage by its velocity, clamps it to the world
+  /// rectangle starting at (minX, minZ) spanning width x height cells and
+  /// writes the index of the cell it ends up in. The previous position is
+  /// saved for interpolation in the same pass. Implemented with SSE2, or AVX2
+  /// when built with USE_AVX2.
+  void integrate(Storage & storage, float dt, float minX, float minZ, uint32_t width, uint32_t height);
+
+  /// Same as above for units [begin, end) only, begin must be a multiple of
+  /// STORAGE_PADDING so ranges can be integrated in parallel.
+  void integrate(Storage & storage, uint32_t begin, uint32_t end, float dt, float minX, float minZ, uint32_t width, uint32_t height);
+
+}
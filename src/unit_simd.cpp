@@ -0,0 +1,120 @@
+#include "unit.h"
+
+#include <emmintrin.h>
+#if defined(__AVX2__)
+  #include <immintrin.h>
+#endif
+
+namespace unit
+{
+
+  // Storage capacity is always a multiple of STORAGE_PADDING and every stream
+  // is 32 byte aligned, so the kernels below run whole vectors straight past
+  // count into the padding and never need a scalar tail.
+
+#if defined(__AVX2__)
+
+  void integrate(Storage & storage, uint32_t begin, uint32_t end, float dt, float minX, float minZ, uint32_t width, uint32_t height)
+  {
+    if (begin >= end || width == 0 || height == 0)
+      return;
+
+    const __m256 step = _mm256_set1_ps(dt);
+    const __m256 lowX = _mm256_set1_ps(minX);
+    const __m256 lowZ = _mm256_set1_ps(minZ);
+
+    // Keep units strictly inside the last cell so the truncation below never
+    // produces an index of width or height.
+    const __m256 highX = _mm256_set1_ps(minX + width - 0.001f);
+    const __m256 highZ = _mm256_set1_ps(minZ + height - 0.001f);
+    const __m256i stride = _mm256_set1_epi32(width);
+
+    for (uint32_t i = begin; i < end; i += 8)
+    {
+      __m256 x = _mm256_load_ps(storage.x + i);
+      __m256 y = _mm256_load_ps(storage.y + i);
+      __m256 z = _mm256_load_ps(storage.z + i);
+
+      _mm256_store_ps(storage.prevX + i, x);
+      _mm256_store_ps(storage.prevY + i, y);
+      _mm256_store_ps(storage.prevZ + i, z);
+
+      x = _mm256_add_ps(x, _mm256_mul_ps(_mm256_load_ps(storage.vx + i), step));
+      y = _mm256_add_ps(y, _mm256_mul_ps(_mm256_load_ps(storage.vy + i), step));
+      z = _mm256_add_ps(z, _mm256_mul_ps(_mm256_load_ps(storage.vz + i), step));
+
+      x = _mm256_min_ps(_mm256_max_ps(x, lowX), highX);
+      z = _mm256_min_ps(_mm256_max_ps(z, lowZ), highZ);
+
+      _mm256_store_ps(storage.x + i, x);
+      _mm256_store_ps(storage.y + i, y);
+      _mm256_store_ps(storage.z + i, z);
+
+      // Both offsets are non-negative after clamping, so truncation is floor
+      const __m256i cellX = _mm256_cvttps_epi32(_mm256_sub_ps(x, lowX));
+      const __m256i cellZ = _mm256_cvttps_epi32(_mm256_sub_ps(z, lowZ));
+      const __m256i cell = _mm256_add_epi32(_mm256_mullo_epi32(cellZ, stride), cellX);
+
+      _mm256_store_si256((__m256i *)(storage.cell + i), cell);
+    }
+  }
+
+#else
+
+  void integrate(Storage & storage, uint32_t begin, uint32_t end, float dt, float minX, float minZ, uint32_t width, uint32_t height)
+  {
+    if (begin >= end || width == 0 || height == 0)
+      return;
+
+    const __m128 step = _mm_set1_ps(dt);
+    const __m128 lowX = _mm_set1_ps(minX);
+    const __m128 lowZ = _mm_set1_ps(minZ);
+
+    // Keep units strictly inside the last cell so the truncation below never
+    // produces an index of width or height.
+    const __m128 highX = _mm_set1_ps(minX + width - 0.001f);
+    const __m128 highZ = _mm_set1_ps(minZ + height - 0.001f);
+
+    // SSE2 has no 32 bit integer multiply, so the row offset is computed in
+    // float. That is exact as long as the world has less than 2^24 cells.
+    const __m128 stride = _mm_set1_ps((float)width);
+
+    for (uint32_t i = begin; i < end; i += 4)
+    {
+      __m128 x = _mm_load_ps(storage.x + i);
+      __m128 y = _mm_load_ps(storage.y + i);
+      __m128 z = _mm_load_ps(storage.z + i);
+
+      _mm_store_ps(storage.prevX + i, x);
+      _mm_store_ps(storage.prevY + i, y);
+      _mm_store_ps(storage.prevZ + i, z);
+
+      x = _mm_add_ps(x, _mm_mul_ps(_mm_load_ps(storage.vx + i), step));
+      y = _mm_add_ps(y, _mm_mul_ps(_mm_load_ps(storage.vy + i), step));
+      z = _mm_add_ps(z, _mm_mul_ps(_mm_load_ps(storage.vz + i), step));
+
+      x = _mm_min_ps(_mm_max_ps(x, lowX), highX);
+      z = _mm_min_ps(_mm_max_ps(z, lowZ), highZ);
+
+      _mm_store_ps(storage.x + i, x);
+      _mm_store_ps(storage.y + i, y);
+      _mm_store_ps(storage.z + i, z);
+
+      // Both offsets are non-negative after clamping, so truncation is floor
+      const __m128i cellX = _mm_cvttps_epi32(_mm_sub_ps(x, lowX));
+      const __m128i cellZ = _mm_cvttps_epi32(_mm_sub_ps(z, lowZ));
+      const __m128 row = _mm_mul_ps(_mm_cvtepi32_ps(cellZ), stride);
+      const __m128i cell = _mm_add_epi32(_mm_cvttps_epi32(row), cellX);
+
+      _mm_store_si128((__m128i *)(storage.cell + i), cell);
+    }
+  }
+
+#endif
+
+  void integrate(Storage & storage, float dt, float minX, float minZ, uint32_t width, uint32_t height)
+  {
+    integrate(storage, 0, storage.count, dt, minX, minZ, width, height);
+  }
+
+}
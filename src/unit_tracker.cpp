@@ -0,0 +1,47 @@
+#include "unit_tracker.h"
+
+namespace unit
+{
+
+  Tracker::Tracker() : update(0)
+  {
+  }
+
+  void Tracker::clear()
+  {
+    ids.clear();
+    ownerOf.clear();
+    cellOf.clear();
+    seen.clear();
+  }
+
+  void Tracker::begin()
+  {
+    // Stamps from before the wrap would look current again
+    if (++update == 0)
+    {
+      seen.assign(seen.size(), 0);
+      update = 1;
+    }
+  }
+
+  void Tracker::grow(uint32_t slot)
+  {
+    ids.resize(slot + 1, INVALID_ID);
+    ownerOf.resize(slot + 1, 0);
+    cellOf.resize(slot + 1, NO_CELL);
+    seen.resize(slot + 1, 0);
+  }
+
+  void Tracker::sweep(Dropped dropped)
+  {
+    for (uint32_t slot = 0; slot < ids.size(); ++slot)
+      if (cellOf[slot] != NO_CELL && seen[slot] != update)
+      {
+        dropped(slot, ownerOf[slot], cellOf[slot]);
+        cellOf[slot] = NO_CELL;
+        ids[slot] = INVALID_ID;
+      }
+  }
+
+}
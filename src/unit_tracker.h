@@ -0,0 +1,88 @@
+#pragma once
+
+#include "unit.h"
+
+#include <vector>
+
+namespace unit
+{
+
+  /// Remembers the cell and owning player of every unit between updates, by
+  /// registry slot, for modules that bucket units by cell. An update passes
+  /// every live unit to move(), which is a single compare for units that
+  /// stayed in their cell, and then calls sweep() to drop the ones that were
+  /// not passed since they died.
+  struct Tracker
+  {
+    enum { NO_CELL = 0xffffffff };
+
+    Tracker();
+
+    /// Forgets every unit
+    void clear();
+
+    /// Starts an update
+    void begin();
+
+    /// Records that unit id of player owner is in cell. Returns true when
+    /// it was somewhere else before, then from and fromOwner hold where it
+    /// was, from is NO_CELL for units not tracked yet.
+    bool move(ID id, uint32_t owner, uint32_t cell, uint32_t & from, uint32_t & fromOwner)
+    {
+      const uint32_t slot = index(id);
+      if (slot >= ids.size())
+        grow(slot);
+
+      seen[slot] = update;
+      if (ids[slot] == id && cellOf[slot] == cell)
+        return false;
+
+      // A new handle in the slot means the previous unit died, it still has
+      // to leave its cell
+      from = cellOf[slot];
+      fromOwner = ownerOf[slot];
+
+      ids[slot] = id;
+      ownerOf[slot] = owner;
+      cellOf[slot] = cell;
+      return true;
+    }
+
+    /// Called for every unit sweep() drops, with its registry slot and
+    /// where it was
+    typedef void (*Dropped)(uint32_t slot, uint32_t owner, uint32_t cell);
+
+    /// Ends an update, forgets the units move() was not called for since
+    /// begin()
+    void sweep(Dropped dropped);
+
+    /// Handle of the unit tracked in slot
+    ID id(uint32_t slot) const
+    {
+      return slot < ids.size() ? ids[slot] : INVALID_ID;
+    }
+
+    /// Cell and owner of the unit tracked in slot
+    uint32_t cell(uint32_t slot) const
+    {
+      return slot < cellOf.size() ? cellOf[slot] : (uint32_t)NO_CELL;
+    }
+
+    uint32_t owner(uint32_t slot) const
+    {
+      return slot < ownerOf.size() ? ownerOf[slot] : 0;
+    }
+
+  private:
+    void grow(uint32_t slot);
+
+    // Per registry slot: the handle being tracked, the player owning it, its
+    // cell and the last update it was seen in
+    std::vector<ID> ids;
+    std::vector<uint32_t> ownerOf;
+    std::vector<uint32_t> cellOf;
+    std::vector<uint32_t> seen;
+    uint32_t update;
+  };
+
+}
@@ -4,6 +4,10 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#if defined(WIN32) || defined(_WINDOWS)
+  #include <malloc.h>
+#endif
 
 namespace util
 {
@@ -34,4 +38,100 @@ namespace util
     return data;
   };
 
-}
\ No newline at end of file
+  void * alignedAlloc(size_t size, size_t alignment)
+  {
+    #if defined(WIN32) || defined(_WINDOWS)
+      return _aligned_malloc(size, alignment);
+    #else
+      void * ptr = NULL;
+      if (posix_memalign(&ptr, alignment, size) != 0)
+        return NULL;
+      return ptr;
+    #endif
+  }
+
+  void alignedFree(void * ptr)
+  {
+    #if defined(WIN32) || defined(_WINDOWS)
+      _aligned_free(ptr);
+    #else
+      free(ptr);
+    #endif
+  }
+
+  uint64_t hash64(const void * data, size_t size, uint64_t seed)
+  {
+    const uint8_t * bytes = (const uint8_t *)data;
+    uint64_t hash = mix64(seed ^ size);
+
+    for (; size >= 8; bytes += 8, size -= 8)
+    {
+      uint64_t word;
+      memcpy(&word, bytes, 8);
+      hash = mix64(hash ^ word);
+    }
+
+    if (size > 0)
+    {
+      uint64_t word = 0;
+      memcpy(&word, bytes, size);
+      hash = mix64(hash ^ word);
+    }
+
+    return hash;
+  }
+
+  void append(std::vector<uint8_t> & out, const void * data, size_t size)
+  {
+    const uint8_t * bytes = (const uint8_t *)data;
+    out.insert(out.end(), bytes, bytes + size);
+  }
+
+  void appendPlanes(std::vector<uint8_t> & out, const void * data, size_t count, size_t elementSize)
+  {
+    const uint8_t * bytes = (const uint8_t *)data;
+    size_t at = out.size();
+    out.resize(at + count * elementSize);
+
+    for (size_t b = 0; b < elementSize; ++b)
+      for (size_t i = 0; i < count; ++i)
+        out[at++] = bytes[i * elementSize + b];
+  }
+
+  Reader::Reader(const uint8_t * data, size_t size)
+    : cursor(data),
+      end(data + size),
+      failed(false)
+  {
+  }
+
+  bool Reader::read(void * out, size_t size)
+  {
+    if (failed || (size_t)(end - cursor) < size)
+    {
+      failed = true;
+      return false;
+    }
+
+    memcpy(out, cursor, size);
+    cursor += size;
+    return true;
+  }
+
+  bool Reader::readPlanes(void * out, size_t count, size_t elementSize)
+  {
+    if (failed || (size_t)(end - cursor) < count * elementSize)
+    {
+      failed = true;
+      return false;
+    }
+
+    uint8_t * bytes = (uint8_t *)out;
+    for (size_t b = 0; b < elementSize; ++b)
+      for (size_t i = 0; i < count; ++i)
+        bytes[i * elementSize + b] = *cursor++;
+
+    return true;
+  }
+
+}
@@ -2,11 +2,113 @@
 #pragma once
 
 #include <string>
+#include <vector>
 #include <stdint.h>
 
+#if defined(_MSC_VER)
+  #include <intrin.h>
+#endif
+
 namespace util
 {
 
   std::string loadFileStr(const char * filename, uint32_t * size = NULL);
 
+  /// Allocates size bytes aligned to alignment (a power of two)
+  void * alignedAlloc(size_t size, size_t alignment);
+  void alignedFree(void * ptr);
+
+  // -- Bit scanning --
+
+  /// Index of the lowest set bit, bits must not be 0
+  inline uint32_t lowestBit(uint64_t bits)
+  {
+    #if defined(_MSC_VER)
+      unsigned long index;
+      _BitScanForward64(&index, bits);
+      return index;
+    #else
+      return __builtin_ctzll(bits);
+    #endif
+  }
+
+  /// Index of the highest set bit, bits must not be 0
+  inline uint32_t highestBit(uint64_t bits)
+  {
+    #if defined(_MSC_VER)
+      unsigned long index;
+      _BitScanReverse64(&index, bits);
+      return index;
+    #else
+      return 63 - __builtin_clzll(bits);
+    #endif
+  }
+
+  inline uint32_t bitCount(uint64_t bits)
+  {
+    #if defined(_MSC_VER)
+      return (uint32_t)__popcnt64(bits);
+    #else
+      return __builtin_popcountll(bits);
+    #endif
+  }
+
+  /// Bits [lo, hi] of a word
+  inline uint64_t spanMask(uint32_t lo, uint32_t hi)
+  {
+    return (~0ull >> (63 - hi)) & (~0ull << lo);
+  }
+
+  // -- Hashing --
+
+  /// Scrambles value so every input bit affects every output bit, the
+  /// splitmix64 finalizer
+  inline uint64_t mix64(uint64_t value)
+  {
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+    return value ^ (value >> 31);
+  }
+
+  /// 64-bit hash of size raw bytes
+  uint64_t hash64(const void * data, size_t size, uint64_t seed = 0);
+
+  // -- State serialization --
+
+  /// Appends size raw bytes to out
+  void append(std::vector<uint8_t> & out, const void * data, size_t size);
+
+  template <typename T>
+  void append(std::vector<uint8_t> & out, T const& value)
+  {
+    append(out, &value, sizeof(T));
+  }
+
+  /// Appends count elements of elementSize bytes as byte planes, the first
+  /// byte of every element, then the second and so on. Floats of similar
+  /// magnitude share their high bytes, which compresses far better that way.
+  void appendPlanes(std::vector<uint8_t> & out, const void * data, size_t count, size_t elementSize);
+
+  /// Reads raw bytes back in order. Reading past the end fails, leaves the
+  /// destination untouched and makes every later read fail too.
+  struct Reader
+  {
+    Reader(const uint8_t * data, size_t size);
+
+    bool read(void * out, size_t size);
+
+    /// Reads elements written by appendPlanes()
+    bool readPlanes(void * out, size_t count, size_t elementSize);
+
+    template <typename T>
+    bool read(T & value)
+    {
+      return read(&value, sizeof(T));
+    }
+
+    const uint8_t * cursor;
+    const uint8_t * end;
+    bool failed;
+  };
+
 }
\ No newline at end of file
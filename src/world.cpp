@@ -1,129 +1,186 @@
-
-#include "config.h"
-#include "gfx.h"
 #include "tcl.h"
 #include "world.h"
+#include "collide.h"
+#include "util.h"
 
 #include <stdio.h>
 #include <memory.h>
-
-#include <vector>
+#include <cmath>
 
 namespace world
 {
   namespace {
-    uint32_t _width;
-    uint32_t _height;
+    uint32_t _width = 0;
+    uint32_t _height = 0;
 
     uint16_t * _cells = NULL;
+    uint32_t _revision = 0;
 
-    gfx::VertexDecl _terrainDecl;
-    gfx::VertexBuffer * _terrainVB = NULL;
-    gfx::IndexBuffer * _terrainIB = NULL;
+    // XOR of cellHash() over all cells
+    uint64_t _hash = 0;
   }
 
   #define ACCESS(x, z) _cells[((z) > _height ? (_height - 1) : (z)) * _width + ((x) > _width ? (_width - 1) : (x))]
   #define TYPE(cell) (cell & 0x0F)
 
-  struct TerrainVertex
+  /// Zero cells hash to zero, so an empty world needs no pass over the cells
+  static inline uint64_t cellHash(uint32_t index, uint16_t cell)
   {
-    float x, y, z;
-    uint32_t color;
-  };
+    return cell ? util::mix64(((uint64_t)index << 16) | cell) : 0;
+  }
+
+  static void rehash()
+  {
+    _hash = 0;
+    for (uint32_t i = 0; i < _width * _height; ++i)
+      _hash ^= cellHash(i, _cells[i]);
+  }
 
   void clear()
   {
     delete[] _cells;
     _cells = NULL;
 
-    if (_terrainVB)
-      gfx::destroyVertexBuffer(_terrainVB);
-    if (_terrainIB)
-      gfx::destroyIndexBuffer(_terrainIB);
+    _width = 0;
+    _height = 0;
+    _hash = 0;
+  }
 
-    _terrainVB = NULL;
-    _terrainIB = NULL;
+  void createEmpty(uint32_t width, uint32_t height)
+  {
+    clear();
+
+    _width = width;
+    _height = height;
+
+    _cells = new uint16_t[_width * _height];
+    memset(_cells, 0, sizeof(uint16_t) * width * height);
+    _hash = 0;
+
+    collide::reset(width * 2, height * 2);
+    ++_revision;
+  }
+
+  void save(std::vector<uint8_t> & out)
+  {
+    util::append(out, _width);
+    util::append(out, _height);
+    util::append(out, _cells, sizeof(uint16_t) * _width * _height);
   }
 
-  static void initGfx()
+  bool load(util::Reader & reader)
   {
-    static bool initialized = false;
+    uint32_t width = 0, height = 0;
+    if (!reader.read(width) || !reader.read(height))
+      return false;
+
+    if ((size_t)(reader.end - reader.cursor) < sizeof(uint16_t) * width * height)
+    {
+      reader.failed = true;
+      return false;
+    }
+
+    const size_t size = sizeof(uint16_t) * width * height;
+
+    // Rolling back rarely touches the map, keep the caches built on it
+    if (width == _width && height == _height && memcmp(_cells, reader.cursor, size) == 0)
+      return reader.read(_cells, size);
 
-    if (!initialized)
+    if (width != _width || height != _height)
     {
-      _terrainDecl.position(3, GL_FLOAT)
-                  .color(4, GL_UNSIGNED_BYTE, true);
-      initialized = true;
+      clear();
+      _width = width;
+      _height = height;
+      _cells = new uint16_t[_width * _height];
     }
 
-    /*
-    std::vector<TerrainVertex> vb;
-    std::vector<uint16_t> ib;
+    // The revision is not restored, caches built since the save are stale
+    ++_revision;
+    if (!reader.read(_cells, size))
+      return false;
 
-    const float startX = _width * -0.5f;
-    const float startZ = _height * -0.5f;
+    rehash();
+    return true;
+  }
 
-    for (uint32_t x = 0; x < _width; ++x)
-      for (uint32_t z = 0; z < _height; ++z)
-      {
-        uint16_t cell = ACCESS(x, z);
-        uint8_t type = TYPE(cell);
+  uint32_t width()
+  {
+    return _width;
+  }
 
-        TerrainVertex vertex = { startX + x, 0, startZ + z, 0xff00ff00 };
-        vb.push_back(vertex);
-      }
-    */
+  uint32_t height()
+  {
+    return _height;
+  }
 
-    const float halfX = _width * 0.5f;
-    const float halfZ = _height * 0.5f;
-    const TerrainVertex terrainVertices[4] = {
-      { -halfX, 0, -halfZ, 0xff0ba500 },
-      { -halfX, 0,  halfZ, 0xff0ba500 },
-      {  halfX, 0,  halfZ, 0xff0ba500 },
-      {  halfX, 0, -halfZ, 0xff0ba500 },
-    };
+  uint32_t cellAt(float x, float z)
+  {
+    const int32_t cellX = (int32_t)std::floor(x + _width * 0.5f);
+    const int32_t cellZ = (int32_t)std::floor(z + _height * 0.5f);
 
-    static const uint16_t terrainIndicies[6] = { 0, 1, 2, 2, 3, 0 };
+    const uint32_t clampedX = cellX < 0 ? 0 : (cellX >= (int32_t)_width ? _width - 1 : cellX);
+    const uint32_t clampedZ = cellZ < 0 ? 0 : (cellZ >= (int32_t)_height ? _height - 1 : cellZ);
 
-    const gfx::Memory * mem = gfx::makeRef(terrainVertices, sizeof(terrainVertices));
-    _terrainVB = gfx::createDynamicVertexBuffer(mem, _terrainDecl);
+    return clampedZ * _width + clampedX;
+  }
 
-    mem = gfx::makeRef(terrainIndicies, sizeof(terrainIndicies));
-    _terrainIB = gfx::createIndexBuffer(mem);
+  uint8_t cellType(uint32_t x, uint32_t z)
+  {
+    if (x >= _width || z >= _height)
+      return WALL;
+
+    return TYPE(_cells[z * _width + x]);
   }
 
-  void createEmpty(uint32_t width, uint32_t height)
+  void setCellType(uint32_t x, uint32_t z, uint8_t type)
   {
-    clear();
+    if (x >= _width || z >= _height)
+      return;
+
+    const uint32_t index = z * _width + x;
+    uint16_t & cell = _cells[index];
+    const bool blocked = TYPE(cell) != GROUND;
+
+    _hash ^= cellHash(index, cell);
+    cell = (cell & ~0x0F) | (type & 0x0F);
+    _hash ^= cellHash(index, cell);
+    ++_revision;
+
+    // Movement, sight and the path finders only look at the collide bitmap,
+    // each world cell covers 2x2 bits of it
+    if (!blocked && TYPE(cell) != GROUND)
+      collide::setRect(x * 2, z * 2, 2, 2);
+    else if (blocked && TYPE(cell) == GROUND)
+      collide::clearRect(x * 2, z * 2, 2, 2);
+  }
 
-    _width = width;
-    _height = height;
+  bool walkable(uint32_t x, uint32_t z)
+  {
+    if (x >= _width || z >= _height)
+      return false;
 
-    _cells = new uint16_t[_width * _height];
-    memset(_cells, 0, sizeof(uint16_t) * width * height);
+    // Cells that are not ground set their collide bits
+    return !collide::testRect(x * 2, z * 2, 2, 2);
+  }
 
-    initGfx();
+  uint32_t revision()
+  {
+    return _revision + collide::revision();
   }
 
-  float getHeight(float x, float y)
+  uint64_t hash()
   {
-    return 0.0f;
+    return util::mix64(_hash ^ (((uint64_t)_width << 32) | _height));
   }
 
-  void render()
+  float getHeight(float x, float y)
   {
-    if (_terrainVB && _terrainIB)
-    {
-      gfx::begin(gfx::Feature::VertexColor | gfx::Feature::Proj3D);
-      gfx::setTransform(0, 0, 0, 0, 0, 0);
-      gfx::setVertexBuffer(_terrainVB);
-      gfx::setIndexBuffer(_terrainIB);
-      gfx::draw(6);
-      gfx::end();
-    }
+    return 0.0f;
   }
 
   // Tcl Bindings
   PROC("world:clear", clear)
   PROC("world:createEmpty", createEmpty)
+  PROC("world:setCellType", setCellType)
+  PROC("world:cellType", cellType)
 }
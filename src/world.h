@@ -1,14 +1,58 @@
-
 #pragma once
 
+#include <stdint.h>
+#include <vector>
+
+namespace util { struct Reader; }
+
 namespace world
 {
 
+  /// Cell types, stored in the low nibble of each cell
+  enum CellType
+  {
+    GROUND = 0,
+    WALL,
+    FLAG,
+    SPAWNER,
+    COLLECTOR
+  };
+
   void createEmpty(uint32_t width, uint32_t height);
   void clear();
 
+  uint32_t width();
+  uint32_t height();
+
+  /// The world is centered on the origin, this returns the index of the cell
+  /// containing world position (x, z), clamped to the world.
+  uint32_t cellAt(float x, float z);
+
+  uint8_t cellType(uint32_t x, uint32_t z);
+
+  /// Turning a ground cell into anything else sets the 2x2 collide bits it
+  /// covers, turning it back into ground clears them
+  void setCellType(uint32_t x, uint32_t z, uint8_t type);
+
+  /// A cell can be walked when none of its collide bits are set
+  bool walkable(uint32_t x, uint32_t z);
+
+  /// Incremented whenever walkability may have changed, either through the
+  /// cell types or the collide bitmap.
+  uint32_t revision();
+
+  /// Hash of the cells, updated as cells change
+  uint64_t hash();
+
   float getHeight(float x, float z);
 
+  /// Cell data, part of the state written by sim::save()
+  void save(std::vector<uint8_t> & out);
+  bool load(util::Reader & reader);
+
+  // -- Rendering, implemented in world_gfx.cpp --
+
+  void shutdownGfx();
   void render();
 
-}
\ No newline at end of file
+}
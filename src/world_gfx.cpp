@@ -0,0 +1,94 @@
+#include "config.h"
+#include "gfx.h"
+#include "world.h"
+
+#include <vector>
+
+namespace world
+{
+  namespace {
+    uint32_t _terrainWidth = 0;
+    uint32_t _terrainHeight = 0;
+
+    gfx::VertexDecl _terrainDecl;
+    gfx::VertexBuffer * _terrainVB = NULL;
+    gfx::IndexBuffer * _terrainIB = NULL;
+  }
+
+  struct TerrainVertex
+  {
+    float x, y, z;
+    uint32_t color;
+  };
+
+  void shutdownGfx()
+  {
+    if (_terrainVB)
+      gfx::destroyVertexBuffer(_terrainVB);
+    if (_terrainIB)
+      gfx::destroyIndexBuffer(_terrainIB);
+
+    _terrainVB = NULL;
+    _terrainIB = NULL;
+    _terrainWidth = 0;
+    _terrainHeight = 0;
+  }
+
+  static void initGfx()
+  {
+    static bool initialized = false;
+
+    if (!initialized)
+    {
+      _terrainDecl.position(3, GL_FLOAT)
+                  .color(4, GL_UNSIGNED_BYTE, true);
+      initialized = true;
+    }
+
+    shutdownGfx();
+
+    _terrainWidth = width();
+    _terrainHeight = height();
+
+    const float halfX = _terrainWidth * 0.5f;
+    const float halfZ = _terrainHeight * 0.5f;
+    const TerrainVertex terrainVertices[4] = {
+      { -halfX, 0, -halfZ, 0xff0ba500 },
+      { -halfX, 0,  halfZ, 0xff0ba500 },
+      {  halfX, 0,  halfZ, 0xff0ba500 },
+      {  halfX, 0, -halfZ, 0xff0ba500 },
+    };
+
+    static const uint16_t terrainIndicies[6] = { 0, 1, 2, 2, 3, 0 };
+
+    const gfx::Memory * mem = gfx::makeRef(terrainVertices, sizeof(terrainVertices));
+    _terrainVB = gfx::createDynamicVertexBuffer(mem, _terrainDecl);
+
+    mem = gfx::makeRef(terrainIndicies, sizeof(terrainIndicies));
+    _terrainIB = gfx::createIndexBuffer(mem);
+  }
+
+  void render()
+  {
+    // The simulation owns the world and knows nothing about the GPU, so the
+    // terrain buffers are (re)built here whenever the world size changes.
+    if (width() != _terrainWidth || height() != _terrainHeight)
+    {
+      if (width() == 0 || height() == 0)
+        shutdownGfx();
+      else
+        initGfx();
+    }
+
+    if (_terrainVB && _terrainIB)
+    {
+      gfx::begin(gfx::Feature::VertexColor | gfx::Feature::Proj3D);
+      gfx::setTransform(0, 0, 0, 0, 0, 0);
+      gfx::setVertexBuffer(_terrainVB);
+      gfx::setIndexBuffer(_terrainIB);
+      gfx::draw(6);
+      gfx::end();
+    }
+  }
+
+}
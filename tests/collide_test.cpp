@@ -0,0 +1,301 @@
+#include "test.h"
+#include "collide.h"
+#include "world.h"
+
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+
+// -- Helpers --
+
+namespace {
+  // A world of 75 x 50 units, neither side a multiple of 64 bits
+  const int32_t WIDTH = 150;
+  const int32_t HEIGHT = 100;
+
+  /// The bitmap as one bool per bit, changed the slow way
+  std::vector<bool> _reference;
+}
+
+static void reset()
+{
+  world::createEmpty(WIDTH / 2, HEIGHT / 2);
+  _reference.assign(WIDTH * HEIGHT, false);
+}
+
+static bool referenceBit(int32_t x, int32_t z)
+{
+  if (x < 0 || z < 0 || x >= WIDTH || z >= HEIGHT)
+    return true;
+
+  return _reference[z * WIDTH + x];
+}
+
+static void referenceRect(int32_t x, int32_t z, int32_t width, int32_t height, bool on)
+{
+  for (int32_t bz = std::max(z, 0); bz < std::min(z + height, HEIGHT); ++bz)
+    for (int32_t bx = std::max(x, 0); bx < std::min(x + width, WIDTH); ++bx)
+      _reference[bz * WIDTH + bx] = on;
+}
+
+/// Set bits of the rectangle, bits outside the bitmap in outside
+static void referenceCount(int32_t x, int32_t z, int32_t width, int32_t height, uint32_t & inside, uint32_t & outside)
+{
+  inside = outside = 0;
+  for (int32_t bz = z; bz < z + height; ++bz)
+    for (int32_t bx = x; bx < x + width; ++bx)
+    {
+      if (bx < 0 || bz < 0 || bx >= WIDTH || bz >= HEIGHT)
+        ++outside;
+      else if (_reference[bz * WIDTH + bx])
+        ++inside;
+    }
+}
+
+/// Random rectangle, sometimes reaching past the edges
+static void randomRect(int32_t & x, int32_t & z, int32_t & width, int32_t & height, int32_t maxSize)
+{
+  x = rand() % (WIDTH + 20) - 10;
+  z = rand() % (HEIGHT + 20) - 10;
+  width = 1 + rand() % maxSize;
+  height = 1 + rand() % maxSize;
+}
+
+// -- Rectangles --
+
+TEST(collide, rectOpsMatchReference)
+{
+  srand(11);
+  reset();
+
+  for (uint32_t op = 0; op < 400; ++op)
+  {
+    int32_t x, z, width, height;
+    randomRect(x, z, width, height, 70);
+
+    const bool on = rand() % 3 != 0;
+    if (on)
+      collide::setRect(x, z, width, height);
+    else
+      collide::clearRect(x, z, width, height);
+
+    referenceRect(x, z, width, height, on);
+  }
+
+  bool bits = true;
+  for (int32_t z = -2; z < HEIGHT + 2; ++z)
+    for (int32_t x = -2; x < WIDTH + 2; ++x)
+      bits = bits && collide::checkI(x, z) == referenceBit(x, z);
+
+  CHECK(bits);
+
+  // Every query agrees with counting the bits one by one
+  bool queries = true;
+  for (uint32_t query = 0; query < 2000; ++query)
+  {
+    int32_t x, z, width, height;
+    randomRect(x, z, width, height, query % 2 ? 8 : 90);
+
+    uint32_t inside, outside;
+    referenceCount(x, z, width, height, inside, outside);
+    const uint32_t area = width * height;
+
+    queries = queries && collide::countRect(x, z, width, height) == inside;
+    queries = queries && collide::testRect(x, z, width, height) == (inside + outside > 0);
+    queries = queries && collide::rectFree(x, z, width, height) == (inside + outside == 0);
+    queries = queries && collide::rectBlocked(x, z, width, height) == (inside + outside == area);
+  }
+
+  CHECK(queries);
+}
+
+TEST(collide, pyramidAnswersLargeRects)
+{
+  reset();
+
+  // Whole blocks set and cleared, so the pyramid shortcuts are taken
+  collide::setRect(0, 0, WIDTH, HEIGHT);
+  CHECK(collide::rectBlocked(0, 0, WIDTH, HEIGHT));
+  CHECK(collide::countRect(0, 0, WIDTH, HEIGHT) == (uint32_t)(WIDTH * HEIGHT));
+
+  collide::clearRect(16, 16, 64, 64);
+  CHECK(collide::rectFree(16, 16, 64, 64));
+  CHECK(!collide::rectFree(15, 16, 64, 64));
+  CHECK(!collide::rectBlocked(0, 0, WIDTH, HEIGHT));
+  CHECK(collide::countRect(0, 0, WIDTH, HEIGHT) == (uint32_t)(WIDTH * HEIGHT - 64 * 64));
+
+  // A single bit inside an otherwise free block
+  collide::setI(47, 47, true);
+  CHECK(!collide::rectFree(16, 16, 64, 64));
+  CHECK(collide::countRect(16, 16, 64, 64) == 1);
+  CHECK(collide::rectFree(48, 48, 32, 32));
+
+  collide::clearRect(0, 0, WIDTH, HEIGHT);
+  CHECK(collide::rectFree(0, 0, WIDTH, HEIGHT));
+  CHECK(!collide::rectFree(-1, 0, WIDTH, HEIGHT));
+  CHECK(!collide::rectFree(0, 0, WIDTH, HEIGHT + 1));
+}
+
+TEST(collide, wordReadsMatchBits)
+{
+  srand(12);
+  reset();
+
+  for (uint32_t op = 0; op < 100; ++op)
+  {
+    int32_t x, z, width, height;
+    randomRect(x, z, width, height, 20);
+    collide::setRect(x, z, width, height);
+    referenceRect(x, z, width, height, true);
+  }
+
+  bool rows = true, columns = true;
+  for (int32_t a = -70; a < WIDTH + 5; a += 7)
+    for (int32_t b = -3; b < HEIGHT + 3; ++b)
+    {
+      const uint64_t row = collide::row64(a, b);
+      const uint64_t column = collide::column64(b, a);
+      for (int32_t n = 0; n < 64; ++n)
+      {
+        rows = rows && ((row >> n) & 1) == referenceBit(a + n, b);
+        columns = columns && ((column >> n) & 1) == referenceBit(b, a + n);
+      }
+    }
+
+  CHECK(rows);
+  CHECK(columns);
+}
+
+// -- Line of sight --
+
+TEST(collide, lineOfSightAcrossWall)
+{
+  reset();
+
+  // A wall across the whole bitmap at z = 20 world units
+  collide::setRect(0, 40, WIDTH, 1);
+
+  CHECK(!collide::lineOfSight(10.0f, 5.0f, 10.0f, 30.0f));
+  CHECK(!collide::lineOfSight(1.0f, 19.0f, 74.0f, 21.0f));
+  CHECK(collide::lineOfSight(1.0f, 19.0f, 74.0f, 19.9f));
+  CHECK(collide::lineOfSight(70.0f, 49.0f, 2.0f, 20.6f));
+
+  // Leaving the bitmap is blocked
+  CHECK(!collide::lineOfSight(10.0f, 5.0f, -1.0f, 5.0f));
+  CHECK(!collide::lineOfSight(10.0f, 5.0f, 80.0f, 5.0f));
+}
+
+TEST(collide, lineOfSightMatchesSampling)
+{
+  srand(13);
+  reset();
+
+  // Scattered single bits
+  for (uint32_t i = 0; i < 60; ++i)
+  {
+    const int32_t x = rand() % WIDTH, z = rand() % HEIGHT;
+    collide::setI(x, z, true);
+    referenceRect(x, z, 1, 1, true);
+  }
+
+  std::vector<collide::Ray> rays;
+  bool consistent = true;
+  for (uint32_t i = 0; i < 3000; ++i)
+  {
+    collide::Ray ray;
+    ray.x0 = (rand() % 14900) / 200.0f + 0.1f;
+    ray.z0 = (rand() % 9900) / 200.0f + 0.1f;
+    ray.x1 = (rand() % 14900) / 200.0f + 0.1f;
+    ray.z1 = (rand() % 9900) / 200.0f + 0.1f;
+    rays.push_back(ray);
+
+    // Points along the segment are a subset of the bits it touches, so a
+    // sample on a set bit means blocked
+    bool sampledBlocked = false;
+    for (uint32_t s = 0; s <= 1000; ++s)
+    {
+      const float t = s / 1000.0f;
+      const int32_t x = (int32_t)((ray.x0 + (ray.x1 - ray.x0) * t) * 2.0f);
+      const int32_t z = (int32_t)((ray.z0 + (ray.z1 - ray.z0) * t) * 2.0f);
+      sampledBlocked = sampledBlocked || referenceBit(x, z);
+    }
+
+    // No set bit in the bounding box of the segment means clear
+    uint32_t inside, outside;
+    const int32_t x0 = (int32_t)(std::min(ray.x0, ray.x1) * 2.0f), x1 = (int32_t)(std::max(ray.x0, ray.x1) * 2.0f);
+    const int32_t z0 = (int32_t)(std::min(ray.z0, ray.z1) * 2.0f), z1 = (int32_t)(std::max(ray.z0, ray.z1) * 2.0f);
+    referenceCount(x0, z0, x1 - x0 + 1, z1 - z0 + 1, inside, outside);
+
+    const bool clear = collide::lineOfSight(ray.x0, ray.z0, ray.x1, ray.z1);
+    consistent = consistent && !(clear && sampledBlocked) && !(!clear && inside == 0);
+  }
+
+  CHECK(consistent);
+
+  // The batch gives the same answers as one ray at a time
+  std::vector<uint8_t> visible(rays.size());
+  const uint32_t clearCount = collide::lineOfSight(&rays[0], rays.size(), &visible[0]);
+
+  uint32_t expected = 0;
+  bool same = true;
+  for (size_t i = 0; i < rays.size(); ++i)
+  {
+    const bool clear = collide::lineOfSight(rays[i].x0, rays[i].z0, rays[i].x1, rays[i].z1);
+    same = same && visible[i] == (clear ? 1 : 0);
+    expected += clear;
+  }
+
+  CHECK(same);
+  CHECK(clearCount == expected);
+  CHECK(clearCount > 0 && clearCount < rays.size());
+}
+
+// -- Movement --
+
+TEST(collide, sweepStopsAtThinWall)
+{
+  reset();
+  collide::setRect(60, 0, 1, HEIGHT);
+
+  // Far further than the wall is thick in a single move
+  float x = 50.0f, z = 10.0f;
+  const uint32_t blocked = collide::sweep(20.0f, 10.0f, x, z, 0.25f);
+  CHECK(blocked == collide::BLOCKED_X);
+  CHECK(x + 0.25f <= 30.0f && x > 29.0f);
+  CHECK(z == 10.0f);
+
+  // Moving along the wall is not blocked
+  x = 29.0f;
+  z = 40.0f;
+  CHECK(collide::sweep(29.0f, 10.0f, x, z, 0.25f) == 0);
+  CHECK(x == 29.0f && z == 40.0f);
+}
+
+TEST(collide, wallCellsBlockMovementAndSight)
+{
+  reset();
+
+  // A wall row of world cells, as the game map builds it
+  for (uint32_t x = 0; x < WIDTH / 2; ++x)
+    world::setCellType(x, 20, world::WALL);
+
+  CHECK(!world::walkable(10, 20));
+  CHECK(collide::checkI(20, 40) && collide::checkI(21, 41));
+
+  // Heading straight through the wall row, as units pushed off their flow
+  // field do
+  float x = 10.0f, z = 30.0f;
+  const uint32_t blocked = collide::sweep(10.0f, 15.0f, x, z, 0.25f);
+  CHECK(blocked == collide::BLOCKED_Z);
+  CHECK(z + 0.25f <= 20.0f && z > 19.0f);
+  CHECK(!collide::lineOfSight(10.0f, 15.0f, 10.0f, 30.0f));
+
+  // Back to ground opens the bits again
+  world::setCellType(10, 20, world::GROUND);
+  CHECK(world::walkable(10, 20));
+
+  x = 10.5f;
+  z = 30.0f;
+  CHECK(collide::sweep(10.5f, 15.0f, x, z, 0.25f) == 0);
+  CHECK(collide::lineOfSight(10.5f, 15.0f, 10.5f, 30.0f));
+}
@@ -0,0 +1,169 @@
+#include "test.h"
+#include "fixed.h"
+
+#include <stdlib.h>
+#include <cmath>
+
+using math::Fixed;
+using math::FixedVector2;
+
+// -- Helpers --
+
+static int32_t randomRaw()
+{
+  // Spread over every magnitude, not just large values
+  const int32_t value = (int32_t)(((uint32_t)rand() << 16) ^ (uint32_t)rand()) >> (rand() % 31);
+  return rand() % 2 ? value : -value;
+}
+
+/// Floor of a / b for any signs
+static int64_t floorDivide(int64_t a, int64_t b)
+{
+  const int64_t quotient = a / b;
+  return (a % b != 0 && (a < 0) != (b < 0)) ? quotient - 1 : quotient;
+}
+
+// -- Arithmetic --
+
+TEST(fixed, divisionRoundsDown)
+{
+  CHECK((Fixed::fromInt(1) / Fixed::fromInt(3)).raw == 21845);
+  CHECK((Fixed::fromInt(-1) / Fixed::fromInt(3)).raw == -21846);
+  CHECK((Fixed::fromInt(1) / Fixed::fromInt(-3)).raw == -21846);
+  CHECK((Fixed::fromInt(-1) / Fixed::fromInt(-3)).raw == 21845);
+  CHECK((Fixed::fromInt(6) / Fixed::fromInt(-3)).raw == Fixed::fromInt(-2).raw);
+
+  srand(31);
+  bool exact = true;
+  for (uint32_t i = 0; i < 100000; ++i)
+  {
+    const Fixed a = Fixed::fromRaw(randomRaw());
+    const Fixed b = Fixed::fromRaw(randomRaw());
+    if (b.raw == 0)
+      continue;
+
+    // Quotients outside the range wrap like every other overflow
+    const int64_t expected = floorDivide((int64_t)a.raw * Fixed::ONE, b.raw);
+    if (expected < INT32_MIN || expected > INT32_MAX)
+      continue;
+
+    exact = exact && (a / b).raw == expected;
+  }
+
+  CHECK(exact);
+}
+
+TEST(fixed, divisionByZeroSaturates)
+{
+  CHECK((Fixed::fromInt(5) / Fixed()).raw == INT32_MAX);
+  CHECK((Fixed::fromInt(-5) / Fixed()).raw == INT32_MIN);
+}
+
+TEST(fixed, productRoundsDown)
+{
+  const Fixed half = Fixed::fromRaw(Fixed::ONE / 2);
+  const Fixed smallest = Fixed::fromRaw(1);
+
+  CHECK((smallest * half).raw == 0);
+  CHECK((-smallest * half).raw == -1);
+  CHECK((Fixed::fromInt(3) * Fixed::fromInt(-4)).raw == Fixed::fromInt(-12).raw);
+}
+
+TEST(fixed, fromFloatRoundsToNearest)
+{
+  const float step = 1.0f / Fixed::ONE;
+
+  CHECK(Fixed::fromFloat(1.4f * step).raw == 1);
+  CHECK(Fixed::fromFloat(1.6f * step).raw == 2);
+  CHECK(Fixed::fromFloat(-1.4f * step).raw == -1);
+  CHECK(Fixed::fromFloat(-1.6f * step).raw == -2);
+  CHECK(Fixed::fromFloat(0.5f * step).raw == 1);
+  CHECK(Fixed::fromFloat(-0.5f * step).raw == 0);
+  CHECK(Fixed::fromFloat(-2.75f).raw == -180224);
+
+  CHECK(Fixed::fromFloat(1e9f).raw == INT32_MAX);
+  CHECK(Fixed::fromFloat(-1e9f).raw == INT32_MIN);
+}
+
+TEST(fixed, overflowWraps)
+{
+  // Outside Q16.16, but well defined
+  CHECK(Fixed::fromInt(40000).raw == (int32_t)(40000u << 16));
+  CHECK((Fixed::fromInt(30000) + Fixed::fromInt(30000)).raw == (int32_t)(60000u << 16));
+  CHECK((Fixed::fromRaw(INT32_MIN) - Fixed::fromRaw(1)).raw == INT32_MAX);
+  CHECK((-Fixed::fromRaw(INT32_MIN)).raw == INT32_MIN);
+
+  Fixed sum = Fixed::fromRaw(INT32_MAX);
+  sum += Fixed::fromRaw(1);
+  CHECK(sum.raw == INT32_MIN);
+}
+
+// -- Functions --
+
+TEST(fixed, sqrtIsExactFloor)
+{
+  CHECK(math::fixed::sqrt(Fixed::fromInt(4)).raw == Fixed::fromInt(2).raw);
+  CHECK(math::fixed::sqrt(Fixed::fromInt(-4)).raw == 0);
+  CHECK(math::fixed::sqrt(Fixed::fromRaw(INT32_MAX)).raw == 11863283);
+
+  srand(32);
+  bool exact = true;
+  for (uint32_t i = 0; i < 100000; ++i)
+  {
+    const int32_t raw = randomRaw();
+    if (raw <= 0)
+      continue;
+
+    const uint64_t squared = (uint64_t)raw << Fixed::FRACTION_BITS;
+    const uint64_t root = math::fixed::sqrt(Fixed::fromRaw(raw)).raw;
+    exact = exact && root * root <= squared && (root + 1) * (root + 1) > squared;
+  }
+
+  CHECK(exact);
+}
+
+TEST(fixed, lengthAndNormalize)
+{
+  CHECK(math::fixed::length(FixedVector2(Fixed::fromInt(3), Fixed::fromInt(-4))).raw == Fixed::fromInt(5).raw);
+
+  // The squares are far beyond 32 bits, too long a vector saturates
+  CHECK(math::fixed::length(FixedVector2(Fixed::fromInt(20000), Fixed::fromInt(-20000))).raw == 1853638000);
+  CHECK(math::fixed::length(FixedVector2(Fixed::fromInt(30000), Fixed::fromInt(-30000))).raw == INT32_MAX);
+
+  const FixedVector2 zero = math::fixed::normalize(FixedVector2());
+  CHECK(zero.x.raw == 0 && zero.z.raw == 0);
+
+  srand(33);
+  bool unit = true;
+  for (uint32_t i = 0; i < 10000; ++i)
+  {
+    // Below a length of one the length divided by is too coarse
+    const FixedVector2 v(Fixed::fromRaw(randomRaw() >> 4), Fixed::fromRaw(randomRaw() >> 4));
+    if (math::fixed::length(v).raw < Fixed::ONE)
+      continue;
+
+    const int32_t length = math::fixed::length(math::fixed::normalize(v)).raw;
+    unit = unit && std::abs(length - Fixed::ONE) <= 4;
+  }
+
+  CHECK(unit);
+}
+
+TEST(fixed, sineTableAccuracy)
+{
+  CHECK(math::fixed::sin(Fixed()).raw == 0);
+  CHECK(math::fixed::sin(Fixed::fromInt(90)).raw == Fixed::ONE);
+  CHECK(math::fixed::sin(Fixed::fromInt(-90)).raw == -Fixed::ONE);
+  CHECK(math::fixed::cos(Fixed::fromInt(180)).raw == -Fixed::ONE);
+
+  bool close = true;
+  for (int32_t tenth = -7200; tenth <= 7200; ++tenth)
+  {
+    const Fixed degrees = Fixed::fromInt(tenth) / Fixed::fromInt(10);
+    const double radians = degrees.toFloat() * 3.14159265358979323846 / 180.0;
+    close = close && std::fabs(math::fixed::sin(degrees).raw - std::sin(radians) * Fixed::ONE) <= 2.5;
+    close = close && std::fabs(math::fixed::cos(degrees).raw - std::cos(radians) * Fixed::ONE) <= 2.5;
+  }
+
+  CHECK(close);
+}
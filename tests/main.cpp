@@ -0,0 +1,75 @@
+#include "test.h"
+#include "sim.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+namespace test
+{
+  namespace {
+    struct Test
+    {
+      const char * group;
+      const char * name;
+      Function function;
+    };
+
+    // Filled from static initializers, so it must not be a plain global
+    std::vector<Test> & tests()
+    {
+      static std::vector<Test> registered;
+      return registered;
+    }
+
+    uint32_t _failures = 0;
+  }
+
+  bool add(const char * group, const char * name, Function function)
+  {
+    Test test = { group, name, function };
+    tests().push_back(test);
+    return true;
+  }
+
+  void fail(const char * file, int line, const char * expression)
+  {
+    fprintf(stderr, "%s:%d: CHECK(%s) failed\n", file, line, expression);
+    ++_failures;
+  }
+}
+
+int main(int argc, char * argv[])
+{
+  if (argc != 2)
+  {
+    printf("Usage: %s group\n", argv[0]);
+    printf("  Runs every test of the group, fails if any check does not hold.\n");
+    return 1;
+  }
+
+  sim::init();
+
+  uint32_t run = 0;
+  for (size_t i = 0; i < test::tests().size(); ++i)
+  {
+    test::Test const& t = test::tests()[i];
+    if (strcmp(t.group, argv[1]) != 0)
+      continue;
+
+    const uint32_t failuresBefore = test::_failures;
+    t.function();
+    printf("%s %s.%s\n", test::_failures == failuresBefore ? "ok  " : "FAIL", t.group, t.name);
+    ++run;
+  }
+
+  sim::shutdown();
+
+  if (run == 0)
+  {
+    fprintf(stderr, "No tests in group '%s'\n", argv[1]);
+    return 1;
+  }
+
+  return test::_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,253 @@
+#include "test.h"
+#include "jps.h"
+#include "hpa.h"
+#include "flowfield.h"
+#include "collide.h"
+#include "world.h"
+#include "grid.h"
+
+#include <stdlib.h>
+#include <functional>
+#include <queue>
+#include <vector>
+
+// -- Helpers --
+
+namespace {
+  const uint32_t UNREACHABLE = 0xffffffff;
+
+  typedef bool (*Walkable)(int32_t x, int32_t z);
+  typedef std::pair<uint32_t, uint32_t> Node;
+}
+
+static bool bitFree(int32_t x, int32_t z)
+{
+  return x >= 0 && z >= 0 && x < (int32_t)collide::width() && z < (int32_t)collide::height() && !collide::checkI(x, z);
+}
+
+static bool cellFree(int32_t x, int32_t z)
+{
+  return x >= 0 && z >= 0 && x < (int32_t)world::width() && z < (int32_t)world::height() && world::walkable(x, z);
+}
+
+/// Plain Dijkstra with the rules every path finder shares, 8-connected
+/// without cutting corners. Returns the cost from (goalX, goalZ) to every
+/// cell of a width x height grid.
+static std::vector<uint32_t> dijkstra(Walkable walkable, uint32_t width, uint32_t height, uint32_t goalX, uint32_t goalZ)
+{
+  std::vector<uint32_t> cost(width * height, UNREACHABLE);
+  std::priority_queue<Node, std::vector<Node>, std::greater<Node> > open;
+
+  cost[goalZ * width + goalX] = 0;
+  open.push(Node(0, goalZ * width + goalX));
+
+  while (!open.empty())
+  {
+    const Node node = open.top();
+    open.pop();
+    if (node.first != cost[node.second])
+      continue;
+
+    const int32_t x = node.second % width, z = node.second / width;
+    for (uint32_t dir = 0; dir < 8; ++dir)
+    {
+      const int32_t nx = x + grid::DIRECTION_X[dir], nz = z + grid::DIRECTION_Z[dir];
+      if (!walkable(nx, nz) || ((dir & 1) && (!walkable(nx, z) || !walkable(x, nz))))
+        continue;
+
+      const uint32_t next = nz * width + nx;
+      const uint32_t nextCost = node.first + ((dir & 1) ? grid::DIAGONAL_COST : grid::STRAIGHT_COST);
+      if (nextCost < cost[next])
+      {
+        cost[next] = nextCost;
+        open.push(Node(nextCost, next));
+      }
+    }
+  }
+
+  return cost;
+}
+
+/// Cost of a path of jump points, UNREACHABLE if a leg is not a straight or
+/// diagonal line of free bits or cuts a corner
+static uint32_t pathCost(jps::Path const& path)
+{
+  uint32_t cost = 0;
+  for (size_t i = 1; i < path.size(); ++i)
+  {
+    const int32_t dx = (int32_t)path[i].x - (int32_t)path[i - 1].x;
+    const int32_t dz = (int32_t)path[i].z - (int32_t)path[i - 1].z;
+    const int32_t stepX = dx > 0 ? 1 : dx < 0 ? -1 : 0;
+    const int32_t stepZ = dz > 0 ? 1 : dz < 0 ? -1 : 0;
+    if (dx != 0 && dz != 0 && abs(dx) != abs(dz))
+      return UNREACHABLE;
+
+    int32_t x = path[i - 1].x, z = path[i - 1].z;
+    while (x != (int32_t)path[i].x || z != (int32_t)path[i].z)
+    {
+      if (stepX && stepZ && (!bitFree(x + stepX, z) || !bitFree(x, z + stepZ)))
+        return UNREACHABLE;
+
+      x += stepX;
+      z += stepZ;
+      if (!bitFree(x, z))
+        return UNREACHABLE;
+    }
+
+    cost += grid::octile(path[i - 1].x, path[i - 1].z, path[i].x, path[i].z);
+  }
+
+  return cost;
+}
+
+/// Random rectangles of walls over a world of 40 x 40 units
+static void randomWorld(uint32_t walls)
+{
+  world::createEmpty(40, 40);
+
+  for (uint32_t i = 0; i < walls; ++i)
+    collide::setRect(rand() % 80, rand() % 80, 1 + rand() % 12, 1 + rand() % 6);
+}
+
+static void randomFreeBit(uint32_t & x, uint32_t & z)
+{
+  do
+  {
+    x = rand() % collide::width();
+    z = rand() % collide::height();
+  }
+  while (!bitFree(x, z));
+}
+
+// -- Jump point search --
+
+TEST(path, jpsCostMatchesDijkstra)
+{
+  srand(21);
+
+  bool optimal = true, reachability = true;
+  uint32_t found = 0, searches = 0;
+
+  for (uint32_t map = 0; map < 20; ++map)
+  {
+    randomWorld(60 + map * 8);
+
+    for (uint32_t goal = 0; goal < 5; ++goal)
+    {
+      uint32_t goalX, goalZ;
+      randomFreeBit(goalX, goalZ);
+      const std::vector<uint32_t> cost = dijkstra(bitFree, collide::width(), collide::height(), goalX, goalZ);
+
+      for (uint32_t start = 0; start < 10; ++start)
+      {
+        uint32_t startX, startZ;
+        randomFreeBit(startX, startZ);
+        const uint32_t expected = cost[startZ * collide::width() + startX];
+
+        jps::Path path;
+        const bool ok = jps::findPath(startX, startZ, goalX, goalZ, path);
+        reachability = reachability && ok == (expected != UNREACHABLE);
+        ++searches;
+
+        if (!ok)
+          continue;
+
+        ++found;
+        optimal = optimal && path.front().x == startX && path.front().z == startZ &&
+                  path.back().x == goalX && path.back().z == goalZ &&
+                  pathCost(path) == expected;
+      }
+    }
+  }
+
+  CHECK(reachability);
+  CHECK(optimal);
+
+  // The maps must leave some goals out of reach for the test to mean much
+  CHECK(found > searches / 2 && found < searches);
+}
+
+TEST(path, hpaPathsAreValid)
+{
+  srand(22);
+
+  bool valid = true, reachability = true;
+  for (uint32_t map = 0; map < 10; ++map)
+  {
+    randomWorld(60);
+
+    for (uint32_t search = 0; search < 30; ++search)
+    {
+      uint32_t startX, startZ, goalX, goalZ;
+      randomFreeBit(startX, startZ);
+      randomFreeBit(goalX, goalZ);
+
+      const std::vector<uint32_t> cost = dijkstra(bitFree, collide::width(), collide::height(), goalX, goalZ);
+      const uint32_t expected = cost[startZ * collide::width() + startX];
+
+      // Not always the shortest path, but never shorter than it and always
+      // walkable
+      jps::Path path;
+      const bool ok = hpa::findPath(startX, startZ, goalX, goalZ, path);
+      reachability = reachability && ok == (expected != UNREACHABLE);
+      if (ok)
+      {
+        const uint32_t length = pathCost(path);
+        valid = valid && length != UNREACHABLE && length >= expected;
+      }
+    }
+  }
+
+  CHECK(reachability);
+  CHECK(valid);
+}
+
+TEST(path, hpaStartOnTransition)
+{
+  // A wall along the border between the third and fourth cluster column
+  // with a single gap, the start sits in the gap and the goal far to the west
+  const uint32_t border = hpa::CLUSTER_SIZE * 3;
+  world::createEmpty(40, 40);
+  collide::setRect(border, 0, 1, 40);
+  collide::setRect(border, 41, 1, 39);
+
+  const std::vector<uint32_t> cost = dijkstra(bitFree, collide::width(), collide::height(), 2, 40);
+
+  jps::Path path;
+  CHECK(hpa::findPath(border, 40, 2, 40, path, false));
+  CHECK(hpa::findPath(border, 40, 2, 40, path));
+
+  const uint32_t length = pathCost(path);
+  CHECK(length != UNREACHABLE && length >= cost[40 * collide::width() + border]);
+}
+
+// -- Flow fields --
+
+TEST(path, flowFieldCostMatchesDijkstra)
+{
+  srand(23);
+
+  bool same = true;
+  for (uint32_t map = 0; map < 10; ++map)
+  {
+    world::createEmpty(50, 40);
+    for (uint32_t i = 0; i < 150; ++i)
+      world::setCellType(rand() % 50, rand() % 40, world::WALL);
+
+    uint32_t goalX, goalZ;
+    do
+    {
+      goalX = rand() % 50;
+      goalZ = rand() % 40;
+    }
+    while (!world::walkable(goalX, goalZ));
+
+    flowfield::Field field;
+    flowfield::build(field, goalX, goalZ);
+
+    const std::vector<uint32_t> cost = dijkstra(cellFree, 50, 40, goalX, goalZ);
+    same = same && field.cost == cost;
+  }
+
+  CHECK(same);
+}
@@ -0,0 +1,387 @@
+#include "test.h"
+#include "sim.h"
+#include "world.h"
+#include "player.h"
+#include "collide.h"
+#include "ai.h"
+#include "unit.h"
+#include "replay.h"
+#include "interest.h"
+#include "fog.h"
+#include "tcl.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// -- Helpers --
+
+/// Two players with walls in between, spawning units that walk to the other
+/// base, so within a few hundred ticks units move, collide, separate and
+/// fight
+static void setupGame()
+{
+  world::createEmpty(64, 64);
+
+  for (uint32_t x = 10; x < 54; ++x)
+    if (x < 30 || x > 34)
+      world::setCellType(x, 32, world::WALL);
+
+  collide::setRect(40, 40, 6, 6);
+
+  player::setup(2, 0);
+
+  for (uint32_t p = 0; p < 2; ++p)
+  {
+    player::Player & player = player::player(p);
+    player.startX = p == 0 ? -8.0f : 8.0f;
+    player.startZ = p == 0 ? -8.0f : 8.0f;
+    player.spawnRate = 0.1f;
+    player.timeToNextSpawn = 0.0f;
+    player.rallyX = -player.startX;
+    player.rallyZ = -player.startZ;
+    player.hasRally = true;
+  }
+}
+
+static void run(uint32_t ticks)
+{
+  for (uint32_t i = 0; i < ticks; ++i)
+    sim::tick(sim::tickDuration());
+}
+
+static bool equal(sim::Hash const& a, sim::Hash const& b)
+{
+  for (uint32_t i = 0; i < sim::HASH_PART_COUNT; ++i)
+    if (a.parts[i] != b.parts[i])
+      return false;
+
+  return true;
+}
+
+/// XOR of every unit hashed from scratch
+static uint64_t rehashUnits()
+{
+  uint64_t result = 0;
+  for (size_t p = 0; p < player::players().size(); ++p)
+  {
+    unit::Storage const& units = player::players()[p].units;
+    result ^= unit::hash(units, 0, units.count);
+  }
+
+  return result;
+}
+
+static uint32_t unitCount()
+{
+  uint32_t count = 0;
+  for (size_t p = 0; p < player::players().size(); ++p)
+    count += player::players()[p].units.count;
+
+  return count;
+}
+
+// -- Save and load --
+
+TEST(sim, loadRestoresHash)
+{
+  setupGame();
+  run(300);
+  CHECK(unitCount() > 0);
+  CHECK(ai::stats().engaged > 0);
+
+  std::vector<uint8_t> state;
+  sim::save(state);
+  const uint64_t savedTick = sim::tickCount();
+
+  sim::Hash saved;
+  sim::hash(saved);
+
+  run(300);
+
+  sim::Hash later;
+  sim::hash(later);
+  CHECK(!equal(saved, later));
+
+  CHECK(sim::load(&state[0], state.size()));
+  CHECK(sim::tickCount() == savedTick);
+
+  sim::Hash loaded;
+  sim::hash(loaded);
+  CHECK(equal(saved, loaded));
+
+  // Running on from the loaded state gives the same ticks again
+  run(300);
+
+  sim::Hash replayed;
+  sim::hash(replayed);
+  CHECK(equal(later, replayed));
+}
+
+TEST(sim, saveOfLoadedStateIsIdentical)
+{
+  setupGame();
+  run(200);
+
+  std::vector<uint8_t> first;
+  sim::save(first);
+
+  CHECK(sim::load(&first[0], first.size()));
+
+  std::vector<uint8_t> second;
+  sim::save(second);
+  CHECK(first == second);
+}
+
+TEST(sim, truncatedStateFailsToLoad)
+{
+  setupGame();
+  run(100);
+
+  std::vector<uint8_t> state;
+  sim::save(state);
+
+  sim::Hash saved;
+  sim::hash(saved);
+
+  CHECK(!sim::load(&state[0], state.size() / 2));
+  CHECK(!sim::load(&state[0], 3));
+
+  // A failed load leaves garbage behind, a good one repairs it
+  CHECK(sim::load(&state[0], state.size()));
+
+  sim::Hash loaded;
+  sim::hash(loaded);
+  CHECK(equal(saved, loaded));
+}
+
+// -- State hash --
+
+TEST(sim, hashPartFollowsCollide)
+{
+  setupGame();
+
+  sim::Hash before;
+  sim::hash(before);
+
+  collide::setRect(2, 2, 3, 3);
+
+  sim::Hash blocked;
+  sim::hash(blocked);
+  CHECK(blocked.parts[sim::HASH_COLLIDE] != before.parts[sim::HASH_COLLIDE]);
+  CHECK(blocked.parts[sim::HASH_UNITS] == before.parts[sim::HASH_UNITS]);
+
+  // The collide part is a XOR over the set bits, clearing them restores it
+  collide::clearRect(2, 2, 3, 3);
+
+  sim::Hash cleared;
+  sim::hash(cleared);
+  CHECK(cleared.parts[sim::HASH_COLLIDE] == before.parts[sim::HASH_COLLIDE]);
+}
+
+TEST(sim, unitHashFollowsTicksAndKills)
+{
+  setupGame();
+  run(300);
+  CHECK(player::unitHash() == rehashUnits());
+
+  // Killed between ticks, the hash must not wait for the next one
+  unit::Storage const& units = player::player(1).units;
+  CHECK(units.count > 1);
+  unit::kill(units.ids[0]);
+  CHECK(player::unitHash() == rehashUnits());
+
+  run(100);
+  CHECK(player::unitHash() == rehashUnits());
+}
+
+// -- Commands --
+
+TEST(sim, killGoesThroughCommands)
+{
+  const char * filename = "sim_kill.rep";
+
+  setupGame();
+  run(30);
+
+  CHECK(replay::record(filename));
+  run(5);
+
+  const unit::ID id = player::player(1).units.ids[0];
+  char command[64];
+  snprintf(command, sizeof(command), "unit:kill %u", id);
+  CHECK(tcl::evaluate(command) == tcl::RET_OK);
+
+  // Like every command, it runs on the next tick on every peer
+  CHECK(unit::alive(id));
+  const uint64_t killTick = sim::tickCount();
+  run(1);
+  CHECK(!unit::alive(id));
+  CHECK(player::unitHash() == rehashUnits());
+
+  run(5);
+  replay::stop();
+
+  // It is part of the recorded commands, playback kills the unit too
+  CHECK(replay::play(filename));
+  CHECK(unit::alive(id));
+  CHECK(replay::seek(killTick + 1));
+  CHECK(!unit::alive(id));
+
+  replay::stop();
+  remove(filename);
+}
+
+// -- Area of interest --
+
+/// What a viewer at (x, z) limited to player sees, from scratch
+static std::vector<unit::ID> referenceInterest(float x, float z, float reach, uint32_t player)
+{
+  const float size = interest::CELL_SIZE;
+  const float halfWidth = world::width() * 0.5f, halfHeight = world::height() * 0.5f;
+  const float lastX = (world::width() - 1) / interest::CELL_SIZE, lastZ = (world::height() - 1) / interest::CELL_SIZE;
+
+  const float x0 = std::max(0.0f, std::floor((x + halfWidth - reach) / size));
+  const float z0 = std::max(0.0f, std::floor((z + halfHeight - reach) / size));
+  const float x1 = std::min(lastX, std::floor((x + halfWidth + reach) / size));
+  const float z1 = std::min(lastZ, std::floor((z + halfHeight + reach) / size));
+
+  std::vector<unit::ID> result;
+  for (uint32_t p = 0; p < player::players().size(); ++p)
+  {
+    unit::Storage const& units = player::players()[p].units;
+    for (uint32_t i = 0; i < units.count; ++i)
+    {
+      const float bx = std::min(lastX, std::floor(std::max(0.0f, units.x[i] + halfWidth) / size));
+      const float bz = std::min(lastZ, std::floor(std::max(0.0f, units.z[i] + halfHeight) / size));
+      if (bx < x0 || bx > x1 || bz < z0 || bz > z1)
+        continue;
+
+      if (player == interest::ALL_PLAYERS || p == player || fog::visibleAt(player, units.x[i], units.z[i]))
+        result.push_back(units.ids[i]);
+    }
+  }
+
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+static std::vector<unit::ID> sortedInterest(uint32_t viewer)
+{
+  std::vector<unit::ID> result = interest::collect(viewer);
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+TEST(sim, interestSetsMatchRescan)
+{
+  setupGame();
+  interest::clear();
+  interest::setRadius(10.0f);
+  interest::setMargin(8.0f);
+
+  const uint32_t everything = interest::addViewer();
+  const uint32_t own = interest::addViewer();
+  const uint32_t moving = interest::addViewer();
+
+  interest::setView(everything, -8.0f, -8.0f);
+  interest::setView(own, -8.0f, -8.0f);
+  interest::setPlayer(own, 0);
+  interest::setPlayer(moving, 1);
+
+  bool matches = true;
+  for (uint32_t step = 0; step < 40; ++step)
+  {
+    run(10);
+
+    // Deaths between updates leave every set they were in
+    if (step % 8 == 7 && player::player(0).units.count > 0)
+      unit::kill(player::player(0).units.ids[0]);
+
+    interest::update();
+
+    // The camera sweeps across the map, in and out of buckets
+    const float cameraX = -30.0f + step * 1.5f;
+    const float cameraZ = 20.0f - step;
+    interest::setView(moving, cameraX, cameraZ);
+
+    matches = matches && sortedInterest(everything) == referenceInterest(-8.0f, -8.0f, 18.0f, interest::ALL_PLAYERS);
+    matches = matches && sortedInterest(own) == referenceInterest(-8.0f, -8.0f, 18.0f, 0);
+    matches = matches && sortedInterest(moving) == referenceInterest(cameraX, cameraZ, 18.0f, 1);
+  }
+
+  CHECK(matches);
+  CHECK(!interest::collect(own).empty());
+  CHECK(!interest::collect(moving).empty());
+
+  interest::clear();
+  interest::setRadius(40.0f);
+}
+
+// -- Replays --
+
+static long fileSize(const char * filename)
+{
+  FILE * file = fopen(filename, "rb");
+  if (!file)
+    return -1;
+
+  fseek(file, 0, SEEK_END);
+  const long size = ftell(file);
+  fclose(file);
+  return size;
+}
+
+TEST(sim, replayKeyframesStayCompact)
+{
+  const char * filename = "sim_test.rep";
+  const uint32_t interval = 40;
+  const uint32_t keyframes = 30;
+
+  // A new unit per player every tick, so the match is at thousands of units
+  // by the end, with keyframes close enough together that it has thirty
+  setupGame();
+  for (uint32_t p = 0; p < 2; ++p)
+    player::player(p).spawnRate = 0.0f;
+
+  replay::setKeyframeInterval(interval);
+  CHECK(replay::record(filename));
+
+  // Units over all keyframes, each is written when its interval starts
+  uint32_t keyframeUnits = 0;
+  for (uint32_t i = 0; i < keyframes - 1; ++i)
+  {
+    keyframeUnits += unitCount();
+    run(interval);
+  }
+
+  keyframeUnits += unitCount();
+  run(interval / 2);
+
+  sim::Hash recorded;
+  sim::hash(recorded);
+  const uint64_t recordedTick = sim::tickCount();
+
+  run(interval / 2);
+  CHECK(unitCount() > 2000);
+  replay::stop();
+
+  // Keyframes from sim::save() come to over 40 bytes a unit compressed. At
+  // the pace of a normal game, a unit every ten seconds and a keyframe every
+  // two minutes, this budget fits a 30 minute match in well under 100 KB.
+  const long size = fileSize(filename);
+  CHECK(size > 0 && size < (long)keyframeUnits * 24 + keyframes * 1024);
+
+  // The derived state comes back from the compact keyframe bit for bit
+  CHECK(replay::play(filename));
+  CHECK(replay::seek(recordedTick));
+
+  sim::Hash played;
+  sim::hash(played);
+  CHECK(equal(recorded, played));
+
+  replay::stop();
+  replay::setKeyframeInterval(3600);
+  remove(filename);
+}
@@ -0,0 +1,222 @@
+#include "test.h"
+#include "snapshot.h"
+#include "player.h"
+#include "world.h"
+#include "sim.h"
+
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+
+// -- Helpers --
+
+static snapshot::Unit makeUnit(uint8_t player, uint32_t index, uint32_t generation, int32_t x, int32_t z, int32_t vx, int32_t vz)
+{
+  snapshot::Unit unit;
+  unit.id = (generation << unit::INDEX_BITS) | index;
+  unit.player = player;
+  unit.x = x;
+  unit.z = z;
+  unit.vx = vx;
+  unit.vz = vz;
+  return unit;
+}
+
+static void setHeader(snapshot::Snapshot & snapshot, uint32_t sequence, uint32_t tick)
+{
+  snapshot.sequence = sequence;
+  snapshot.tick = tick;
+  snapshot.tickRate = 30;
+  snapshot.width = 100;
+  snapshot.height = 80;
+  snapshot.players = 2;
+}
+
+static bool equal(snapshot::Snapshot const& a, snapshot::Snapshot const& b)
+{
+  if (a.sequence != b.sequence || a.tick != b.tick || a.tickRate != b.tickRate ||
+      a.width != b.width || a.height != b.height || a.players != b.players ||
+      a.units.size() != b.units.size())
+    return false;
+
+  for (size_t i = 0; i < a.units.size(); ++i)
+  {
+    snapshot::Unit const& u = a.units[i];
+    snapshot::Unit const& v = b.units[i];
+    if (u.id != v.id || u.player != v.player || u.x != v.x || u.z != v.z || u.vx != v.vx || u.vz != v.vz)
+      return false;
+  }
+
+  return true;
+}
+
+/// Random units sorted by player and index, inside a 100 x 80 world. The
+/// slot after every unit is left free.
+static void randomUnits(snapshot::Snapshot & snapshot, uint32_t count)
+{
+  const int32_t maxX = 100 * snapshot::POSITION_SCALE;
+  const int32_t maxZ = 80 * snapshot::POSITION_SCALE;
+
+  uint32_t index = 1;
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    index += 2 + rand() % 5;
+    snapshot.units.push_back(makeUnit(i < count / 2 ? 0 : 1, index, 1 + rand() % 100,
+                                      rand() % (maxX + 1), rand() % (maxZ + 1),
+                                      rand() % 2001 - 1000, rand() % 2001 - 1000));
+  }
+}
+
+// -- Encoding --
+
+TEST(snapshot, fullRoundTrip)
+{
+  srand(1);
+
+  snapshot::Snapshot original;
+  setHeader(original, 7, 1000);
+  randomUnits(original, 200);
+
+  std::vector<uint8_t> data;
+  snapshot::encode(original, NULL, data);
+  CHECK(snapshot::baselineOf(&data[0], data.size()) == snapshot::NO_BASELINE);
+
+  snapshot::Snapshot decoded;
+  CHECK(snapshot::decode(&data[0], data.size(), NULL, decoded));
+  CHECK(equal(original, decoded));
+}
+
+TEST(snapshot, deltaRoundTrip)
+{
+  srand(2);
+
+  snapshot::Snapshot baseline;
+  setHeader(baseline, 10, 300);
+  randomUnits(baseline, 200);
+
+  // Ten ticks later, some units removed, some changed, some replaced by a
+  // new unit in the same slot and a few new ones
+  snapshot::Snapshot current;
+  setHeader(current, 11, 310);
+
+  for (size_t i = 0; i < baseline.units.size(); ++i)
+  {
+    snapshot::Unit unit = baseline.units[i];
+
+    switch (i % 5)
+    {
+      case 0:
+        continue;
+
+      case 1:
+        unit.x = std::min<int32_t>(unit.x + 17, 100 * snapshot::POSITION_SCALE);
+        unit.vz = -unit.vz;
+        break;
+
+      case 2:
+        unit.id = ((unit::generation(unit.id) + 1) << unit::INDEX_BITS) | unit::index(unit.id);
+        break;
+    }
+
+    current.units.push_back(unit);
+
+    if (i % 37 == 0)
+      current.units.push_back(makeUnit(unit.player, unit::index(unit.id) + 1, 3, 5, 6, 7, 8));
+  }
+
+  std::vector<uint8_t> data;
+  snapshot::encode(current, &baseline, data);
+  CHECK(snapshot::baselineOf(&data[0], data.size()) == baseline.sequence);
+
+  snapshot::Snapshot decoded;
+  CHECK(snapshot::decode(&data[0], data.size(), &baseline, decoded));
+  CHECK(equal(current, decoded));
+}
+
+TEST(snapshot, unchangedUnitsAreCheap)
+{
+  // Units moving at constant velocity land exactly on the prediction
+  snapshot::Snapshot baseline;
+  setHeader(baseline, 1, 0);
+  for (uint32_t i = 0; i < 100; ++i)
+    baseline.units.push_back(makeUnit(0, i + 1, 1, 1000 + i, 2000, 0, 0));
+
+  snapshot::Snapshot current = baseline;
+  current.sequence = 2;
+  current.tick = 30;
+
+  std::vector<uint8_t> full, delta;
+  snapshot::encode(current, NULL, full);
+  snapshot::encode(current, &baseline, delta);
+  CHECK(delta.size() * 10 < full.size());
+
+  snapshot::Snapshot decoded;
+  CHECK(snapshot::decode(&delta[0], delta.size(), &baseline, decoded));
+  CHECK(equal(current, decoded));
+}
+
+TEST(snapshot, rejectsWrongBaselineAndTruncation)
+{
+  srand(3);
+
+  snapshot::Snapshot baseline;
+  setHeader(baseline, 4, 0);
+  randomUnits(baseline, 50);
+
+  snapshot::Snapshot current = baseline;
+  current.sequence = 5;
+
+  std::vector<uint8_t> data;
+  snapshot::encode(current, &baseline, data);
+
+  snapshot::Snapshot other = baseline;
+  other.sequence = 3;
+
+  snapshot::Snapshot decoded;
+  CHECK(!snapshot::decode(&data[0], data.size(), &other, decoded));
+  CHECK(!snapshot::decode(&data[0], data.size(), NULL, decoded));
+  CHECK(!snapshot::decode(&data[0], data.size() / 2, &baseline, decoded));
+}
+
+TEST(snapshot, captureFromSimulation)
+{
+  world::createEmpty(64, 64);
+  player::setup(2, 0);
+
+  for (uint32_t p = 0; p < 2; ++p)
+  {
+    unit::Storage & units = player::player(p).units;
+    for (uint32_t i = 0; i < 20; ++i)
+    {
+      unit::spawn(units);
+      units.x[i] = i - 10.0f;
+      units.z[i] = p * 5.0f;
+      units.vx[i] = 1.5f;
+    }
+  }
+
+  snapshot::Snapshot captured;
+  snapshot::capture(captured, 1);
+  CHECK(captured.units.size() == 40);
+  CHECK(captured.width == 64 && captured.height == 64 && captured.players == 2);
+
+  std::vector<uint8_t> data;
+  snapshot::encode(captured, NULL, data);
+
+  snapshot::Snapshot decoded;
+  CHECK(snapshot::decode(&data[0], data.size(), NULL, decoded));
+  CHECK(equal(captured, decoded));
+
+  // Values on the quantization grid come back exactly
+  snapshot::apply(decoded);
+  bool close = true;
+  for (uint32_t p = 0; p < 2; ++p)
+  {
+    unit::Storage const& units = player::player(p).units;
+    close = close && units.count == 20;
+    for (uint32_t i = 0; i < units.count; ++i)
+      close = close && units.z[i] == p * 5.0f && units.vx[i] == 1.5f;
+  }
+
+  CHECK(close);
+}
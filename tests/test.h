@@ -0,0 +1,24 @@
+#pragma once
+
+/// Minimal test harness. Tests are registered from static initializers like
+/// the Tcl bindings and belong to a group, ctest runs each group in its own
+/// process because the simulation can only be initialized once.
+namespace test
+{
+
+  typedef void (*Function)();
+
+  bool add(const char * group, const char * name, Function function);
+
+  /// Records a failed check, the test keeps running
+  void fail(const char * file, int line, const char * expression);
+
+}
+
+#define TEST(group, name) \
+  static void test_##group##_##name(); \
+  namespace { static bool __test##group##_##name = test::add(#group, #name, test_##group##_##name); } \
+  static void test_##group##_##name()
+
+#define CHECK(expression) \
+  do { if (!(expression)) test::fail(__FILE__, __LINE__, #expression); } while (0)
@@ -0,0 +1,148 @@
+#include "test.h"
+#include "unit.h"
+
+#include <stddef.h>
+#include <vector>
+
+// -- Handle registry --
+
+// Kills id and spawns until its slot comes back. Earlier tests leave free
+// slots behind, the units that take them on the way stay alive, so after
+// this the free list is empty.
+static unit::ID respawn(unit::Storage & storage, unit::ID id)
+{
+  unit::kill(id);
+
+  unit::ID spawned = unit::INVALID_ID;
+  do
+    spawned = unit::spawn(storage);
+  while (unit::index(spawned) != unit::index(id));
+
+  return spawned;
+}
+
+TEST(unit, spawnFindsEachUnit)
+{
+  unit::Storage storage;
+
+  std::vector<unit::ID> ids;
+  for (uint32_t i = 0; i < 100; ++i)
+    ids.push_back(unit::spawn(storage));
+
+  CHECK(storage.count == 100);
+
+  for (uint32_t i = 0; i < ids.size(); ++i)
+  {
+    uint32_t index = 0;
+    CHECK(ids[i] != unit::INVALID_ID);
+    CHECK(unit::find(ids[i], &index) == &storage);
+    CHECK(storage.ids[index] == ids[i]);
+  }
+}
+
+TEST(unit, killKeepsStorageDense)
+{
+  unit::Storage storage;
+
+  const unit::ID first = unit::spawn(storage);
+  const unit::ID middle = unit::spawn(storage);
+  const unit::ID last = unit::spawn(storage);
+  storage.x[2] = 5.0f;
+
+  unit::kill(middle);
+
+  // The last unit takes the place of the killed one
+  uint32_t index = 0;
+  CHECK(storage.count == 2);
+  CHECK(!unit::alive(middle));
+  CHECK(unit::find(middle, &index) == NULL);
+  CHECK(unit::find(last, &index) == &storage && index == 1);
+  CHECK(storage.x[1] == 5.0f);
+  CHECK(unit::find(first, &index) == &storage && index == 0);
+
+  // Killing a stale handle does nothing
+  unit::kill(middle);
+  CHECK(storage.count == 2);
+}
+
+TEST(unit, reusedSlotGetsNewGeneration)
+{
+  unit::Storage storage;
+
+  const unit::ID old = unit::spawn(storage);
+  const unit::ID reused = respawn(storage, old);
+
+  CHECK(unit::generation(reused) != unit::generation(old));
+  CHECK(unit::alive(reused));
+  CHECK(!unit::alive(old));
+
+  uint32_t index = 0;
+  CHECK(unit::find(old, &index) == NULL);
+}
+
+TEST(unit, freeSlotsAreReusedInOrder)
+{
+  unit::Storage storage;
+
+  unit::ID ids[4];
+  for (uint32_t i = 0; i < 4; ++i)
+    ids[i] = unit::spawn(storage);
+
+  ids[3] = respawn(storage, ids[3]);
+  unit::kill(ids[2]);
+  unit::kill(ids[0]);
+
+  // The slot freed first rests the longest
+  CHECK(unit::index(unit::spawn(storage)) == unit::index(ids[2]));
+  CHECK(unit::index(unit::spawn(storage)) == unit::index(ids[0]));
+}
+
+TEST(unit, generationWrapSkipsInvalidID)
+{
+  unit::Storage storage;
+
+  unit::ID id = unit::spawn(storage);
+  const uint32_t slot = unit::index(id);
+
+  // Enough round trips to wrap the generation
+  bool valid = true;
+  for (uint32_t i = 0; i <= unit::GENERATION_MASK + 1; ++i)
+  {
+    id = respawn(storage, id);
+    valid = valid && unit::generation(id) != 0 && unit::alive(id);
+  }
+
+  CHECK(valid);
+  CHECK(unit::index(id) == slot);
+}
+
+TEST(unit, spawnFailsWhenSlotsRunOut)
+{
+  unit::Storage storage;
+
+  // Slot 0 is reserved, which leaves INDEX_MASK slots. Other tests already
+  // freed some, so spawn until it fails and count the live units.
+  unit::ID id = unit::INVALID_ID;
+  do
+    id = unit::spawn(storage);
+  while (id != unit::INVALID_ID);
+
+  CHECK(unit::count() == unit::INDEX_MASK);
+  CHECK(storage.count == unit::INDEX_MASK);
+
+  // Every handle still points at a distinct slot within the index bits
+  std::vector<bool> seen(unit::INDEX_MASK + 1, false);
+  bool distinct = true;
+  for (uint32_t i = 0; i < storage.count; ++i)
+  {
+    const uint32_t slot = unit::index(storage.ids[i]);
+    distinct = distinct && slot != 0 && !seen[slot];
+    seen[slot] = true;
+  }
+
+  CHECK(distinct);
+
+  // A freed slot can be used again
+  unit::kill(storage.ids[0]);
+  CHECK(unit::spawn(storage) != unit::INVALID_ID);
+}